@@ -0,0 +1,224 @@
+#ifndef _BASIC_ARENA_H
+#define _BASIC_ARENA_H
+
+/*
+ * Simple bump-pointer arena allocator.
+ *
+ * Memory is handed out from big chunks by moving a pointer forward, and chunks are
+ * chained when one runs out. Single allocations are never freed; the arena is rolled
+ * back to a mark, or released as a whole, which costs one free() per chunk no matter
+ * how many objects were allocated.
+ *
+ * ba_allocator() gives a bm_allocator backed by the arena, so any container can use it.
+ * A NULL arena gives the NULL allocator, malloc/free, which the *_init_arena helpers
+ * pass on as well.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "basic_general.h"
+#include "basic_memory.h"
+
+/*
+ * constant macros
+ */
+
+/* the default chunk size */
+#define BA_CHUNK_SIZE 65536
+
+/* the default alignment, enough for any basic type */
+#define BA_ALIGN (2*sizeof(void *))
+
+/*
+ * type definitions
+ */
+
+/* header of a chunk, the usable memory follows it */
+struct ba_chunk {
+	struct ba_chunk *prev;
+	char *end;
+};
+
+struct ba_arena {
+	/* the current chunk, chained to the older ones */
+	struct ba_chunk *chunk;
+	/* free space of the current chunk */
+	char *ptr;
+	char *end;
+	size_t chunk_size;
+	size_t align;
+	/* allocator interface to the arena, for containers */
+	struct bm_allocator allocator;
+};
+
+/* a position in the arena to roll back to */
+struct ba_mark {
+	struct ba_chunk *chunk;
+	char *ptr;
+};
+
+/*
+ * API functions
+ */
+static inline void ba_init(struct ba_arena *arena, size_t chunk_size, size_t align);
+
+static inline void *ba_alloc(struct ba_arena *arena, size_t size);
+
+static inline void *ba_alloc_aligned(struct ba_arena *arena, size_t size, size_t align);
+
+static inline void *ba_realloc(struct ba_arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+static inline struct ba_mark ba_mark(struct ba_arena *arena);
+
+static inline void ba_reset_to_mark(struct ba_arena *arena, struct ba_mark mark);
+
+static inline void ba_reset(struct ba_arena *arena);
+
+static inline void ba_destroy(struct ba_arena *arena);
+
+static inline struct bm_allocator *ba_allocator(struct ba_arena *arena);
+
+/*
+ * private functions
+ */
+static inline char *__ba_align(char *ptr, size_t align);
+static inline void *__ba_alloc_chunk(struct ba_arena *arena, size_t size, size_t align);
+static inline void *__ba_alloc_cb(void *ctx, size_t size);
+static inline void *__ba_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size);
+
+/*
+ * inline function definitions
+ */
+
+/* chunk_size and align may be 0 for the defaults, align must be a power of 2 */
+static inline void ba_init(struct ba_arena *arena, size_t chunk_size, size_t align) {
+	arena->chunk = NULL;
+	arena->ptr = NULL;
+	arena->end = NULL;
+	arena->chunk_size = chunk_size ? chunk_size : BA_CHUNK_SIZE;
+	arena->align = align ? align : BA_ALIGN;
+	bm_init(&arena->allocator, __ba_alloc_cb, __ba_realloc_cb, NULL, arena);
+}
+
+static inline void *ba_alloc(struct ba_arena *arena, size_t size) {
+	return ba_alloc_aligned(arena, size, arena->align);
+}
+
+static inline void *ba_alloc_aligned(struct ba_arena *arena, size_t size, size_t align) {
+	char *ptr = __ba_align(arena->ptr, align);
+
+	if (arena->chunk == NULL || ptr > arena->end || size > (size_t)(arena->end-ptr))
+		return __ba_alloc_chunk(arena, size, align);
+
+	arena->ptr = ptr+size;
+	return ptr;
+}
+
+/* grows in place if ptr is the last allocation and there is room, copies otherwise */
+static inline void *ba_realloc(struct ba_arena *arena, void *ptr, size_t old_size, size_t new_size) {
+	void *neww;
+
+	if (ptr == NULL)
+		return ba_alloc(arena, new_size);
+
+	if ((char *)ptr+old_size == arena->ptr && new_size <= (size_t)(arena->end-(char *)ptr)) {
+		arena->ptr = (char *)ptr+new_size;
+		return ptr;
+	}
+
+	if (new_size <= old_size)
+		return ptr;
+
+	neww = ba_alloc(arena, new_size);
+	if (neww != NULL)
+		memcpy(neww, ptr, old_size);
+	return neww;
+}
+
+static inline struct ba_mark ba_mark(struct ba_arena *arena) {
+	struct ba_mark mark;
+
+	mark.chunk = arena->chunk;
+	mark.ptr = arena->ptr;
+	return mark;
+}
+
+static inline void ba_reset_to_mark(struct ba_arena *arena, struct ba_mark mark) {
+	struct ba_chunk *prev;
+
+	/* drop the chunks created after the mark */
+	while (arena->chunk != mark.chunk) {
+		prev = arena->chunk->prev;
+		free(arena->chunk);
+		arena->chunk = prev;
+	}
+
+	arena->ptr = mark.ptr;
+	arena->end = (mark.chunk != NULL) ? mark.chunk->end : NULL;
+}
+
+/* release everything but keep the current chunk for reuse */
+static inline void ba_reset(struct ba_arena *arena) {
+	struct ba_chunk *ptr, *prev;
+
+	if (arena->chunk == NULL)
+		return;
+
+	for (ptr = arena->chunk->prev; ptr != NULL; ptr = prev) {
+		prev = ptr->prev;
+		free(ptr);
+	}
+	arena->chunk->prev = NULL;
+	arena->ptr = (char *)(arena->chunk+1);
+	arena->end = arena->chunk->end;
+}
+
+static inline void ba_destroy(struct ba_arena *arena) {
+	struct ba_mark mark = {NULL, NULL};
+
+	ba_reset_to_mark(arena, mark);
+}
+
+static inline struct bm_allocator *ba_allocator(struct ba_arena *arena) {
+	if (arena == NULL)
+		return NULL;
+	return &arena->allocator;
+}
+
+static inline char *__ba_align(char *ptr, size_t align) {
+	return (char *)(((uintptr_t)ptr+align-1) & ~(uintptr_t)(align-1));
+}
+
+static inline void *__ba_alloc_chunk(struct ba_arena *arena, size_t size, size_t align) {
+	struct ba_chunk *chunk;
+	size_t bytes = arena->chunk_size;
+	char *ptr;
+
+	/* oversized requests get a chunk of their own */
+	if (bytes < size+align)
+		bytes = size+align;
+
+	chunk = (struct ba_chunk *)malloc(sizeof(struct ba_chunk)+bytes);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->prev = arena->chunk;
+	chunk->end = (char *)(chunk+1)+bytes;
+	arena->chunk = chunk;
+	arena->end = chunk->end;
+
+	ptr = __ba_align((char *)(chunk+1), align);
+	arena->ptr = ptr+size;
+	return ptr;
+}
+
+static inline void *__ba_alloc_cb(void *ctx, size_t size) {
+	return ba_alloc((struct ba_arena *)ctx, size);
+}
+
+static inline void *__ba_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+	return ba_realloc((struct ba_arena *)ctx, ptr, old_size, new_size);
+}
+
+#endif
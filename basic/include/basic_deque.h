@@ -0,0 +1,211 @@
+#ifndef _BASIC_DEQUE_H
+#define _BASIC_DEQUE_H
+
+/*
+ * Chase-Lev work-stealing deque.
+ *
+ * The owner thread pushes and pops at the bottom without locks, other threads steal
+ * from the top with a compare-and-swap, so the owner only synchronizes with thieves
+ * when they fight for the last element. The ring buffer doubles when it is full; old
+ * buffers may still be read by a thief, so they are kept until bd_destroy.
+ *
+ * This follows "Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop,
+ * Cohen, Zappa Nardelli, PPoPP 2013). NULL can't be pushed, since it means empty.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "basic_general.h"
+
+/*
+ * constant macros
+ */
+
+/* the default capacity, must be a power of 2 */
+#define BD_INIT_CAPACITY 64
+
+/* results of bd_steal */
+#define BD_EMPTY 1
+#define BD_ABORT 2
+
+#define BD_ALLOC_ERROR -1
+
+/*
+ * type definitions
+ */
+typedef void * bd_data;
+
+struct bd_array {
+	long size;
+	/* the array it replaced, kept for the thieves that may still read it */
+	struct bd_array *prev;
+	_Atomic(bd_data) buf[];
+};
+
+struct bd_deque {
+	/* top and bottom on separate cache lines, thieves only write top */
+	_Alignas(64) atomic_long top;
+	_Alignas(64) atomic_long bottom;
+	_Atomic(struct bd_array *) array;
+};
+
+/*
+ * API functions
+ */
+static inline int bd_init(struct bd_deque *deque, long capacity);
+
+static inline void bd_destroy(struct bd_deque *deque);
+
+static inline long bd_num_elem(struct bd_deque *deque);
+
+static inline int bd_push(struct bd_deque *deque, bd_data data);
+
+static inline bd_data bd_pop(struct bd_deque *deque);
+
+static inline int bd_steal(struct bd_deque *deque, bd_data *data);
+
+/*
+ * private functions
+ */
+static inline struct bd_array *__bd_array_new(long size, struct bd_array *prev);
+static inline struct bd_array *__bd_grow(struct bd_deque *deque, struct bd_array *array, long top, long bottom);
+
+/*
+ * inline function definitions
+ */
+
+/* capacity may be 0 for the default, it is rounded up to a power of 2 */
+static inline int bd_init(struct bd_deque *deque, long capacity) {
+	struct bd_array *array;
+	long size = 1;
+
+	if (capacity <= 0)
+		capacity = BD_INIT_CAPACITY;
+	while (size < capacity)
+		size *= 2;
+
+	array = __bd_array_new(size, NULL);
+	if (array == NULL)
+		return BD_ALLOC_ERROR;
+
+	atomic_init(&deque->top, 0);
+	atomic_init(&deque->bottom, 0);
+	atomic_init(&deque->array, array);
+	return 0;
+}
+
+/* no other thread may use the deque anymore */
+static inline void bd_destroy(struct bd_deque *deque) {
+	struct bd_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+	struct bd_array *prev;
+
+	while (array != NULL) {
+		prev = array->prev;
+		free(array);
+		array = prev;
+	}
+	atomic_store_explicit(&deque->array, NULL, memory_order_relaxed);
+}
+
+/* only exact when no other thread is using the deque */
+static inline long bd_num_elem(struct bd_deque *deque) {
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	return (bottom > top) ? bottom-top : 0;
+}
+
+/* owner only */
+static inline int bd_push(struct bd_deque *deque, bd_data data) {
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	struct bd_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+	if (bottom-top > array->size-1) {
+		array = __bd_grow(deque, array, top, bottom);
+		if (array == NULL)
+			return BD_ALLOC_ERROR;
+	}
+
+	atomic_store_explicit(&array->buf[bottom & (array->size-1)], data, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
+	return 0;
+}
+
+/* owner only, returns NULL if the deque is empty */
+static inline bd_data bd_pop(struct bd_deque *deque) {
+	long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed)-1;
+	struct bd_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+	bd_data data = NULL;
+	long top;
+
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top <= bottom) {
+		data = atomic_load_explicit(&array->buf[bottom & (array->size-1)], memory_order_relaxed);
+		if (top == bottom) {
+			/* the last element, race the thieves for it */
+			if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top+1,
+					memory_order_seq_cst, memory_order_relaxed))
+				data = NULL;
+			atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&deque->bottom, bottom+1, memory_order_relaxed);
+	}
+
+	return data;
+}
+
+/* any thread, returns 0, BD_EMPTY, or BD_ABORT if another thread won the race */
+static inline int bd_steal(struct bd_deque *deque, bd_data *data) {
+	long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	struct bd_array *array;
+	long bottom;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+	if (top >= bottom)
+		return BD_EMPTY;
+
+	array = atomic_load_explicit(&deque->array, memory_order_acquire);
+	*data = atomic_load_explicit(&array->buf[top & (array->size-1)], memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top+1,
+			memory_order_seq_cst, memory_order_relaxed))
+		return BD_ABORT;
+
+	return 0;
+}
+
+static inline struct bd_array *__bd_array_new(long size, struct bd_array *prev) {
+	struct bd_array *array;
+
+	array = (struct bd_array *)malloc(sizeof(struct bd_array)+size*sizeof(_Atomic(bd_data)));
+	if (array == NULL)
+		return NULL;
+
+	array->size = size;
+	array->prev = prev;
+	return array;
+}
+
+static inline struct bd_array *__bd_grow(struct bd_deque *deque, struct bd_array *array, long top, long bottom) {
+	struct bd_array *neww = __bd_array_new(array->size*2, array);
+	bd_data data;
+	long i;
+
+	if (neww == NULL)
+		return NULL;
+
+	for (i = top; i < bottom; i++) {
+		data = atomic_load_explicit(&array->buf[i & (array->size-1)], memory_order_relaxed);
+		atomic_store_explicit(&neww->buf[i & (neww->size-1)], data, memory_order_relaxed);
+	}
+	atomic_store_explicit(&deque->array, neww, memory_order_release);
+	return neww;
+}
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef _BASIC_HASH_H
+#define _BASIC_HASH_H
+
+/*
+ * Open-addressing hash map with group probing (SwissTable layout).
+ *
+ * BH_DEFINE(name, key_type, value_type, hash_func, eq_func) generates struct name and
+ * the name_* functions for a flat map storing keys and values inline. Every slot has
+ * a control byte: BH_EMPTY, BH_DELETED, or the low 7 bits of the hash of its key. A
+ * lookup loads a group of 16 control bytes and compares them to the hash all at once
+ * (with SSE2 when available), so most misses and hits cost one or two cache lines.
+ *
+ * Erasing a key only leaves a tombstone when a probe could have passed over the slot
+ * while its group was full, which is rare below the maximum load of 7/8. Tombstones
+ * are dropped when the table is rehashed, which happens in place (same capacity)
+ * if most of the used slots are tombstones.
+ *
+ * Example:
+ *	BH_DEFINE(id_map, uint64_t, int, bh_hash_uint64, bh_eq_scalar)
+ *
+ *	struct id_map map;
+ *	id_map_init(&map);
+ *	id_map_insert(&map, 42, 1);
+ *	value = id_map_find(&map, 42);
+ *	id_map_destroy(&map);
+ *
+ * Keys and values are copied by assignment. Pointers to values are invalidated by any
+ * insertion that rehashes the table.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "basic_general.h"
+#include "basic_memory.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * constant macros
+ */
+
+/* number of control bytes probed at once */
+#define BH_GROUP_WIDTH 16
+
+/* the smallest table, must not be smaller than a group */
+#define BH_MIN_CAPACITY 16
+
+/* control byte values, full slots have the 7 bit hash (>= 0) */
+#define BH_EMPTY ((int8_t)-128)
+#define BH_DELETED ((int8_t)-2)
+
+#define BH_ALLOC_ERROR -1
+
+/*
+ * hash and equality functions for common key types
+ */
+static inline uint64_t bh_hash_uint64(uint64_t key) {
+	/* the finalizer of MurmurHash3, every bit of the key affects every bit of the hash */
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/* FNV-1a, with a final mix because the control bytes use the low bits */
+static inline uint64_t bh_hash_str(const char *key) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*key != '\0') {
+		hash ^= (unsigned char)*key++;
+		hash *= 0x100000001b3ULL;
+	}
+	return bh_hash_uint64(hash);
+}
+
+#define bh_eq_scalar(key1, key2) ((key1) == (key2))
+
+#define bh_eq_str(key1, key2) (strcmp((key1), (key2)) == 0)
+
+/*
+ * private functions
+ */
+
+/* bit i of the result is set if byte i of the group equals value */
+static inline uint32_t __bh_match(const int8_t *ctrl, int8_t value) {
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < BH_GROUP_WIDTH; i++)
+		mask |= (uint32_t)(ctrl[i] == value) << i;
+	return mask;
+#endif
+}
+
+/* empty and deleted slots are the ones with the sign bit set */
+static inline uint32_t __bh_match_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	uint32_t mask = 0;
+	int i;
+
+	for (i = 0; i < BH_GROUP_WIDTH; i++)
+		mask |= (uint32_t)(ctrl[i] < 0) << i;
+	return mask;
+#endif
+}
+
+static inline size_t __bh_max_load(size_t capacity) {
+	return capacity-capacity/8;
+}
+
+/*
+ * API macros
+ */
+
+/* iterates over the slots in use, pos is a pointer to struct name_slot */
+#define BH_FOREACH(pos, map)		\
+	for(pos = (map)->slots; pos < (map)->slots+(map)->capacity; pos++)	\
+		if ((map)->ctrl[pos-(map)->slots] >= 0)
+
+/*
+ * BH_DEFINE - generate a hash map type and its functions
+ * @name:	the name of the struct, and the prefix of the functions
+ * @ktype:	the key type
+ * @vtype:	the value type
+ * @hash:	function or macro taking a key and returning a uint64_t hash
+ * @eq:		function or macro taking two keys and returning non-zero if they are equal
+ *
+ * struct name_slot {ktype key; vtype value;}
+ * struct name {struct name_slot *slots; int8_t *ctrl; size_t capacity; size_t size; ...}
+ *
+ * void name_init(struct name *map);
+ * void name_init_with_allocator(struct name *map, const struct bm_allocator *alloc);
+ * void name_destroy(struct name *map);
+ * void name_clear(struct name *map);
+ * size_t name_size(struct name *map);
+ * int name_reserve(struct name *map, size_t num);
+ * vtype *name_find(struct name *map, ktype key);		NULL if the key is missing
+ * vtype *name_emplace(struct name *map, ktype key, int *inserted);	NULL on alloc error
+ * int name_insert(struct name *map, ktype key, vtype value);	replaces an existing value
+ * int name_insert_bulk(struct name *map, const ktype *keys, const vtype *values, size_t num);
+ * int name_erase(struct name *map, ktype key);			1 if the key was there
+ */
+#define BH_DEFINE(name, ktype, vtype, hash, eq)		\
+									\
+struct name##_slot {						\
+	ktype key;							\
+	vtype value;							\
+};									\
+									\
+struct name {							\
+	struct name##_slot *slots;					\
+	/* capacity+BH_GROUP_WIDTH control bytes, the first group is cloned at the end */	\
+	int8_t *ctrl;							\
+	size_t capacity;						\
+	size_t size;							\
+	/* number of empty slots that can still be used before a rehash */	\
+	size_t growth_left;						\
+	/* allocator for the table, NULL for malloc/free */		\
+	const struct bm_allocator *alloc;			\
+};									\
+									\
+static inline void name##_init_with_allocator(struct name *map, const struct bm_allocator *alloc) {	\
+	map->slots = NULL;						\
+	map->ctrl = NULL;						\
+	map->capacity = 0;						\
+	map->size = 0;							\
+	map->growth_left = 0;						\
+	map->alloc = alloc;						\
+}									\
+									\
+static inline void name##_init(struct name *map) {		\
+	name##_init_with_allocator(map, NULL);			\
+}									\
+									\
+static inline size_t name##_alloc_size(size_t capacity) {	\
+	return capacity*sizeof(struct name##_slot)+capacity+BH_GROUP_WIDTH;	\
+}									\
+									\
+static inline void name##_destroy(struct name *map) {		\
+	if (map->slots != NULL)						\
+		bm_free(map->alloc, map->slots, name##_alloc_size(map->capacity));	\
+	name##_init_with_allocator(map, map->alloc);			\
+}									\
+									\
+static inline void name##_clear(struct name *map) {		\
+	if (map->capacity == 0)						\
+		return;							\
+	memset(map->ctrl, BH_EMPTY, map->capacity+BH_GROUP_WIDTH);	\
+	map->size = 0;							\
+	map->growth_left = __bh_max_load(map->capacity);		\
+}									\
+									\
+static inline size_t name##_size(struct name *map) {		\
+	return map->size;						\
+}									\
+									\
+static inline void name##_set_ctrl(struct name *map, size_t index, int8_t value) {	\
+	map->ctrl[index] = value;					\
+	if (index < BH_GROUP_WIDTH)					\
+		map->ctrl[map->capacity+index] = value;			\
+}									\
+									\
+/* the first empty or deleted slot on the probe sequence of hash_value */	\
+static inline size_t name##_find_free(struct name *map, uint64_t hash_value) {	\
+	size_t mask = map->capacity-1;					\
+	size_t pos = (size_t)(hash_value >> 7) & mask;			\
+	size_t step = 0;						\
+	uint32_t match;							\
+									\
+	while (1) {							\
+		match = __bh_match_free(map->ctrl+pos);			\
+		if (match)						\
+			return (pos+__builtin_ctz(match)) & mask;	\
+		step += BH_GROUP_WIDTH;					\
+		pos = (pos+step) & mask;				\
+	}								\
+}									\
+									\
+static inline struct name##_slot *name##_find_hashed(struct name *map, ktype key, uint64_t hash_value) {	\
+	size_t mask = map->capacity-1;					\
+	size_t pos = (size_t)(hash_value >> 7) & mask;			\
+	size_t step = 0;						\
+	size_t index;							\
+	uint32_t match;							\
+									\
+	if (map->capacity == 0)						\
+		return NULL;						\
+									\
+	while (1) {							\
+		match = __bh_match(map->ctrl+pos, (int8_t)(hash_value & 0x7f));	\
+		while (match) {						\
+			index = (pos+__builtin_ctz(match)) & mask;	\
+			if (eq(map->slots[index].key, key))		\
+				return &map->slots[index];		\
+			match &= match-1;				\
+		}							\
+		/* an empty slot ends the probe sequence */		\
+		if (__bh_match(map->ctrl+pos, BH_EMPTY))		\
+			return NULL;					\
+		step += BH_GROUP_WIDTH;					\
+		pos = (pos+step) & mask;				\
+	}								\
+}									\
+									\
+/* moves everything to a table of the given capacity, dropping the tombstones */	\
+static inline int name##_rehash(struct name *map, size_t capacity) {	\
+	struct name old = *map;						\
+	uint64_t hash_value;						\
+	size_t i, index;						\
+	char *block;							\
+									\
+	block = (char *)bm_alloc(map->alloc, name##_alloc_size(capacity));	\
+	if (block == NULL)						\
+		return BH_ALLOC_ERROR;					\
+									\
+	map->slots = (struct name##_slot *)block;			\
+	map->ctrl = (int8_t *)(block+capacity*sizeof(struct name##_slot));	\
+	map->capacity = capacity;					\
+	memset(map->ctrl, BH_EMPTY, capacity+BH_GROUP_WIDTH);		\
+									\
+	for (i = 0; i < old.capacity; i++) {				\
+		if (old.ctrl[i] < 0)					\
+			continue;					\
+		hash_value = hash(old.slots[i].key);			\
+		index = name##_find_free(map, hash_value);		\
+		name##_set_ctrl(map, index, (int8_t)(hash_value & 0x7f));	\
+		map->slots[index] = old.slots[i];			\
+	}								\
+	map->growth_left = __bh_max_load(capacity)-map->size;		\
+									\
+	if (old.slots != NULL)						\
+		bm_free(map->alloc, old.slots, name##_alloc_size(old.capacity));	\
+	return 0;							\
+}									\
+									\
+static inline int name##_reserve(struct name *map, size_t num) {	\
+	size_t capacity = map->capacity ? map->capacity : BH_MIN_CAPACITY;	\
+									\
+	while (__bh_max_load(capacity) < num)				\
+		capacity *= 2;						\
+	if (capacity == map->capacity)					\
+		return 0;						\
+	return name##_rehash(map, capacity);				\
+}									\
+									\
+static inline vtype *name##_emplace_hashed(struct name *map, ktype key, uint64_t hash_value, int *inserted) {	\
+	struct name##_slot *slot;					\
+	size_t capacity, index;						\
+									\
+	slot = name##_find_hashed(map, key, hash_value);		\
+	if (slot != NULL) {						\
+		if (inserted != NULL)					\
+			*inserted = 0;					\
+		return &slot->value;					\
+	}								\
+									\
+	index = map->capacity ? name##_find_free(map, hash_value) : 0;	\
+									\
+	/* reusing a tombstone needs no growth */			\
+	if (map->capacity == 0 || (map->growth_left == 0 && map->ctrl[index] == BH_EMPTY)) {	\
+		capacity = map->capacity ? map->capacity : BH_MIN_CAPACITY;	\
+		/* grow unless most of the used slots are tombstones */	\
+		if (map->size+1 > __bh_max_load(capacity)/2)		\
+			capacity *= 2;					\
+		if (name##_rehash(map, capacity))			\
+			return NULL;					\
+		index = name##_find_free(map, hash_value);		\
+	}								\
+									\
+	if (map->ctrl[index] == BH_EMPTY)				\
+		map->growth_left--;					\
+	name##_set_ctrl(map, index, (int8_t)(hash_value & 0x7f));	\
+	map->slots[index].key = key;					\
+	map->size++;							\
+									\
+	if (inserted != NULL)						\
+		*inserted = 1;						\
+	return &map->slots[index].value;				\
+}									\
+									\
+static inline vtype *name##_find(struct name *map, ktype key) {	\
+	struct name##_slot *slot = name##_find_hashed(map, key, hash(key));	\
+									\
+	return slot != NULL ? &slot->value : NULL;			\
+}									\
+									\
+static inline vtype *name##_emplace(struct name *map, ktype key, int *inserted) {	\
+	return name##_emplace_hashed(map, key, hash(key), inserted);	\
+}									\
+									\
+static inline int name##_insert(struct name *map, ktype key, vtype value) {	\
+	vtype *ptr = name##_emplace(map, key, NULL);			\
+									\
+	if (ptr == NULL)						\
+		return BH_ALLOC_ERROR;					\
+	*ptr = value;							\
+	return 0;							\
+}									\
+									\
+/* sizes the table once, and hashes a group of keys ahead to prefetch their slots */	\
+static inline int name##_insert_bulk(struct name *map, const ktype *keys, const vtype *values, size_t num) {	\
+	uint64_t hashes[BH_GROUP_WIDTH];				\
+	size_t i, j, n;							\
+	vtype *ptr;							\
+									\
+	if (name##_reserve(map, map->size+num))			\
+		return BH_ALLOC_ERROR;					\
+									\
+	for (i = 0; i < num; i += n) {					\
+		n = num-i < BH_GROUP_WIDTH ? num-i : BH_GROUP_WIDTH;	\
+		for (j = 0; j < n; j++) {				\
+			hashes[j] = hash(keys[i+j]);			\
+			__builtin_prefetch(map->ctrl+((hashes[j] >> 7) & (map->capacity-1)));	\
+		}							\
+		for (j = 0; j < n; j++) {				\
+			ptr = name##_emplace_hashed(map, keys[i+j], hashes[j], NULL);	\
+			if (ptr == NULL)				\
+				return BH_ALLOC_ERROR;			\
+			*ptr = values[i+j];				\
+		}							\
+	}								\
+	return 0;							\
+}									\
+									\
+static inline int name##_erase(struct name *map, ktype key) {	\
+	struct name##_slot *slot = name##_find_hashed(map, key, hash(key));	\
+	size_t index, before;						\
+	uint32_t empty_after, empty_before;				\
+									\
+	if (slot == NULL)						\
+		return 0;						\
+									\
+	/*								\
+	 * The slot can become empty again if every group containing it also has an	\
+	 * empty slot, since then no probe sequence ever went past it.	\
+	 */								\
+	index = slot-map->slots;					\
+	before = (index-BH_GROUP_WIDTH) & (map->capacity-1);		\
+	empty_after = __bh_match(map->ctrl+index, BH_EMPTY);		\
+	empty_before = __bh_match(map->ctrl+before, BH_EMPTY);		\
+	if (empty_after && empty_before &&				\
+			__builtin_ctz(empty_after)+__builtin_clz(empty_before << 16) < BH_GROUP_WIDTH) {	\
+		name##_set_ctrl(map, index, BH_EMPTY);			\
+		map->growth_left++;					\
+	} else {							\
+		name##_set_ctrl(map, index, BH_DELETED);		\
+	}								\
+	map->size--;							\
+	return 1;							\
+}
+
+#endif
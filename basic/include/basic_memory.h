@@ -0,0 +1,74 @@
+#ifndef _BASIC_MEMORY_H
+#define _BASIC_MEMORY_H
+
+/*
+ * Pluggable allocator interface.
+ *
+ * Containers keep a pointer to an allocator and do all their allocations through it.
+ * A NULL allocator means the standard malloc/realloc/free, which is the default. The
+ * sizes of blocks are passed back on realloc and free, so allocators such as arenas
+ * and pools don't have to store them.
+ */
+
+#include <stdlib.h>
+#include "basic_general.h"
+
+/*
+ * type definitions
+ */
+typedef void * (*bm_alloc_func)(void *ctx, size_t size);
+typedef void * (*bm_realloc_func)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+typedef void (*bm_free_func)(void *ctx, void *ptr, size_t size);
+
+struct bm_allocator {
+	bm_alloc_func alloc_func;
+	bm_realloc_func realloc_func;
+	/* may be NULL if blocks are never freed one by one */
+	bm_free_func free_func;
+	/* passed as the first argument to every function */
+	void *ctx;
+};
+
+/*
+ * API functions
+ */
+static inline void bm_init(struct bm_allocator *alloc, bm_alloc_func alloc_func,
+	bm_realloc_func realloc_func, bm_free_func free_func, void *ctx);
+
+static inline void *bm_alloc(const struct bm_allocator *alloc, size_t size);
+
+static inline void *bm_realloc(const struct bm_allocator *alloc, void *ptr, size_t old_size, size_t new_size);
+
+static inline void bm_free(const struct bm_allocator *alloc, void *ptr, size_t size);
+
+/*
+ * inline function definitions
+ */
+static inline void bm_init(struct bm_allocator *alloc, bm_alloc_func alloc_func,
+		bm_realloc_func realloc_func, bm_free_func free_func, void *ctx) {
+	alloc->alloc_func = alloc_func;
+	alloc->realloc_func = realloc_func;
+	alloc->free_func = free_func;
+	alloc->ctx = ctx;
+}
+
+static inline void *bm_alloc(const struct bm_allocator *alloc, size_t size) {
+	if (alloc == NULL)
+		return malloc(size);
+	return alloc->alloc_func(alloc->ctx, size);
+}
+
+static inline void *bm_realloc(const struct bm_allocator *alloc, void *ptr, size_t old_size, size_t new_size) {
+	if (alloc == NULL)
+		return realloc(ptr, new_size);
+	return alloc->realloc_func(alloc->ctx, ptr, old_size, new_size);
+}
+
+static inline void bm_free(const struct bm_allocator *alloc, void *ptr, size_t size) {
+	if (alloc == NULL)
+		free(ptr);
+	else if (alloc->free_func != NULL)
+		alloc->free_func(alloc->ctx, ptr, size);
+}
+
+#endif
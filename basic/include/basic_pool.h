@@ -0,0 +1,448 @@
+#ifndef _BASIC_POOL_H
+#define _BASIC_POOL_H
+
+/*
+ * Fixed-size object pool with per-thread caches.
+ *
+ * Objects are carved out of big slabs and recycled through free lists, so allocating a
+ * container element is a few pointer moves instead of a malloc. The pool itself is shared
+ * and protected by a mutex; each thread allocates through its own bp_cache, which holds
+ * two magazines (arrays of free objects) and only takes the lock to swap a whole magazine
+ * with the pool's depot. Objects may be freed by a different thread than the one that
+ * allocated them.
+ *
+ * bp_allocator() and bp_cache_allocator() give a bm_allocator, so containers can use the
+ * pool as their backend, e.g. bs_init_with_allocator(&stack, bp_cache_allocator(&cache)).
+ * Requests bigger than the object size fall through to malloc/free.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "basic_general.h"
+#include "basic_memory.h"
+
+/*
+ * constant macros
+ */
+
+/* number of objects held by a magazine */
+#define BP_MAGAZINE_SIZE 64
+
+/* the default number of objects per slab */
+#define BP_SLAB_OBJECTS 1024
+
+/*
+ * type definitions
+ */
+
+/* a free object, linked through its first word */
+struct bp_object {
+	struct bp_object *next;
+};
+
+/* header of a slab, the objects follow it */
+struct bp_slab {
+	struct bp_slab *next;
+	/* keeps the objects aligned for any basic type */
+	void *pad;
+};
+
+struct bp_magazine {
+	struct bp_magazine *next;
+	int num;
+	void *objects[BP_MAGAZINE_SIZE];
+};
+
+struct bp_pool {
+	size_t obj_size;
+	size_t slab_objects;
+	pthread_mutex_t lock;
+	/* the depot, magazines with objects and empty ones */
+	struct bp_magazine *full;
+	struct bp_magazine *empty;
+	/* objects freed one by one without a cache */
+	struct bp_object *free_list;
+	/* all slabs, and the unused part of the newest one */
+	struct bp_slab *slabs;
+	char *ptr;
+	char *end;
+	/* allocator interface to the pool, takes the lock on every call */
+	struct bm_allocator allocator;
+};
+
+/* per-thread cache, must only be used by one thread at a time */
+struct bp_cache {
+	struct bp_pool *pool;
+	struct bp_magazine *loaded;
+	struct bp_magazine *previous;
+	/* allocator interface to the cache, lock-free on the fast path */
+	struct bm_allocator allocator;
+};
+
+/*
+ * API functions
+ */
+static inline void bp_init(struct bp_pool *pool, size_t obj_size, size_t slab_objects);
+
+static inline void *bp_alloc(struct bp_pool *pool);
+
+static inline void bp_free(struct bp_pool *pool, void *ptr);
+
+static inline void bp_destroy(struct bp_pool *pool);
+
+static inline struct bm_allocator *bp_allocator(struct bp_pool *pool);
+
+static inline void bp_cache_init(struct bp_cache *cache, struct bp_pool *pool);
+
+static inline void *bp_cache_alloc(struct bp_cache *cache);
+
+static inline void bp_cache_free(struct bp_cache *cache, void *ptr);
+
+static inline void bp_cache_destroy(struct bp_cache *cache);
+
+static inline struct bm_allocator *bp_cache_allocator(struct bp_cache *cache);
+
+/*
+ * private functions
+ */
+static inline void *__bp_take(struct bp_pool *pool);
+static inline struct bp_magazine *__bp_get_full(struct bp_pool *pool, struct bp_magazine *empty);
+static inline struct bp_magazine *__bp_get_empty(struct bp_pool *pool, struct bp_magazine *full);
+static inline void *__bp_alloc_cb(void *ctx, size_t size);
+static inline void *__bp_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static inline void __bp_free_cb(void *ctx, void *ptr, size_t size);
+static inline void *__bp_cache_alloc_cb(void *ctx, size_t size);
+static inline void *__bp_cache_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size);
+static inline void __bp_cache_free_cb(void *ctx, void *ptr, size_t size);
+
+/*
+ * inline function definitions
+ */
+
+/* slab_objects may be 0 for the default */
+static inline void bp_init(struct bp_pool *pool, size_t obj_size, size_t slab_objects) {
+	/* free objects hold a link, and every object stays pointer aligned */
+	if (obj_size < sizeof(struct bp_object))
+		obj_size = sizeof(struct bp_object);
+	obj_size = (obj_size+sizeof(void *)-1) & ~(sizeof(void *)-1);
+
+	pool->obj_size = obj_size;
+	pool->slab_objects = slab_objects ? slab_objects : BP_SLAB_OBJECTS;
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->full = NULL;
+	pool->empty = NULL;
+	pool->free_list = NULL;
+	pool->slabs = NULL;
+	pool->ptr = NULL;
+	pool->end = NULL;
+	bm_init(&pool->allocator, __bp_alloc_cb, __bp_realloc_cb, __bp_free_cb, pool);
+}
+
+static inline void *bp_alloc(struct bp_pool *pool) {
+	void *ptr;
+
+	pthread_mutex_lock(&pool->lock);
+	ptr = __bp_take(pool);
+	pthread_mutex_unlock(&pool->lock);
+	return ptr;
+}
+
+static inline void bp_free(struct bp_pool *pool, void *ptr) {
+	struct bp_object *obj = (struct bp_object *)ptr;
+
+	if (ptr == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	obj->next = pool->free_list;
+	pool->free_list = obj;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* releases all objects at once, the caches must be destroyed before */
+static inline void bp_destroy(struct bp_pool *pool) {
+	struct bp_magazine *mag, *next_mag;
+	struct bp_slab *slab, *next_slab;
+
+	for (mag = pool->full; mag != NULL; mag = next_mag) {
+		next_mag = mag->next;
+		free(mag);
+	}
+	for (mag = pool->empty; mag != NULL; mag = next_mag) {
+		next_mag = mag->next;
+		free(mag);
+	}
+	for (slab = pool->slabs; slab != NULL; slab = next_slab) {
+		next_slab = slab->next;
+		free(slab);
+	}
+
+	pool->full = NULL;
+	pool->empty = NULL;
+	pool->free_list = NULL;
+	pool->slabs = NULL;
+	pool->ptr = NULL;
+	pool->end = NULL;
+	pthread_mutex_destroy(&pool->lock);
+}
+
+static inline struct bm_allocator *bp_allocator(struct bp_pool *pool) {
+	return &pool->allocator;
+}
+
+static inline void bp_cache_init(struct bp_cache *cache, struct bp_pool *pool) {
+	cache->pool = pool;
+	cache->loaded = NULL;
+	cache->previous = NULL;
+	bm_init(&cache->allocator, __bp_cache_alloc_cb, __bp_cache_realloc_cb, __bp_cache_free_cb, cache);
+}
+
+static inline void *bp_cache_alloc(struct bp_cache *cache) {
+	struct bp_magazine *mag = cache->loaded;
+
+	if (mag != NULL && mag->num > 0)
+		return mag->objects[--mag->num];
+
+	/* the other magazine may still have objects */
+	if (cache->previous != NULL && cache->previous->num > 0) {
+		SWAP(cache->loaded, cache->previous);
+		mag = cache->loaded;
+		return mag->objects[--mag->num];
+	}
+
+	/* both are empty, trade the previous one for a full magazine from the depot */
+	mag = __bp_get_full(cache->pool, cache->previous);
+	if (mag == NULL)
+		return NULL;
+	cache->previous = cache->loaded;
+	cache->loaded = mag;
+	return mag->objects[--mag->num];
+}
+
+static inline void bp_cache_free(struct bp_cache *cache, void *ptr) {
+	struct bp_magazine *mag = cache->loaded;
+
+	if (ptr == NULL)
+		return;
+
+	if (mag != NULL && mag->num < BP_MAGAZINE_SIZE) {
+		mag->objects[mag->num++] = ptr;
+		return;
+	}
+
+	/* the other magazine may still have room */
+	if (cache->previous != NULL && cache->previous->num < BP_MAGAZINE_SIZE) {
+		SWAP(cache->loaded, cache->previous);
+		mag = cache->loaded;
+		mag->objects[mag->num++] = ptr;
+		return;
+	}
+
+	/* both are full, trade the previous one for an empty magazine from the depot */
+	mag = __bp_get_empty(cache->pool, cache->previous);
+	if (mag == NULL) {
+		bp_free(cache->pool, ptr);
+		return;
+	}
+	cache->previous = cache->loaded;
+	cache->loaded = mag;
+	mag->objects[mag->num++] = ptr;
+}
+
+/* gives the cached objects back to the pool */
+static inline void bp_cache_destroy(struct bp_cache *cache) {
+	struct bp_pool *pool = cache->pool;
+	struct bp_magazine *mags[2] = {cache->loaded, cache->previous};
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < 2; i++) {
+		if (mags[i] == NULL)
+			continue;
+		if (mags[i]->num > 0) {
+			mags[i]->next = pool->full;
+			pool->full = mags[i];
+		} else {
+			mags[i]->next = pool->empty;
+			pool->empty = mags[i];
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	cache->loaded = NULL;
+	cache->previous = NULL;
+}
+
+static inline struct bm_allocator *bp_cache_allocator(struct bp_cache *cache) {
+	return &cache->allocator;
+}
+
+/* takes one object from the free list or the slabs, the lock must be held */
+static inline void *__bp_take(struct bp_pool *pool) {
+	struct bp_object *obj = pool->free_list;
+	struct bp_slab *slab;
+	char *ptr;
+
+	if (obj != NULL) {
+		pool->free_list = obj->next;
+		return obj;
+	}
+
+	if (pool->ptr == pool->end) {
+		slab = (struct bp_slab *)malloc(sizeof(struct bp_slab)+pool->obj_size*pool->slab_objects);
+		if (slab == NULL)
+			return NULL;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+		pool->ptr = (char *)(slab+1);
+		pool->end = pool->ptr+pool->obj_size*pool->slab_objects;
+	}
+
+	ptr = pool->ptr;
+	pool->ptr += pool->obj_size;
+	return ptr;
+}
+
+/* gets a magazine with objects, the empty one (may be NULL) goes to the depot on success */
+static inline struct bp_magazine *__bp_get_full(struct bp_pool *pool, struct bp_magazine *empty) {
+	struct bp_magazine *mag;
+
+	pthread_mutex_lock(&pool->lock);
+	mag = pool->full;
+	if (mag != NULL) {
+		pool->full = mag->next;
+		if (empty != NULL) {
+			empty->next = pool->empty;
+			pool->empty = empty;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		return mag;
+	}
+
+	/* no magazine in the depot, fill one in a batch */
+	mag = empty;
+	if (mag == NULL) {
+		mag = (struct bp_magazine *)malloc(sizeof(struct bp_magazine));
+		if (mag == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		mag->num = 0;
+	}
+	while (mag->num < BP_MAGAZINE_SIZE) {
+		mag->objects[mag->num] = __bp_take(pool);
+		if (mag->objects[mag->num] == NULL)
+			break;
+		mag->num++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (mag->num == 0) {
+		if (empty == NULL)
+			free(mag);
+		return NULL;
+	}
+	return mag;
+}
+
+/* gets an empty magazine, the full one (may be NULL) goes to the depot on success */
+static inline struct bp_magazine *__bp_get_empty(struct bp_pool *pool, struct bp_magazine *full) {
+	struct bp_magazine *mag;
+
+	pthread_mutex_lock(&pool->lock);
+	mag = pool->empty;
+	if (mag != NULL)
+		pool->empty = mag->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (mag == NULL) {
+		mag = (struct bp_magazine *)malloc(sizeof(struct bp_magazine));
+		if (mag == NULL)
+			return NULL;
+	}
+	mag->num = 0;
+
+	if (full != NULL) {
+		pthread_mutex_lock(&pool->lock);
+		full->next = pool->full;
+		pool->full = full;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return mag;
+}
+
+static inline void *__bp_alloc_cb(void *ctx, size_t size) {
+	struct bp_pool *pool = (struct bp_pool *)ctx;
+
+	if (size > pool->obj_size)
+		return malloc(size);
+	return bp_alloc(pool);
+}
+
+static inline void *__bp_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+	struct bp_pool *pool = (struct bp_pool *)ctx;
+	void *neww;
+
+	if (ptr == NULL)
+		return __bp_alloc_cb(ctx, new_size);
+	if (new_size <= pool->obj_size && old_size <= pool->obj_size)
+		return ptr;
+	if (new_size > pool->obj_size && old_size > pool->obj_size)
+		return realloc(ptr, new_size);
+
+	neww = __bp_alloc_cb(ctx, new_size);
+	if (neww != NULL) {
+		memcpy(neww, ptr, old_size < new_size ? old_size : new_size);
+		__bp_free_cb(ctx, ptr, old_size);
+	}
+	return neww;
+}
+
+static inline void __bp_free_cb(void *ctx, void *ptr, size_t size) {
+	struct bp_pool *pool = (struct bp_pool *)ctx;
+
+	if (size > pool->obj_size)
+		free(ptr);
+	else
+		bp_free(pool, ptr);
+}
+
+static inline void *__bp_cache_alloc_cb(void *ctx, size_t size) {
+	struct bp_cache *cache = (struct bp_cache *)ctx;
+
+	if (size > cache->pool->obj_size)
+		return malloc(size);
+	return bp_cache_alloc(cache);
+}
+
+static inline void *__bp_cache_realloc_cb(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+	struct bp_cache *cache = (struct bp_cache *)ctx;
+	size_t obj_size = cache->pool->obj_size;
+	void *neww;
+
+	if (ptr == NULL)
+		return __bp_cache_alloc_cb(ctx, new_size);
+	if (new_size <= obj_size && old_size <= obj_size)
+		return ptr;
+	if (new_size > obj_size && old_size > obj_size)
+		return realloc(ptr, new_size);
+
+	neww = __bp_cache_alloc_cb(ctx, new_size);
+	if (neww != NULL) {
+		memcpy(neww, ptr, old_size < new_size ? old_size : new_size);
+		__bp_cache_free_cb(ctx, ptr, old_size);
+	}
+	return neww;
+}
+
+static inline void __bp_cache_free_cb(void *ctx, void *ptr, size_t size) {
+	struct bp_cache *cache = (struct bp_cache *)ctx;
+
+	if (size > cache->pool->obj_size)
+		free(ptr);
+	else
+		bp_cache_free(cache, ptr);
+}
+
+#endif
@@ -6,8 +6,11 @@
  *
  */
 
+#include <string.h>
 #include "basic_list.h"
 #include "basic_general.h"
+#include "basic_memory.h"
+#include "basic_arena.h"
 
 /*
  * type definitions
@@ -23,6 +26,8 @@ typedef struct bq_elem bq_elem;
 struct bq_queue {
 	struct bl_head head;
 	int num;
+	/* allocator for the elements, NULL for malloc/free */
+	const struct bm_allocator *alloc;
 };
 
 typedef void bq_cleanup_ret;
@@ -34,6 +39,10 @@ typedef bq_cleanup_ret (*bq_cleanup_func)(bq_data, bq_cleanup_args);
  */
 static inline void bq_init(struct bq_queue *queue);
 
+static inline void bq_init_with_allocator(struct bq_queue *queue, const struct bm_allocator *alloc);
+
+static inline void bq_init_arena(struct bq_queue *queue, struct ba_arena *arena);
+
 static inline int bq_is_empty(struct bq_queue *queue);
 
 static inline int bq_num_elem(struct bq_queue *queue);
@@ -110,6 +119,16 @@ static inline bq_data __bq_peek(struct bq_queue *queue, int head);
 static inline void bq_init(struct bq_queue *queue) {
 	BL_INIT_HEAD(&queue->head);
 	queue->num = 0;
+	queue->alloc = NULL;
+}
+
+static inline void bq_init_with_allocator(struct bq_queue *queue, const struct bm_allocator *alloc) {
+	bq_init(queue);
+	queue->alloc = alloc;
+}
+
+static inline void bq_init_arena(struct bq_queue *queue, struct ba_arena *arena) {
+	bq_init_with_allocator(queue, ba_allocator(arena));
 }
 
 static inline int bq_is_empty(struct bq_queue *queue) {
@@ -176,7 +195,7 @@ static inline void bq_destroy(struct bq_queue *queue, bq_cleanup_func func, bq_c
 }
 
 static inline void __bq_push(bq_data data, struct bq_queue *queue, int head) {
-	bq_elem *elem = (bq_elem *)malloc(sizeof(bq_elem));
+	bq_elem *elem = (bq_elem *)bm_alloc(queue->alloc, sizeof(bq_elem));
 
 	BL_INIT_HEAD(&elem->list);
 	elem->data = data;
@@ -204,7 +223,7 @@ static inline bq_data __bq_pop(struct bq_queue *queue, int head) {
 		data = elem->data;
 		bl_del(node);
 		queue->num--;
-		free(elem);
+		bm_free(queue->alloc, elem, sizeof(bq_elem));
 		return data;
 	} else {
 		return NULL;
@@ -228,4 +247,176 @@ static inline bq_data __bq_peek(struct bq_queue *queue, int head) {
 	}
 }
 
+/*
+ * Type-specialized queues
+ *
+ * BQ_DEFINE(name, type) generates struct name and the name_* functions for a queue
+ * storing type elements by value in a growable ring buffer, so pushing an element
+ * needs no allocation of its own and no pointer chasing. Elements are copied by
+ * assignment.
+ *
+ * struct name {type *elems; int head; int num; int max; const struct bm_allocator *alloc;}
+ *
+ * void name_init(struct name *queue);
+ * void name_init_with_allocator(struct name *queue, const struct bm_allocator *alloc);
+ * int name_is_empty(struct name *queue);
+ * int name_num_elem(struct name *queue);
+ * int name_push_head(type data, struct name *queue);	0 or BQ_ALLOC_ERROR
+ * int name_push_tail(type data, struct name *queue);
+ * int name_push(type data, struct name *queue);		same as push_tail
+ * int name_pop_head(struct name *queue, type *data);	0 if the queue is empty
+ * int name_pop_tail(struct name *queue, type *data);
+ * int name_pop(struct name *queue, type *data);		same as pop_head
+ * type *name_peek_head(struct name *queue);		NULL if the queue is empty
+ * type *name_peek_tail(struct name *queue);
+ * type *name_peek(struct name *queue);			same as peek_head
+ * void name_destroy(struct name *queue, name_cleanup_func func, bq_cleanup_args args);
+ */
+
+/* the capacity of the first allocation, must be a power of 2 */
+#define BQ_INIT_CAPACITY 8
+
+#define BQ_ALLOC_ERROR -1
+
+/* from the head to the tail of a queue generated by BQ_DEFINE, i is an int counter */
+#define BQ_TYPED_FOREACH(pos, i, queue)		\
+	for(i = 0; i < (queue)->num &&		\
+		((pos = &(queue)->elems[((queue)->head+i) & ((queue)->max-1)]), 1); i++)
+
+#define BQ_DEFINE(name, type)		\
+									\
+struct name {							\
+	/* ring buffer of max elements, max is a power of 2 */	\
+	type *elems;							\
+	int head;							\
+	int num;							\
+	int max;							\
+	/* allocator for the array, NULL for malloc/free */		\
+	const struct bm_allocator *alloc;			\
+};									\
+									\
+typedef bq_cleanup_ret (*name##_cleanup_func)(type *, bq_cleanup_args);	\
+									\
+static inline void name##_init_with_allocator(struct name *queue, const struct bm_allocator *alloc) {	\
+	queue->elems = NULL;						\
+	queue->head = 0;						\
+	queue->num = 0;							\
+	queue->max = 0;							\
+	queue->alloc = alloc;						\
+}									\
+									\
+static inline void name##_init(struct name *queue) {		\
+	name##_init_with_allocator(queue, NULL);			\
+}									\
+									\
+static inline int name##_is_empty(struct name *queue) {	\
+	return (queue->num == 0);					\
+}									\
+									\
+static inline int name##_num_elem(struct name *queue) {	\
+	return (queue->num);						\
+}									\
+									\
+/* doubles the ring and unwraps it, so the head is at index 0 */	\
+static inline int name##_grow(struct name *queue) {		\
+	int max = queue->max ? queue->max*2 : BQ_INIT_CAPACITY;	\
+	int first = queue->max-queue->head;				\
+	type *neww;							\
+									\
+	neww = (type *)bm_alloc(queue->alloc, max*sizeof(type));	\
+	if (neww == NULL)						\
+		return BQ_ALLOC_ERROR;					\
+									\
+	if (queue->num > 0) {						\
+		if (first > queue->num)					\
+			first = queue->num;				\
+		memcpy(neww, queue->elems+queue->head, first*sizeof(type));	\
+		memcpy(neww+first, queue->elems, (queue->num-first)*sizeof(type));	\
+	}								\
+	bm_free(queue->alloc, queue->elems, queue->max*sizeof(type));	\
+									\
+	queue->elems = neww;						\
+	queue->head = 0;						\
+	queue->max = max;						\
+	return 0;							\
+}									\
+									\
+static inline int name##_push_head(type data, struct name *queue) {	\
+	if (queue->num == queue->max && name##_grow(queue))		\
+		return BQ_ALLOC_ERROR;					\
+									\
+	queue->head = (queue->head-1) & (queue->max-1);			\
+	queue->elems[queue->head] = data;				\
+	queue->num++;							\
+	return 0;							\
+}									\
+									\
+static inline int name##_push_tail(type data, struct name *queue) {	\
+	if (queue->num == queue->max && name##_grow(queue))		\
+		return BQ_ALLOC_ERROR;					\
+									\
+	queue->elems[(queue->head+queue->num) & (queue->max-1)] = data;	\
+	queue->num++;							\
+	return 0;							\
+}									\
+									\
+static inline int name##_push(type data, struct name *queue) {	\
+	return name##_push_tail(data, queue);				\
+}									\
+									\
+static inline int name##_pop_head(struct name *queue, type *data) {	\
+	if (queue->num == 0)						\
+		return 0;						\
+									\
+	if (data != NULL)						\
+		*data = queue->elems[queue->head];			\
+	queue->head = (queue->head+1) & (queue->max-1);			\
+	queue->num--;							\
+	return 1;							\
+}									\
+									\
+static inline int name##_pop_tail(struct name *queue, type *data) {	\
+	if (queue->num == 0)						\
+		return 0;						\
+									\
+	queue->num--;							\
+	if (data != NULL)						\
+		*data = queue->elems[(queue->head+queue->num) & (queue->max-1)];	\
+	return 1;							\
+}									\
+									\
+static inline int name##_pop(struct name *queue, type *data) {	\
+	return name##_pop_head(queue, data);				\
+}									\
+									\
+static inline type *name##_peek_head(struct name *queue) {	\
+	if (queue->num > 0)						\
+		return &queue->elems[queue->head];			\
+	else								\
+		return NULL;						\
+}									\
+									\
+static inline type *name##_peek_tail(struct name *queue) {	\
+	if (queue->num > 0)						\
+		return &queue->elems[(queue->head+queue->num-1) & (queue->max-1)];	\
+	else								\
+		return NULL;						\
+}									\
+									\
+static inline type *name##_peek(struct name *queue) {		\
+	return name##_peek_head(queue);					\
+}									\
+									\
+static inline void name##_destroy(struct name *queue, name##_cleanup_func func, bq_cleanup_args args) {	\
+	type data;							\
+									\
+	if (func != NULL) {						\
+		while (name##_pop_head(queue, &data))			\
+			func(&data, args);				\
+	}								\
+									\
+	bm_free(queue->alloc, queue->elems, queue->max*sizeof(type));	\
+	name##_init_with_allocator(queue, queue->alloc);		\
+}
+
 #endif
@@ -7,7 +7,10 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include "basic_general.h"
+#include "basic_memory.h"
+#include "basic_arena.h"
 
 /*
  * type definitions
@@ -23,6 +26,40 @@ typedef struct bs_elem bs_elem;
 struct bs_stack {
 	bs_elem *top;
 	int num;
+	/* allocator for the elements, NULL for malloc/free */
+	const struct bm_allocator *alloc;
+};
+
+/*
+ * inline elements of a stack generated by BS_SMALL_DEFINE, handed out by an allocator
+ * that falls back to parent when they are all in use
+ */
+struct bs_inline {
+	struct bm_allocator alloc;
+	const struct bm_allocator *parent;
+	/* free inline elements */
+	bs_elem *spare;
+	bs_elem *elems;
+	int num;
+};
+
+/*
+ * a stack that bs_rollback can roll back in constant time. Its allocator hands out the
+ * elements discarded by the last rollback before asking parent.
+ */
+struct bs_rstack {
+	struct bs_stack stack;
+	struct bm_allocator alloc;
+	const struct bm_allocator *parent;
+	/* elements discarded by bs_rollback, a chain from garbage up to garbage_end */
+	bs_elem *garbage;
+	bs_elem *garbage_end;
+};
+
+/* a depth of the stack to roll back to */
+struct bs_mark {
+	bs_elem *top;
+	int num;
 };
 
 typedef void bs_cleanup_ret;
@@ -34,6 +71,13 @@ typedef bs_cleanup_ret (*bs_cleanup_func)(bs_data, bs_cleanup_args);
  */
 static inline void bs_init(struct bs_stack *stack);
 
+static inline void bs_init_with_allocator(struct bs_stack *stack, const struct bm_allocator *alloc);
+
+static inline void bs_init_arena(struct bs_stack *stack, struct ba_arena *arena);
+
+static inline void bs_init_inline(struct bs_stack *stack, struct bs_inline *inl,
+	bs_elem *elems, int n, const struct bm_allocator *parent);
+
 static inline int bs_is_empty(struct bs_stack *stack);
 
 static inline int bs_num_elem(struct bs_stack *stack);
@@ -46,9 +90,56 @@ static inline bs_data bs_peek(struct bs_stack *stack);
 
 static inline void bs_destroy(struct bs_stack *stack, bs_cleanup_func func, bs_cleanup_args args);
 
+static inline struct bs_stack *bs_rstack_init(struct bs_rstack *rstack, const struct bm_allocator *parent);
+
+static inline void bs_rstack_destroy(struct bs_rstack *rstack, bs_cleanup_func func, bs_cleanup_args args);
+
+static inline struct bs_mark bs_mark(struct bs_stack *stack);
+
+static inline void bs_rollback(struct bs_rstack *rstack, struct bs_mark mark,
+	bs_cleanup_func func, bs_cleanup_args args);
+
+/*
+ * private functions
+ */
+static inline void *__bs_inline_alloc(void *ctx, size_t size);
+static inline void __bs_inline_free(void *ctx, void *ptr, size_t size);
+static inline void *__bs_rstack_alloc(void *ctx, size_t size);
+static inline void __bs_rstack_free(void *ctx, void *ptr, size_t size);
+static inline void __bs_release_garbage(struct bs_rstack *rstack);
+
 /*
  * API macros
  */
+
+/*
+ * BS_SMALL_DEFINE - generate a stack type with n elements stored inline
+ * @name:	the name of the struct
+ * @n:		the number of inline elements
+ *
+ * The first n elements of the stack need no allocation, the next ones spill to the
+ * allocator. name_init() and name_init_with_allocator() return the embedded struct
+ * bs_stack, which works with all the bs_ functions and macros. Its allocator is the
+ * inline one, so plain stacks don't carry the inline state. The struct must not be
+ * moved while it is in use.
+ */
+#define BS_SMALL_DEFINE(name, n)		\
+struct name {						\
+	struct bs_stack stack;				\
+	struct bs_inline inl;				\
+	bs_elem elems[n];				\
+};							\
+							\
+static inline struct bs_stack *name##_init_with_allocator(struct name *small,	\
+		const struct bm_allocator *alloc) {		\
+	bs_init_inline(&small->stack, &small->inl, small->elems, n, alloc);	\
+	return &small->stack;				\
+}							\
+							\
+static inline struct bs_stack *name##_init(struct name *small) {	\
+	return name##_init_with_allocator(small, NULL);	\
+}
+
 #define BS_FOREACH(pos, type, stack)		\
 	for(pos = (type **)MEMBER_OF_SAFE((stack)->top, bs_data, OFFSET_OF(bs_elem, data));	\
 		pos != NULL;		\
@@ -71,6 +162,34 @@ static inline void bs_destroy(struct bs_stack *stack, bs_cleanup_func func, bs_c
 static inline void bs_init(struct bs_stack *stack) {
 	stack->top = NULL;
 	stack->num = 0;
+	stack->alloc = NULL;
+}
+
+static inline void bs_init_with_allocator(struct bs_stack *stack, const struct bm_allocator *alloc) {
+	bs_init(stack);
+	stack->alloc = alloc;
+}
+
+static inline void bs_init_arena(struct bs_stack *stack, struct ba_arena *arena) {
+	bs_init_with_allocator(stack, ba_allocator(arena));
+}
+
+/* inl and elems, storage for n elements, live as long as the stack */
+static inline void bs_init_inline(struct bs_stack *stack, struct bs_inline *inl,
+		bs_elem *elems, int n, const struct bm_allocator *parent) {
+	int i;
+
+	/* the elements are never reallocated */
+	bm_init(&inl->alloc, __bs_inline_alloc, NULL, __bs_inline_free, inl);
+	inl->parent = parent;
+	inl->spare = NULL;
+	for (i = n-1; i >= 0; i--) {
+		elems[i].next = inl->spare;
+		inl->spare = &elems[i];
+	}
+	inl->elems = elems;
+	inl->num = n;
+	bs_init_with_allocator(stack, &inl->alloc);
 }
 
 static inline int bs_is_empty(struct bs_stack *stack) {
@@ -82,7 +201,7 @@ static inline int bs_num_elem(struct bs_stack *stack) {
 }
 
 static inline void bs_push(bs_data data, struct bs_stack *stack) {
-	bs_elem *neww = (bs_elem *)malloc(sizeof(bs_elem));
+	bs_elem *neww = (bs_elem *)bm_alloc(stack->alloc, sizeof(bs_elem));
 
 	neww->data = data;
 	neww->next = stack->top;
@@ -98,7 +217,7 @@ static inline bs_data bs_pop(struct bs_stack *stack) {
 		data = popped->data;
 		stack->top = popped->next;
 		stack->num--;
-		free(popped);
+		bm_free(stack->alloc, popped, sizeof(bs_elem));
 		return data;
 	} else {
 		return NULL;
@@ -124,4 +243,231 @@ static inline void bs_destroy(struct bs_stack *stack, bs_cleanup_func func, bs_c
 	}
 }
 
+/* the struct must not be moved while the returned stack is in use */
+static inline struct bs_stack *bs_rstack_init(struct bs_rstack *rstack, const struct bm_allocator *parent) {
+	/* the elements are never reallocated */
+	bm_init(&rstack->alloc, __bs_rstack_alloc, NULL, __bs_rstack_free, rstack);
+	rstack->parent = parent;
+	rstack->garbage = NULL;
+	rstack->garbage_end = NULL;
+	bs_init_with_allocator(&rstack->stack, &rstack->alloc);
+	return &rstack->stack;
+}
+
+static inline void bs_rstack_destroy(struct bs_rstack *rstack, bs_cleanup_func func, bs_cleanup_args args) {
+	bs_destroy(&rstack->stack, func, args);
+	__bs_release_garbage(rstack);
+}
+
+static inline struct bs_mark bs_mark(struct bs_stack *stack) {
+	struct bs_mark mark;
+
+	mark.top = stack->top;
+	mark.num = stack->num;
+	return mark;
+}
+
+/*
+ * Discards everything pushed after the mark. The elements under the mark must not have
+ * been popped since. Without a cleanup function this takes constant time: the discarded
+ * elements are kept as a chain and reused by the next pushes, and only released when
+ * another rollback or bs_rstack_destroy comes.
+ */
+static inline void bs_rollback(struct bs_rstack *rstack, struct bs_mark mark,
+		bs_cleanup_func func, bs_cleanup_args args) {
+	struct bs_stack *stack = &rstack->stack;
+	bs_elem *ptr;
+
+	if (stack->num <= mark.num)
+		return;
+
+	if (func != NULL) {
+		for (ptr = stack->top; ptr != mark.top; ptr = ptr->next)
+			func(ptr->data, args);
+	}
+
+	__bs_release_garbage(rstack);
+	rstack->garbage = stack->top;
+	rstack->garbage_end = mark.top;
+	stack->top = mark.top;
+	stack->num = mark.num;
+}
+
+static inline void *__bs_inline_alloc(void *ctx, size_t size) {
+	struct bs_inline *inl = (struct bs_inline *)ctx;
+	bs_elem *elem = inl->spare;
+
+	if (elem == NULL)
+		return bm_alloc(inl->parent, size);
+	inl->spare = elem->next;
+	return elem;
+}
+
+/* inline elements go back to the spare list, the others to the parent allocator */
+static inline void __bs_inline_free(void *ctx, void *ptr, size_t size) {
+	struct bs_inline *inl = (struct bs_inline *)ctx;
+	bs_elem *elem = (bs_elem *)ptr;
+
+	if ((uintptr_t)elem-(uintptr_t)inl->elems < inl->num*sizeof(bs_elem)) {
+		elem->next = inl->spare;
+		inl->spare = elem;
+	} else {
+		bm_free(inl->parent, elem, size);
+	}
+}
+
+/* reuse the elements discarded by a rollback first */
+static inline void *__bs_rstack_alloc(void *ctx, size_t size) {
+	struct bs_rstack *rstack = (struct bs_rstack *)ctx;
+	bs_elem *elem = rstack->garbage;
+
+	if (elem == NULL)
+		return bm_alloc(rstack->parent, size);
+	rstack->garbage = elem->next;
+	if (rstack->garbage == rstack->garbage_end)
+		rstack->garbage = NULL;
+	return elem;
+}
+
+static inline void __bs_rstack_free(void *ctx, void *ptr, size_t size) {
+	struct bs_rstack *rstack = (struct bs_rstack *)ctx;
+
+	bm_free(rstack->parent, ptr, size);
+}
+
+static inline void __bs_release_garbage(struct bs_rstack *rstack) {
+	bs_elem *ptr = rstack->garbage;
+	bs_elem *next;
+
+	while (ptr != NULL && ptr != rstack->garbage_end) {
+		next = ptr->next;
+		bm_free(rstack->parent, ptr, sizeof(bs_elem));
+		ptr = next;
+	}
+	rstack->garbage = NULL;
+	rstack->garbage_end = NULL;
+}
+
+/*
+ * Type-specialized stacks
+ *
+ * BS_DEFINE(name, type) generates struct name and the name_* functions for a stack
+ * storing type elements by value in a growable array, so pushing an element needs no
+ * allocation of its own and no pointer chasing. Elements are copied by assignment.
+ *
+ * struct name {type *elems; int num; int max; const struct bm_allocator *alloc;}
+ *
+ * void name_init(struct name *stack);
+ * void name_init_with_allocator(struct name *stack, const struct bm_allocator *alloc);
+ * int name_is_empty(struct name *stack);
+ * int name_num_elem(struct name *stack);
+ * int name_push(type data, struct name *stack);		0 or BS_ALLOC_ERROR
+ * int name_pop(struct name *stack, type *data);		0 if the stack is empty
+ * type *name_peek(struct name *stack);			NULL if the stack is empty
+ * void name_destroy(struct name *stack, name_cleanup_func func, bs_cleanup_args args);
+ * int name_mark(struct name *stack);
+ * void name_rollback(struct name *stack, int mark, name_cleanup_func func, bs_cleanup_args args);
+ */
+
+/* the capacity of the first allocation */
+#define BS_INIT_CAPACITY 8
+
+#define BS_ALLOC_ERROR -1
+
+/*
+ * from the top to the bottom of a stack generated by BS_DEFINE, pos is a type pointer;
+ * pos is compared before it is decremented, so it never points before elems
+ */
+#define BS_TYPED_FOREACH(pos, stack)		\
+	for(pos = (stack)->elems+(stack)->num; pos != (stack)->elems && (--pos, 1); )
+
+#define BS_DEFINE(name, type)		\
+									\
+struct name {							\
+	type *elems;							\
+	int num;							\
+	int max;							\
+	/* allocator for the array, NULL for malloc/free */		\
+	const struct bm_allocator *alloc;			\
+};									\
+									\
+typedef bs_cleanup_ret (*name##_cleanup_func)(type *, bs_cleanup_args);	\
+									\
+static inline void name##_init_with_allocator(struct name *stack, const struct bm_allocator *alloc) {	\
+	stack->elems = NULL;						\
+	stack->num = 0;							\
+	stack->max = 0;							\
+	stack->alloc = alloc;						\
+}									\
+									\
+static inline void name##_init(struct name *stack) {		\
+	name##_init_with_allocator(stack, NULL);			\
+}									\
+									\
+static inline int name##_is_empty(struct name *stack) {	\
+	return (stack->num == 0);					\
+}									\
+									\
+static inline int name##_num_elem(struct name *stack) {	\
+	return (stack->num);						\
+}									\
+									\
+static inline int name##_push(type data, struct name *stack) {	\
+	type *neww;							\
+	int max;							\
+									\
+	if (stack->num == stack->max) {					\
+		max = stack->max ? stack->max*2 : BS_INIT_CAPACITY;	\
+		neww = (type *)bm_realloc(stack->alloc, stack->elems,	\
+			stack->max*sizeof(type), max*sizeof(type));	\
+		if (neww == NULL)					\
+			return BS_ALLOC_ERROR;				\
+		stack->elems = neww;					\
+		stack->max = max;					\
+	}								\
+									\
+	stack->elems[stack->num++] = data;				\
+	return 0;							\
+}									\
+									\
+static inline int name##_pop(struct name *stack, type *data) {	\
+	if (stack->num == 0)						\
+		return 0;						\
+									\
+	stack->num--;							\
+	if (data != NULL)						\
+		*data = stack->elems[stack->num];			\
+	return 1;							\
+}									\
+									\
+static inline type *name##_peek(struct name *stack) {		\
+	if (stack->num > 0)						\
+		return &stack->elems[stack->num-1];			\
+	else								\
+		return NULL;						\
+}									\
+									\
+static inline void name##_destroy(struct name *stack, name##_cleanup_func func, bs_cleanup_args args) {	\
+	if (func != NULL) {						\
+		while (stack->num > 0)					\
+			func(&stack->elems[--stack->num], args);	\
+	}								\
+									\
+	bm_free(stack->alloc, stack->elems, stack->max*sizeof(type));	\
+	name##_init_with_allocator(stack, stack->alloc);		\
+}									\
+									\
+static inline int name##_mark(struct name *stack) {		\
+	return stack->num;						\
+}									\
+									\
+static inline void name##_rollback(struct name *stack, int mark, name##_cleanup_func func, bs_cleanup_args args) {	\
+	if (func != NULL) {						\
+		while (stack->num > mark)				\
+			func(&stack->elems[--stack->num], args);	\
+	}								\
+	if (stack->num > mark)						\
+		stack->num = mark;					\
+}
+
 #endif
\ No newline at end of file
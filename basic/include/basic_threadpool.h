@@ -0,0 +1,147 @@
+#ifndef _BASIC_THREADPOOL_H
+#define _BASIC_THREADPOOL_H
+
+/*
+ * Work-stealing thread pool.
+ *
+ * A fixed number of workers each own a Chase-Lev deque (basic_deque.h). Tasks spawned
+ * by a worker go to its own deque and are run in LIFO order, which keeps the data of
+ * recursive splits hot in its cache; idle workers steal the oldest tasks of the others.
+ * Tasks spawned by other threads go through a shared queue. Workers that find nothing
+ * to do spin briefly and then sleep on a futex, so an idle pool costs nothing.
+ *
+ * Tasks are grouped for fork/join: btp_group_wait() returns when all the tasks spawned
+ * in a group (including those spawned by these tasks) are done, and the waiting thread
+ * runs pending tasks meanwhile instead of blocking a worker.
+ */
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "basic_general.h"
+#include "basic_deque.h"
+
+/*
+ * constant macros
+ */
+
+/* flags of btp_init */
+#define BTP_PIN_CPUS 1
+
+/* error codes */
+#define BTP_ALLOC_ERROR -1
+#define BTP_THREAD_ERROR -2
+
+/*
+ * type definitions
+ */
+typedef void * btp_args;
+typedef void (*btp_task_func)(btp_args);
+typedef void (*btp_range_func)(long, long, btp_args);
+
+/* a set of tasks to wait for */
+struct btp_group {
+	/* number of tasks not finished yet, also the futex the waiters sleep on */
+	atomic_int pending;
+};
+
+struct btp_task {
+	btp_task_func func;
+	btp_args args;
+	struct btp_group *group;
+	/* link in the shared queue */
+	struct btp_task *next;
+};
+
+struct btp_worker {
+	struct btp_pool *pool;
+	struct bd_deque deque;
+	pthread_t thread;
+	int index;
+	/* state of the random victim selection */
+	unsigned int seed;
+};
+
+struct btp_pool {
+	struct btp_worker *workers;
+	int num_workers;
+	/* tasks from threads outside the pool */
+	pthread_mutex_t lock;
+	struct btp_task *head;
+	struct btp_task *tail;
+	atomic_int num_shared;
+	/* idle workers sleep on the epoch futex, which is bumped to wake them */
+	atomic_int epoch;
+	atomic_int sleepers;
+	atomic_int stop;
+};
+
+/*
+ * API functions
+ */
+
+/*
+ * btp_init - start a thread pool
+ * @pool: the pool to initialize
+ * @num_workers: the number of worker threads, 0 for the number of online CPUs
+ * @flags: BTP_PIN_CPUS to pin worker i to CPU i (modulo the number of CPUs)
+ * @return: 0, BTP_ALLOC_ERROR or BTP_THREAD_ERROR
+ */
+int btp_init(struct btp_pool *pool, int num_workers, int flags);
+
+/*
+ * btp_destroy - stop the workers and release the pool
+ * @pool: the pool to destroy, all groups must have been waited for
+ */
+void btp_destroy(struct btp_pool *pool);
+
+/*
+ * btp_group_init - initialize an empty task group
+ * @group: the group to initialize
+ */
+static inline void btp_group_init(struct btp_group *group);
+
+/*
+ * btp_spawn - run a function asynchronously as part of a group
+ * @pool: the pool to run it in
+ * @group: the group the task belongs to
+ * @func: the function to run
+ * @args: argument passed to func
+ * @return: 0 or BTP_ALLOC_ERROR, in which case func is run right away in the caller
+ */
+int btp_spawn(struct btp_pool *pool, struct btp_group *group, btp_task_func func, btp_args args);
+
+/*
+ * btp_group_wait - wait until all tasks of a group are done, running tasks meanwhile
+ * @pool: the pool the tasks were spawned in
+ * @group: the group to wait for
+ */
+void btp_group_wait(struct btp_pool *pool, struct btp_group *group);
+
+/*
+ * btp_parallel_for - run func over [begin, end) split into ranges, and wait for it
+ * @pool: the pool to run in
+ * @begin: the first index
+ * @end: one past the last index
+ * @grain: ranges of at most grain indexes are not split further, 0 to pick one
+ * @func: called with (range_begin, range_end, args) for each range
+ * @args: argument passed to func
+ */
+void btp_parallel_for(struct btp_pool *pool, long begin, long end, long grain,
+	btp_range_func func, btp_args args);
+
+/*
+ * btp_worker_index - get the index of the calling worker
+ * @pool: the pool
+ * @return: the index in [0, num_workers), or -1 if not called from a worker of pool
+ */
+int btp_worker_index(struct btp_pool *pool);
+
+/*
+ * inline function definitions
+ */
+static inline void btp_group_init(struct btp_group *group) {
+	atomic_init(&group->pending, 0);
+}
+
+#endif
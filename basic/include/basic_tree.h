@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include "basic_general.h"
 #include "basic_list.h"
+#include "basic_memory.h"
+#include "basic_arena.h"
 
 /*
  * convenient macros for shortening code lines, will be undefined at the end
@@ -40,6 +42,8 @@ struct bt_node {
 	struct bt_node *parent;
 	struct bl_head siblings;
 	struct bl_head children;
+	/* the allocator the node comes from, NULL for malloc/free */
+	const struct bm_allocator *alloc;
 };
 typedef struct bt_node btnode;
 
@@ -80,6 +84,10 @@ typedef enum {
  */
 static inline btnode *bt_new(btnode_data data);
 
+static inline btnode *bt_new_with_allocator(btnode_data data, const struct bm_allocator *alloc);
+
+static inline btnode *bt_new_arena(btnode_data data, struct ba_arena *arena);
+
 btec bt_insert(btnode *node, btnode *parent, int pos);
 
 static inline void bt_insert_after(btnode *node, btnode *sibling);
@@ -148,14 +156,23 @@ void __bt_traverse_bfs(btnode *root, int max_depth, bttf meet_func, btta meet_ar
  * inline function definitions
  */
 static inline btnode *bt_new(btnode_data data) {
-	btnode *node = (btnode *)malloc(sizeof(btnode));
+	return bt_new_with_allocator(data, NULL);
+}
+
+static inline btnode *bt_new_with_allocator(btnode_data data, const struct bm_allocator *alloc) {
+	btnode *node = (btnode *)bm_alloc(alloc, sizeof(btnode));
 	BL_INIT_HEAD(&(node->siblings));
 	BL_INIT_HEAD(&(node->children));
 	node->parent = NULL;
 	node->data = data;
+	node->alloc = alloc;
 	return node;
 }
 
+static inline btnode *bt_new_arena(btnode_data data, struct ba_arena *arena) {
+	return bt_new_with_allocator(data, ba_allocator(arena));
+}
+
 static inline void bt_insert_after(btnode *node, btnode *sibling) {
 	bl_add_after(&(node->siblings), &(sibling->siblings));
 	node->parent = sibling->parent;
@@ -355,7 +372,7 @@ static inline int bt_is_alone(btnode *node) {
 static inline void bt_destroy(btnode *node, btdcf func, btdca args) {
 	if (func != NULL)
 		func(node->data, args);
-	free(node);
+	bm_free(node->alloc, node, sizeof(btnode));
 }
 
 static inline void bt_destroy_tree(btnode *node, btdcf func, btdca args) {
@@ -0,0 +1,228 @@
+#ifndef _BASIC_VECTOR_H
+#define _BASIC_VECTOR_H
+
+/*
+ * Growable typed dynamic array.
+ *
+ * BV_DEFINE(name, type) generates struct name and the name_* functions for a vector of
+ * type elements, stored contiguously. The capacity doubles when it runs out, so appends
+ * are amortized O(1). Elements are moved with memcpy/memmove, so the type must be
+ * trivially copyable.
+ *
+ * Example:
+ *	BV_DEFINE(int_vec, int)
+ *
+ *	struct int_vec vec;
+ *	int_vec_init(&vec);
+ *	int_vec_push(&vec, 42);
+ *	int_vec_destroy(&vec);
+ *
+ * Functions that may allocate return 0, or BV_ALLOC_ERROR leaving the vector unchanged.
+ * Pointers into the vector are invalidated by anything that grows or shrinks it, and the
+ * source buffers given to the insert/append functions must not point into the vector.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "basic_general.h"
+#include "basic_memory.h"
+
+/*
+ * constant macros
+ */
+
+/* the capacity of the first allocation */
+#define BV_INIT_CAPACITY 8
+
+#define BV_ALLOC_ERROR -1
+
+/*
+ * API macros
+ */
+#define BV_FOREACH(pos, vec)		\
+	for(pos = (vec)->data; pos < (vec)->data+(vec)->size; pos++)
+
+/*
+ * BV_DEFINE - generate a vector type and its functions
+ * @name:	the name of the struct, and the prefix of the functions
+ * @type:	the element type
+ *
+ * struct name {type *data; size_t size; size_t capacity; const struct bm_allocator *alloc;}
+ *
+ * void name_init(struct name *vec);
+ * void name_init_with_allocator(struct name *vec, const struct bm_allocator *alloc);
+ * void name_destroy(struct name *vec);
+ * void name_clear(struct name *vec);
+ * size_t name_size(struct name *vec);
+ * type *name_at(struct name *vec, size_t index);
+ * int name_reserve(struct name *vec, size_t capacity);
+ * int name_resize(struct name *vec, size_t size);		new elements are zeroed
+ * int name_shrink_to_fit(struct name *vec);
+ * int name_push(struct name *vec, type value);
+ * type name_pop(struct name *vec);				the vector must not be empty
+ * int name_append(struct name *vec, const type *src, size_t num);
+ * int name_insert(struct name *vec, size_t index, const type *src, size_t num);
+ * void name_erase(struct name *vec, size_t index, size_t num);
+ * type *name_release(struct name *vec, size_t *size, size_t *capacity);	the caller owns the buffer
+ * void name_move(struct name *dst, struct name *src);	src is left empty
+ */
+#define BV_DEFINE(name, type)		\
+									\
+struct name {							\
+	type *data;							\
+	size_t size;							\
+	size_t capacity;						\
+	/* allocator for the buffer, NULL for malloc/free */	\
+	const struct bm_allocator *alloc;			\
+};									\
+									\
+static inline void name##_init_with_allocator(struct name *vec, const struct bm_allocator *alloc) {	\
+	vec->data = NULL;						\
+	vec->size = 0;							\
+	vec->capacity = 0;						\
+	vec->alloc = alloc;						\
+}									\
+									\
+static inline void name##_init(struct name *vec) {		\
+	name##_init_with_allocator(vec, NULL);			\
+}									\
+									\
+static inline void name##_destroy(struct name *vec) {		\
+	bm_free(vec->alloc, vec->data, vec->capacity*sizeof(type));	\
+	vec->data = NULL;						\
+	vec->size = 0;							\
+	vec->capacity = 0;						\
+}									\
+									\
+static inline void name##_clear(struct name *vec) {		\
+	vec->size = 0;							\
+}									\
+									\
+static inline size_t name##_size(struct name *vec) {		\
+	return vec->size;						\
+}									\
+									\
+static inline type *name##_at(struct name *vec, size_t index) {	\
+	return vec->data+index;						\
+}									\
+									\
+static inline int name##_reserve(struct name *vec, size_t capacity) {	\
+	type *neww;							\
+									\
+	if (capacity <= vec->capacity)					\
+		return 0;						\
+									\
+	neww = (type *)bm_realloc(vec->alloc, vec->data,		\
+		vec->capacity*sizeof(type), capacity*sizeof(type));	\
+	if (neww == NULL)						\
+		return BV_ALLOC_ERROR;					\
+									\
+	vec->data = neww;						\
+	vec->capacity = capacity;					\
+	return 0;							\
+}									\
+									\
+/* makes room for num more elements, growing geometrically */	\
+static inline int name##_grow(struct name *vec, size_t num) {	\
+	size_t capacity = vec->capacity ? vec->capacity : BV_INIT_CAPACITY;	\
+									\
+	if (vec->size+num <= vec->capacity)				\
+		return 0;						\
+									\
+	while (capacity < vec->size+num)				\
+		capacity *= 2;						\
+	return name##_reserve(vec, capacity);				\
+}									\
+									\
+static inline int name##_resize(struct name *vec, size_t size) {	\
+	if (size > vec->size) {						\
+		if (name##_reserve(vec, size))				\
+			return BV_ALLOC_ERROR;				\
+		memset(vec->data+vec->size, 0, (size-vec->size)*sizeof(type));	\
+	}								\
+	vec->size = size;						\
+	return 0;							\
+}									\
+									\
+static inline int name##_shrink_to_fit(struct name *vec) {	\
+	type *neww;							\
+									\
+	if (vec->size == vec->capacity)					\
+		return 0;						\
+									\
+	if (vec->size == 0) {						\
+		name##_destroy(vec);					\
+		return 0;						\
+	}								\
+									\
+	neww = (type *)bm_realloc(vec->alloc, vec->data,		\
+		vec->capacity*sizeof(type), vec->size*sizeof(type));	\
+	if (neww == NULL)						\
+		return BV_ALLOC_ERROR;					\
+									\
+	vec->data = neww;						\
+	vec->capacity = vec->size;					\
+	return 0;							\
+}									\
+									\
+static inline int name##_push(struct name *vec, type value) {	\
+	if (vec->size == vec->capacity && name##_grow(vec, 1))		\
+		return BV_ALLOC_ERROR;					\
+									\
+	vec->data[vec->size++] = value;					\
+	return 0;							\
+}									\
+									\
+static inline type name##_pop(struct name *vec) {		\
+	return vec->data[--vec->size];					\
+}									\
+									\
+static inline int name##_append(struct name *vec, const type *src, size_t num) {	\
+	if (name##_grow(vec, num))					\
+		return BV_ALLOC_ERROR;					\
+									\
+	if (num > 0)							\
+		memcpy(vec->data+vec->size, src, num*sizeof(type));	\
+	vec->size += num;						\
+	return 0;							\
+}									\
+									\
+static inline int name##_insert(struct name *vec, size_t index, const type *src, size_t num) {	\
+	if (name##_grow(vec, num))					\
+		return BV_ALLOC_ERROR;					\
+									\
+	if (num > 0) {							\
+		memmove(vec->data+index+num, vec->data+index, (vec->size-index)*sizeof(type));	\
+		memcpy(vec->data+index, src, num*sizeof(type));		\
+	}								\
+	vec->size += num;						\
+	return 0;							\
+}									\
+									\
+static inline void name##_erase(struct name *vec, size_t index, size_t num) {	\
+	memmove(vec->data+index, vec->data+index+num, (vec->size-index-num)*sizeof(type));	\
+	vec->size -= num;						\
+}									\
+									\
+/* hands the buffer over without copying, free it with the vector's allocator	\
+ * and capacity*sizeof(type), since allocators may route blocks by size */	\
+static inline type *name##_release(struct name *vec, size_t *size, size_t *capacity) {	\
+	type *data = vec->data;						\
+									\
+	if (size != NULL)						\
+		*size = vec->size;					\
+	if (capacity != NULL)						\
+		*capacity = vec->capacity;				\
+	vec->data = NULL;						\
+	vec->size = 0;							\
+	vec->capacity = 0;						\
+	return data;							\
+}									\
+									\
+static inline void name##_move(struct name *dst, struct name *src) {	\
+	name##_destroy(dst);						\
+	*dst = *src;							\
+	name##_init_with_allocator(src, src->alloc);			\
+}
+
+#endif
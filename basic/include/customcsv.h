@@ -0,0 +1,146 @@
+#ifndef _CUSTOMCSV_H
+#define _CUSTOMCSV_H
+
+/*
+ * Streaming CSV/TSV parser built on the customio buffered reader.
+ *
+ * Quoting follows RFC 4180: a field may be enclosed in quote characters, in which case it
+ * can contain delimiters and newlines, and a quote inside it is escaped by doubling it.
+ * Records end with "\n" or "\r\n". Fields are returned as null-terminated views into the
+ * reader's buffer (unescaped in place), so nothing is copied or allocated per field. The
+ * views are only valid until the next call on the same parser.
+ *
+ * The parser is lenient: characters after a closing quote are appended to the field, and
+ * an unterminated quote runs until the end of input.
+ */
+
+#include <stdio.h>
+#include "customio.h"
+
+/*
+ * convenient macros for shortening code lines, will be undefined at the end
+ */
+#define cec cio_error_code
+
+/*
+ * constant macros
+ */
+
+/* common delimiters and quote character */
+#define CSV_DELIM ','
+#define TSV_DELIM '\t'
+#define CSV_QUOTE '"'
+
+/* quote character value that disables quoting (plain TSV) */
+#define CSV_NO_QUOTE '\0'
+
+/* the initial number of fields the parser can hold */
+#define CSV_INIT_FIELDS 16
+
+/*
+ * type definitions
+ */
+
+/* view of a field inside the parser's buffer */
+struct csv_field {
+	char *ptr;
+	int len;
+};
+
+/* a batch of records laid out as arrays, for columnar consumers */
+struct csv_batch {
+	/* the base address that the offsets are relative to */
+	char *data;
+	/* offset and length of each field */
+	int *offsets;
+	int *lengths;
+	/* index of the first field of each record, records[num_records] == num_fields */
+	int *records;
+	int num_records;
+	int num_fields;
+};
+
+struct csv_parser {
+	struct cio_reader reader;
+	char delim;
+	char quote;
+	/* fields parsed by the current call, offsets relative to the reader's start */
+	int *offsets;
+	int *lengths;
+	struct csv_field *fields;
+	int num_fields;
+	int max_fields;
+	/* record boundaries of the current batch */
+	int *records;
+	int max_records;
+	/* number of records returned so far */
+	long record;
+};
+
+/*
+ * API functions
+ */
+
+/*
+ * csv_init - initialize a parser on a file stream
+ * @parser: the parser to initialize
+ * @stream: the input stream to read from
+ * @delim: the field delimiter, e.g. CSV_DELIM or TSV_DELIM
+ * @quote: the quote character, CSV_NO_QUOTE to disable quoting
+ * @return: error code
+ */
+cec csv_init(struct csv_parser *parser, FILE *stream, char delim, char quote);
+
+/*
+ * csv_destroy - release all memory held by a parser, the stream is left open
+ * @parser: the parser to destroy
+ */
+void csv_destroy(struct csv_parser *parser);
+
+/*
+ * csv_next_record - read the next record
+ * @parser: the parser to read from
+ * @fields: the pointer to save the address of the field views
+ * @num: the integer to save the number of fields
+ * @return: error code, CIO_EOF if there is no more record
+ */
+cec csv_next_record(struct csv_parser *parser, struct csv_field **fields, int *num);
+
+/*
+ * csv_next_batch - read up to max_records records at once
+ * @parser: the parser to read from
+ * @batch: the batch to fill, its arrays belong to the parser
+ * @max_records: the maximum number of records to read
+ * @return: error code, CIO_EOF if there is no more record
+ *
+ * Field i of the batch starts at batch->data + batch->offsets[i] and is null-terminated.
+ */
+cec csv_next_batch(struct csv_parser *parser, struct csv_batch *batch, int max_records);
+
+/*
+ * csv_record_number - get the number of records read so far
+ * @parser: the parser
+ * @return: the number of records
+ */
+static inline long csv_record_number(struct csv_parser *parser);
+
+/*
+ * private functions
+ */
+int __csv_scan(const char *ptr, int len, char delim);
+cec __csv_add_field(struct csv_parser *parser, int offset, int len);
+cec __csv_parse_record(struct csv_parser *parser, int base, int *consumed);
+
+/*
+ * inline function definitions
+ */
+static inline long csv_record_number(struct csv_parser *parser) {
+	return parser->record;
+}
+
+/*
+ * undefining the convenient macros
+ */
+#undef cec
+
+#endif
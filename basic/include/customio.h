@@ -12,6 +12,10 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "basic_memory.h"
+#include "basic_arena.h"
 
 /*
  * convenient macros for shortening code lines, will be undefined at the end
@@ -28,16 +32,70 @@
 /* the buffer increment value */
 #define CIO_BUF_INC 256
 
+/* the default block size of a buffered reader */
+#define CIO_READER_BUF_SIZE 65536
+
+/* the maximum length of a number read by cio_get_int64 and friends */
+#define CIO_NUM_MAX_LEN 128
+
+/* the default buffer size of a buffered writer */
+#define CIO_WRITER_BUF_SIZE 65536
+
 /*
  * enumarations
  */
 
 /* enum type containing error codes */
 typedef enum {
-	CIO_READ_ERROR  = -2,
-	CIO_ALLOC_ERROR = -3
+	CIO_EOF          = -1,
+	CIO_READ_ERROR   = -2,
+	CIO_ALLOC_ERROR  = -3,
+	CIO_FORMAT_ERROR = -4,
+	CIO_RANGE_ERROR  = -5,
+	CIO_WRITE_ERROR  = -6
 } cio_error_code;
 
+/*
+ * type definitions
+ */
+
+/*
+ * buffered reader over a file stream
+ *
+ * The reader pulls data from the stream in large blocks, so the stream should not be
+ * read by other functions while a reader is attached to it.
+ */
+struct cio_reader {
+	FILE *stream;
+	char *buf;
+	int buf_size;
+	/* offset of the first unread byte in buf */
+	int start;
+	/* offset past the last valid byte in buf */
+	int end;
+	int eof;
+	/* number of lines returned so far */
+	long line;
+	/* allocator for the buffer, NULL for malloc/free */
+	const struct bm_allocator *alloc;
+};
+
+/*
+ * buffered writer over a file descriptor
+ *
+ * Data is collected in the buffer and written with as few write(2)/writev(2) calls as
+ * possible. Nothing reaches the file until the buffer is full or flushed.
+ */
+struct cio_writer {
+	int fd;
+	char *buf;
+	int buf_size;
+	/* number of bytes waiting in buf */
+	int len;
+	/* allocator for the buffer, NULL for malloc/free */
+	const struct bm_allocator *alloc;
+};
+
 /*
  * API functions
  */
@@ -155,11 +213,221 @@ void cio_trim_after(char *str);
  */
 void cio_trim(char *str);
 
+/*
+ * cio_reader_init - attach a buffered reader to a file stream
+ * @reader: the reader to initialize
+ * @stream: the input stream to read from
+ * @buf_size: initial block size, 0 for the default CIO_READER_BUF_SIZE
+ * @return: error code
+ */
+cec cio_reader_init(struct cio_reader *reader, FILE *stream, int buf_size);
+
+/*
+ * cio_reader_init_with_allocator - same as cio_reader_init, but the buffer comes from an allocator
+ * @reader: the reader to initialize
+ * @stream: the input stream to read from
+ * @buf_size: initial block size, 0 for the default CIO_READER_BUF_SIZE
+ * @alloc: the allocator, NULL for malloc/free
+ * @return: error code
+ */
+cec cio_reader_init_with_allocator(struct cio_reader *reader, FILE *stream, int buf_size, const struct bm_allocator *alloc);
+
+/*
+ * cio_reader_init_arena - same as cio_reader_init, but the buffer is allocated from an arena
+ * @reader: the reader to initialize
+ * @stream: the input stream to read from
+ * @buf_size: initial block size, 0 for the default CIO_READER_BUF_SIZE
+ * @arena: the arena to allocate from, NULL for malloc/free
+ * @return: error code
+ */
+cec cio_reader_init_arena(struct cio_reader *reader, FILE *stream, int buf_size, struct ba_arena *arena);
+
+/*
+ * cio_reader_destroy - release the buffer of a reader, the stream is left open
+ * @reader: the reader to destroy
+ */
+void cio_reader_destroy(struct cio_reader *reader);
+
+/*
+ * cio_getline - read a line without copying it
+ * @reader: the reader to read from
+ * @line: the pointer to save the address of the line inside the reader's buffer
+ * @num: the integer to save the number of characters in the line
+ * @strip_cr: if not 0, a trailing '\r' before the newline is removed too
+ * @return: error code, CIO_EOF if there is no more line
+ *
+ * The newline is not included and the line is null-terminated. The line is only valid
+ * until the next call on the same reader.
+ */
+cec cio_getline(struct cio_reader *reader, char **line, int *num, int strip_cr);
+
+/*
+ * cio_getline_copy - read a line into a caller's buffer
+ * @reader: the reader to read from
+ * @ptr: the pointer to save the address of the read data
+ * @size: buffer size if ptr initially points to allocated data
+ * @num: the integer to save the number of characters in the line
+ * @strip_cr: if not 0, a trailing '\r' before the newline is removed too
+ * @return: error code, CIO_EOF if there is no more line
+ */
+cec cio_getline_copy(struct cio_reader *reader, char **ptr, int size, int *num, int strip_cr);
+
+/*
+ * cio_get_int64 - read a signed decimal integer, ignore leading whitespaces
+ * @reader: the reader to read from
+ * @val: the integer to save the value
+ * @return: error code, CIO_FORMAT_ERROR if there is no number, CIO_RANGE_ERROR if it overflows
+ *
+ * The number is parsed directly from the reader's buffer, the character following it is
+ * left unread. A number may be at most CIO_NUM_MAX_LEN characters long.
+ */
+cec cio_get_int64(struct cio_reader *reader, int64_t *val);
+
+/*
+ * cio_get_uint64 - read an unsigned decimal integer, ignore leading whitespaces
+ * @reader: the reader to read from
+ * @val: the integer to save the value
+ * @return: error code, CIO_FORMAT_ERROR if there is no number, CIO_RANGE_ERROR if it overflows
+ */
+cec cio_get_uint64(struct cio_reader *reader, uint64_t *val);
+
+/*
+ * cio_get_double - read a floating point number, ignore leading whitespaces
+ * @reader: the reader to read from
+ * @val: the double to save the value
+ * @return: error code, CIO_FORMAT_ERROR if there is no number, CIO_RANGE_ERROR if it overflows
+ *
+ * The result is correctly rounded. Short decimals are converted exactly with a single
+ * multiplication or division, other inputs fall back to strtod on a stack copy.
+ */
+cec cio_get_double(struct cio_reader *reader, double *val);
+
+/*
+ * cio_line_number - get the number of the last line read
+ * @reader: the reader
+ * @return: the line number, counted from 1, or 0 if no line has been read
+ */
+static inline long cio_line_number(struct cio_reader *reader);
+
+/*
+ * cio_writer_init - create a buffered writer on a file descriptor
+ * @writer: the writer to initialize
+ * @fd: the file descriptor to write to
+ * @buf_size: buffer size, 0 for the default CIO_WRITER_BUF_SIZE
+ * @return: error code
+ */
+cec cio_writer_init(struct cio_writer *writer, int fd, int buf_size);
+
+/*
+ * cio_writer_init_with_allocator - same as cio_writer_init, but the buffer comes from an allocator
+ * @writer: the writer to initialize
+ * @fd: the file descriptor to write to
+ * @buf_size: buffer size, 0 for the default CIO_WRITER_BUF_SIZE
+ * @alloc: the allocator, NULL for malloc/free
+ * @return: error code
+ */
+cec cio_writer_init_with_allocator(struct cio_writer *writer, int fd, int buf_size, const struct bm_allocator *alloc);
+
+/*
+ * cio_writer_init_arena - same as cio_writer_init, but the buffer is allocated from an arena
+ * @writer: the writer to initialize
+ * @fd: the file descriptor to write to
+ * @buf_size: buffer size, 0 for the default CIO_WRITER_BUF_SIZE
+ * @arena: the arena to allocate from, NULL for malloc/free
+ * @return: error code
+ */
+cec cio_writer_init_arena(struct cio_writer *writer, int fd, int buf_size, struct ba_arena *arena);
+
+/*
+ * cio_writer_flush - write everything in the buffer to the file
+ * @writer: the writer to flush
+ * @return: error code
+ */
+cec cio_writer_flush(struct cio_writer *writer);
+
+/*
+ * cio_writer_destroy - flush a writer and release its buffer, the file is left open
+ * @writer: the writer to destroy
+ * @return: error code of the last flush
+ */
+cec cio_writer_destroy(struct cio_writer *writer);
+
+/*
+ * cio_put - write a series of characters
+ * @writer: the writer to write to
+ * @data: the characters to write
+ * @len: the number of characters
+ * @return: error code
+ */
+cec cio_put(struct cio_writer *writer, const char *data, int len);
+
+/*
+ * cio_put_char - write a character
+ * @writer: the writer to write to
+ * @c: the character to write
+ * @return: error code
+ */
+static inline cec cio_put_char(struct cio_writer *writer, char c);
+
+/*
+ * cio_put_str - write a null-terminated string
+ * @writer: the writer to write to
+ * @str: the string to write
+ * @return: error code
+ */
+static inline cec cio_put_str(struct cio_writer *writer, const char *str);
+
+/*
+ * cio_put_int64 - write a signed integer in decimal
+ * @writer: the writer to write to
+ * @val: the value to write
+ * @return: error code
+ */
+cec cio_put_int64(struct cio_writer *writer, int64_t val);
+
+/*
+ * cio_put_uint64 - write an unsigned integer in decimal
+ * @writer: the writer to write to
+ * @val: the value to write
+ * @return: error code
+ */
+cec cio_put_uint64(struct cio_writer *writer, uint64_t val);
+
+/*
+ * cio_put_double - write a floating point number that reads back to the same value
+ * @writer: the writer to write to
+ * @val: the value to write
+ * @return: error code
+ *
+ * Values with a short decimal form (like 3.25 or 0.1) are written in plain notation
+ * with as few decimals as possible. Other values fall back to "%.17g".
+ */
+cec cio_put_double(struct cio_writer *writer, double val);
+
+/*
+ * cio_put_field - write a field, quoting it if needed
+ * @writer: the writer to write to
+ * @data: the field to write
+ * @len: the length of the field
+ * @delim: the field delimiter
+ * @quote: the quote character, '\0' to never quote
+ * @return: error code
+ *
+ * The field is quoted if it contains the delimiter, the quote character or a newline.
+ * Quotes inside a quoted field are doubled. The delimiter itself is not written.
+ */
+cec cio_put_field(struct cio_writer *writer, const char *data, int len, char delim, char quote);
+
 /*
  * private functions
  */
 cec __cio_is_delim(char c, const char *delims, int ws);
 cec __cio_get_before_delim(FILE *stream, const char *delims, int ws, char **ptr, int size, int *num, char *delim, int ignore);
+cec __cio_reader_fill(struct cio_reader *reader);
+cec __cio_reader_ensure(struct cio_reader *reader, int offset);
+cec __cio_skip_ws(struct cio_reader *reader);
+cec __cio_get_digits(struct cio_reader *reader, uint64_t *val, int *neg);
+int __cio_format_uint64(char *end, uint64_t val);
 
 /*
  * inline function definitions
@@ -209,6 +477,21 @@ static inline cec cio_get_before_delim_or_ws_ignore(FILE *stream, const char *de
 	return __cio_get_before_delim(stream, delims, 1, ptr, size, num, delim, 1);
 }
 
+static inline long cio_line_number(struct cio_reader *reader) {
+	return reader->line;
+}
+
+static inline cec cio_put_char(struct cio_writer *writer, char c) {
+	if (writer->len == writer->buf_size)
+		return cio_put(writer, &c, 1);
+	writer->buf[writer->len++] = c;
+	return 0;
+}
+
+static inline cec cio_put_str(struct cio_writer *writer, const char *str) {
+	return cio_put(writer, str, strlen(str));
+}
+
 /*
  * undefining the convenient macros
  */
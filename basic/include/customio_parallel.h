@@ -0,0 +1,135 @@
+#ifndef _CUSTOMIO_PARALLEL_H
+#define _CUSTOMIO_PARALLEL_H
+
+/*
+ * Parallel tokenization of files using chunks.
+ *
+ * The input (a mapped file or a memory buffer) is split into chunks of about the same
+ * size. Each chunk boundary is moved forward to just after the next record delimiter, so
+ * every chunk holds whole records only. The chunks are then processed by one thread each.
+ * Results can be consumed per chunk inside the worker threads, or in chunk order in the
+ * calling thread once all workers are done.
+ *
+ * Records are views into the input and are NOT null-terminated, since a mapped file is
+ * read-only.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "customio.h"
+
+/*
+ * convenient macros for shortening code lines, will be undefined at the end
+ */
+#define cec cio_error_code
+#define ccr cio_chunk_ret
+#define cca cio_chunk_args
+
+/*
+ * type definitions
+ */
+
+/* a part of the input that starts and ends on record boundaries */
+struct cio_chunk {
+	const char *data;
+	size_t len;
+	/* offset of the chunk in the whole input */
+	size_t offset;
+	/* index of the chunk, chunks are numbered in input order */
+	int index;
+	char delim;
+	/* read position for cio_chunk_next */
+	size_t pos;
+};
+
+/* chunk processing functions */
+typedef void * ccr;
+typedef void * cca;
+typedef ccr (*cio_chunk_func)(struct cio_chunk *, cca);
+typedef void (*cio_chunk_done_func)(struct cio_chunk *, ccr, cca);
+
+/*
+ * API functions
+ */
+
+/*
+ * cio_parallel_buffer - process a memory buffer in parallel chunks
+ * @data: the input data
+ * @size: the size of the input
+ * @num_chunks: the number of chunks (and threads), 0 for the number of online CPUs
+ * @delim: the record delimiter, usually '\n'
+ * @work_func: function run on each chunk in its own thread, returns the chunk's result
+ * @work_args: argument passed to work_func
+ * @done_func: if not NULL, called with each chunk's result in chunk order, in the calling thread
+ * @done_args: argument passed to done_func
+ * @return: error code
+ */
+cec cio_parallel_buffer(const char *data, size_t size, int num_chunks, char delim,
+	cio_chunk_func work_func, cca work_args, cio_chunk_done_func done_func, cca done_args);
+
+/*
+ * cio_parallel_file - map a file and process it in parallel chunks
+ * @path: the path of the file
+ * the other arguments are the same as cio_parallel_buffer
+ * @return: error code
+ */
+cec cio_parallel_file(const char *path, int num_chunks, char delim,
+	cio_chunk_func work_func, cca work_args, cio_chunk_done_func done_func, cca done_args);
+
+/*
+ * cio_chunk_next - get the next record of a chunk
+ * @chunk: the chunk to read from
+ * @ptr: the pointer to save the address of the record
+ * @num: the integer to save the length of the record, delimiter excluded
+ * @return: error code, CIO_EOF if there is no more record
+ */
+static inline cec cio_chunk_next(struct cio_chunk *chunk, const char **ptr, size_t *num);
+
+/*
+ * cio_chunk_rewind - start reading a chunk from its beginning again
+ * @chunk: the chunk to rewind
+ */
+static inline void cio_chunk_rewind(struct cio_chunk *chunk);
+
+/*
+ * private functions
+ */
+void __cio_split_chunks(const char *data, size_t size, int num_chunks, char delim, struct cio_chunk *chunks);
+
+/*
+ * inline function definitions
+ */
+static inline cec cio_chunk_next(struct cio_chunk *chunk, const char **ptr, size_t *num) {
+	const char *start = chunk->data+chunk->pos;
+	const char *end = NULL;
+	size_t left = chunk->len-chunk->pos;
+
+	if (left == 0)
+		return CIO_EOF;
+
+	/* the last record of the input may have no delimiter */
+	end = (const char *)memchr(start, chunk->delim, left);
+	if (end == NULL) {
+		*num = left;
+		chunk->pos = chunk->len;
+	} else {
+		*num = end-start;
+		chunk->pos += *num+1;
+	}
+	*ptr = start;
+
+	return 0;
+}
+
+static inline void cio_chunk_rewind(struct cio_chunk *chunk) {
+	chunk->pos = 0;
+}
+
+/*
+ * undefining the convenient macros
+ */
+#undef cec
+#undef ccr
+#undef cca
+
+#endif
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "basic_threadpool.h"
+
+/* failed rounds of stealing before a worker goes to sleep */
+#define BTP_SPIN_ROUNDS 64
+
+/* ranges handed to btp_parallel_for tasks */
+struct __btp_range {
+	struct btp_pool *pool;
+	struct btp_group *group;
+	long begin;
+	long end;
+	long grain;
+	btp_range_func func;
+	btp_args args;
+};
+
+/* the worker running on this thread, if any */
+static __thread struct btp_worker *__btp_current = NULL;
+
+static void __btp_futex_wait(atomic_int *addr, int value) {
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void __btp_futex_wake(atomic_int *addr, int num) {
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+static struct btp_worker *__btp_self(struct btp_pool *pool) {
+	struct btp_worker *worker = __btp_current;
+
+	return (worker != NULL && worker->pool == pool) ? worker : NULL;
+}
+
+/* wakes a sleeping worker, if there is one, after new work was published */
+static void __btp_notify(struct btp_pool *pool) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0) {
+		atomic_fetch_add(&pool->epoch, 1);
+		__btp_futex_wake(&pool->epoch, 1);
+	}
+}
+
+static struct btp_task *__btp_pop_shared(struct btp_pool *pool) {
+	struct btp_task *task;
+
+	if (atomic_load_explicit(&pool->num_shared, memory_order_relaxed) == 0)
+		return NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	task = pool->head;
+	if (task != NULL) {
+		pool->head = task->next;
+		if (pool->head == NULL)
+			pool->tail = NULL;
+		atomic_fetch_sub(&pool->num_shared, 1);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return task;
+}
+
+/* own deque first, then the shared queue, then the other workers from a random one */
+static struct btp_task *__btp_find_task(struct btp_pool *pool, struct btp_worker *self) {
+	struct btp_task *task = NULL;
+	bd_data data;
+	int start, i, rv;
+
+	if (self != NULL) {
+		task = (struct btp_task *)bd_pop(&self->deque);
+		if (task != NULL)
+			return task;
+	}
+
+	task = __btp_pop_shared(pool);
+	if (task != NULL)
+		return task;
+
+	start = (self != NULL) ? rand_r(&self->seed) : rand();
+	for (i = 0; i < pool->num_workers; i++) {
+		struct btp_worker *victim = &pool->workers[(start+i) % pool->num_workers];
+
+		if (victim == self)
+			continue;
+		do {
+			rv = bd_steal(&victim->deque, &data);
+		} while (rv == BD_ABORT);
+		if (rv == 0)
+			return (struct btp_task *)data;
+	}
+
+	return NULL;
+}
+
+static int __btp_has_work(struct btp_pool *pool) {
+	int i;
+
+	if (atomic_load(&pool->num_shared) > 0)
+		return 1;
+	for (i = 0; i < pool->num_workers; i++)
+		if (bd_num_elem(&pool->workers[i].deque) > 0)
+			return 1;
+	return 0;
+}
+
+static void __btp_run(struct btp_task *task) {
+	struct btp_group *group = task->group;
+
+	task->func(task->args);
+	free(task);
+
+	/* the last task of a group wakes the waiters */
+	if (atomic_fetch_sub(&group->pending, 1) == 1)
+		__btp_futex_wake(&group->pending, INT_MAX);
+}
+
+static void __btp_sleep(struct btp_pool *pool) {
+	int epoch;
+
+	atomic_fetch_add(&pool->sleepers, 1);
+	epoch = atomic_load(&pool->epoch);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	/* work published before the sleepers count was raised must not be missed */
+	if (!__btp_has_work(pool) && !atomic_load(&pool->stop))
+		__btp_futex_wait(&pool->epoch, epoch);
+
+	atomic_fetch_sub(&pool->sleepers, 1);
+}
+
+static void *__btp_worker_main(void *arg) {
+	struct btp_worker *worker = (struct btp_worker *)arg;
+	struct btp_pool *pool = worker->pool;
+	struct btp_task *task;
+	int idle = 0;
+
+	__btp_current = worker;
+	while (!atomic_load_explicit(&pool->stop, memory_order_acquire)) {
+		task = __btp_find_task(pool, worker);
+		if (task != NULL) {
+			__btp_run(task);
+			idle = 0;
+		} else if (++idle < BTP_SPIN_ROUNDS) {
+			sched_yield();
+		} else {
+			__btp_sleep(pool);
+			idle = 0;
+		}
+	}
+
+	return NULL;
+}
+
+static void __btp_pin(struct btp_worker *worker) {
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+
+	if (num_cpus <= 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(worker->index % num_cpus, &set);
+	pthread_setaffinity_np(worker->thread, sizeof(set), &set);
+}
+
+/* stops and joins the first started workers, then frees everything */
+static void __btp_shutdown(struct btp_pool *pool, int started) {
+	struct btp_task *task;
+	int i;
+
+	atomic_store_explicit(&pool->stop, 1, memory_order_release);
+	atomic_fetch_add(&pool->epoch, 1);
+	__btp_futex_wake(&pool->epoch, INT_MAX);
+
+	for (i = 0; i < started; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+	/* all the deques exist, and no worker can steal from them any more */
+	for (i = 0; i < pool->num_workers; i++)
+		bd_destroy(&pool->workers[i].deque);
+
+	/* there should be none left if all groups were waited for */
+	while ((task = pool->head) != NULL) {
+		pool->head = task->next;
+		free(task);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->num_workers = 0;
+}
+
+int btp_init(struct btp_pool *pool, int num_workers, int flags) {
+	int i;
+
+	if (num_workers <= 0)
+		num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_workers <= 0)
+		num_workers = 1;
+
+	/*
+	 * the deques are cache line aligned, more than calloc guarantees. A struct's size is a
+	 * multiple of its alignment, as aligned_alloc requires.
+	 */
+	pool->workers = (struct btp_worker *)aligned_alloc(_Alignof(struct btp_worker),
+		num_workers*sizeof(struct btp_worker));
+	if (pool->workers == NULL)
+		return BTP_ALLOC_ERROR;
+	memset(pool->workers, 0, num_workers*sizeof(struct btp_worker));
+
+	pool->num_workers = num_workers;
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->head = NULL;
+	pool->tail = NULL;
+	atomic_init(&pool->num_shared, 0);
+	atomic_init(&pool->epoch, 0);
+	atomic_init(&pool->sleepers, 0);
+	atomic_init(&pool->stop, 0);
+
+	for (i = 0; i < num_workers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+		pool->workers[i].seed = (unsigned int)i*2654435761u;
+		if (bd_init(&pool->workers[i].deque, 0)) {
+			while (--i >= 0)
+				bd_destroy(&pool->workers[i].deque);
+			free(pool->workers);
+			return BTP_ALLOC_ERROR;
+		}
+	}
+
+	/* the deques must all exist before any worker starts stealing */
+	for (i = 0; i < num_workers; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, __btp_worker_main, &pool->workers[i])) {
+			/* the started workers read num_workers, so it stays until they are joined */
+			__btp_shutdown(pool, i);
+			return BTP_THREAD_ERROR;
+		}
+		if (flags & BTP_PIN_CPUS)
+			__btp_pin(&pool->workers[i]);
+	}
+
+	return 0;
+}
+
+void btp_destroy(struct btp_pool *pool) {
+	__btp_shutdown(pool, pool->num_workers);
+}
+
+int btp_spawn(struct btp_pool *pool, struct btp_group *group, btp_task_func func, btp_args args) {
+	struct btp_worker *self = __btp_self(pool);
+	struct btp_task *task;
+
+	task = (struct btp_task *)malloc(sizeof(struct btp_task));
+	if (task == NULL) {
+		func(args);
+		return BTP_ALLOC_ERROR;
+	}
+
+	task->func = func;
+	task->args = args;
+	task->group = group;
+	task->next = NULL;
+	atomic_fetch_add(&group->pending, 1);
+
+	if (self == NULL || bd_push(&self->deque, task)) {
+		pthread_mutex_lock(&pool->lock);
+		if (pool->tail != NULL)
+			pool->tail->next = task;
+		else
+			pool->head = task;
+		pool->tail = task;
+		atomic_fetch_add(&pool->num_shared, 1);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	__btp_notify(pool);
+	return 0;
+}
+
+void btp_group_wait(struct btp_pool *pool, struct btp_group *group) {
+	struct btp_worker *self = __btp_self(pool);
+	struct btp_task *task;
+	int pending;
+
+	while ((pending = atomic_load(&group->pending)) > 0) {
+		task = __btp_find_task(pool, self);
+		if (task != NULL) {
+			__btp_run(task);
+			continue;
+		}
+
+		/* the remaining tasks are running elsewhere, sleep until the last one ends */
+		__btp_futex_wait(&group->pending, pending);
+	}
+}
+
+static void __btp_range_task(btp_args args) {
+	struct __btp_range range = *(struct __btp_range *)args;
+	struct __btp_range *half;
+	long mid;
+
+	free(args);
+
+	/* split off the upper halves for others to steal, keep the lower one */
+	while (range.end-range.begin > range.grain) {
+		mid = range.begin+(range.end-range.begin)/2;
+		half = (struct __btp_range *)malloc(sizeof(struct __btp_range));
+		if (half == NULL)
+			break;
+		*half = range;
+		half->begin = mid;
+		btp_spawn(range.pool, range.group, __btp_range_task, half);
+		range.end = mid;
+	}
+
+	range.func(range.begin, range.end, range.args);
+}
+
+void btp_parallel_for(struct btp_pool *pool, long begin, long end, long grain,
+		btp_range_func func, btp_args args) {
+	struct __btp_range *range;
+	struct btp_group group;
+
+	if (begin >= end)
+		return;
+
+	/* about 8 ranges per worker balance the load without too many tasks */
+	if (grain <= 0)
+		grain = (end-begin)/(8*pool->num_workers);
+	if (grain <= 0)
+		grain = 1;
+
+	range = (struct __btp_range *)malloc(sizeof(struct __btp_range));
+	if (range == NULL) {
+		func(begin, end, args);
+		return;
+	}
+
+	btp_group_init(&group);
+	range->pool = pool;
+	range->group = &group;
+	range->begin = begin;
+	range->end = end;
+	range->grain = grain;
+	range->func = func;
+	range->args = args;
+	btp_spawn(pool, &group, __btp_range_task, range);
+	btp_group_wait(pool, &group);
+}
+
+int btp_worker_index(struct btp_pool *pool) {
+	struct btp_worker *self = __btp_self(pool);
+
+	return (self != NULL) ? self->index : -1;
+}
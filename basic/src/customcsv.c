@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "customcsv.h"
+
+/*
+ * convenient macros for shortening code lines, will be undefined at the end
+ */
+#define cec cio_error_code
+
+/* masks for testing 8 bytes at a time */
+#define CSV_ONES  0x0101010101010101ULL
+#define CSV_HIGHS 0x8080808080808080ULL
+
+/* check if any byte of word equals the byte repeated in pattern */
+static inline int __csv_has_byte(uint64_t word, uint64_t pattern) {
+	uint64_t v = word ^ pattern;
+	return ((v - CSV_ONES) & ~v & CSV_HIGHS) != 0;
+}
+
+int __csv_scan(const char *ptr, int len, char delim) {
+	uint64_t word;
+	uint64_t delims = CSV_ONES * (unsigned char)delim;
+	uint64_t newlines = CSV_ONES * (unsigned char)'\n';
+	int i = 0;
+
+	/* skip 8 bytes at a time while none of them is a delimiter or a newline */
+	while (i+8 <= len) {
+		memcpy(&word, ptr+i, 8);
+		if (__csv_has_byte(word, delims) || __csv_has_byte(word, newlines))
+			break;
+		i += 8;
+	}
+
+	/* find the exact position */
+	while (i < len && ptr[i] != delim && ptr[i] != '\n')
+		i++;
+
+	return i;
+}
+
+cec __csv_add_field(struct csv_parser *parser, int offset, int len) {
+	int *temp_offsets = NULL;
+	int *temp_lengths = NULL;
+	struct csv_field *temp_fields = NULL;
+	int max_fields = parser->max_fields*2;
+
+	/* if the arrays are full, expand them */
+	if (parser->num_fields == parser->max_fields) {
+		temp_offsets = (int *)realloc(parser->offsets, max_fields*sizeof(int));
+		if (temp_offsets == NULL)
+			return CIO_ALLOC_ERROR;
+		parser->offsets = temp_offsets;
+
+		temp_lengths = (int *)realloc(parser->lengths, max_fields*sizeof(int));
+		if (temp_lengths == NULL)
+			return CIO_ALLOC_ERROR;
+		parser->lengths = temp_lengths;
+
+		temp_fields = (struct csv_field *)realloc(parser->fields, max_fields*sizeof(struct csv_field));
+		if (temp_fields == NULL)
+			return CIO_ALLOC_ERROR;
+		parser->fields = temp_fields;
+
+		parser->max_fields = max_fields;
+	}
+
+	parser->offsets[parser->num_fields] = offset;
+	parser->lengths[parser->num_fields] = len;
+	parser->num_fields++;
+
+	return 0;
+}
+
+cec __csv_parse_record(struct csv_parser *parser, int base, int *consumed) {
+	struct cio_reader *reader = &parser->reader;
+	char *p = NULL;
+	char *q = NULL;
+	int r = base, w = base;
+	int fstart, cont, n, k;
+	int c;
+	int rv;
+
+	/*
+	 * r is the read offset and w the write offset, both relative to the reader's start
+	 * so that they survive the buffer being refilled. Unescaping only shrinks the data,
+	 * so w never passes r.
+	 */
+	while (1) {
+		fstart = w;
+
+		rv = __cio_reader_ensure(reader, r);
+		if (rv < 0)
+			return rv;
+		if (rv == 0 && r == base)
+			return CIO_EOF;
+		p = reader->buf+reader->start;
+
+		/* quoted part of the field */
+		if (rv > 0 && parser->quote != '\0' && p[r] == parser->quote) {
+			r++;
+			while (1) {
+				rv = __cio_reader_ensure(reader, r);
+				if (rv < 0)
+					return rv;
+				/* unterminated quote, take what is there */
+				if (rv == 0)
+					break;
+				p = reader->buf+reader->start;
+				n = reader->end-reader->start-r;
+
+				/* no closing quote in the buffer yet, keep everything and read more */
+				q = (char *)memchr(p+r, parser->quote, n);
+				if (q == NULL) {
+					memmove(p+w, p+r, n);
+					w += n;
+					r += n;
+					continue;
+				}
+
+				k = q-(p+r);
+				memmove(p+w, p+r, k);
+				w += k;
+				r += k+1;
+
+				/* a doubled quote is an escaped quote, anything else closes the field */
+				rv = __cio_reader_ensure(reader, r);
+				if (rv < 0)
+					return rv;
+				p = reader->buf+reader->start;
+				if (rv == 0 || p[r] != parser->quote)
+					break;
+				p[w++] = parser->quote;
+				r++;
+			}
+		}
+
+		/* unquoted part of the field, until a delimiter or a newline */
+		cont = w;
+		c = EOF;
+		while (1) {
+			rv = __cio_reader_ensure(reader, r);
+			if (rv < 0)
+				return rv;
+			if (rv == 0)
+				break;
+			p = reader->buf+reader->start;
+			n = reader->end-reader->start-r;
+
+			k = __csv_scan(p+r, n, parser->delim);
+			if (w != r)
+				memmove(p+w, p+r, k);
+			w += k;
+			r += k;
+
+			if (k < n) {
+				c = p[r];
+				r++;
+				break;
+			}
+		}
+
+		/* strip the carriage return of a CRLF, unless it is quoted */
+		p = reader->buf+reader->start;
+		if (c == '\n' && w > cont && p[w-1] == '\r')
+			w--;
+
+		/* the reader keeps one spare byte past its end, so this is safe at EOF */
+		p[w] = '\0';
+		rv = __csv_add_field(parser, fstart, w-fstart);
+		if (rv)
+			return rv;
+		w++;
+
+		if (c != parser->delim)
+			break;
+	}
+
+	*consumed = r-base;
+	return 0;
+}
+
+cec csv_init(struct csv_parser *parser, FILE *stream, char delim, char quote) {
+	int rv;
+
+	rv = cio_reader_init(&parser->reader, stream, 0);
+	if (rv)
+		return rv;
+
+	parser->delim = delim;
+	parser->quote = quote;
+	parser->num_fields = 0;
+	parser->max_fields = CSV_INIT_FIELDS;
+	parser->offsets = (int *)malloc(CSV_INIT_FIELDS*sizeof(int));
+	parser->lengths = (int *)malloc(CSV_INIT_FIELDS*sizeof(int));
+	parser->fields = (struct csv_field *)malloc(CSV_INIT_FIELDS*sizeof(struct csv_field));
+	parser->records = NULL;
+	parser->max_records = 0;
+	parser->record = 0;
+
+	if (parser->offsets == NULL || parser->lengths == NULL || parser->fields == NULL) {
+		csv_destroy(parser);
+		return CIO_ALLOC_ERROR;
+	}
+
+	return 0;
+}
+
+void csv_destroy(struct csv_parser *parser) {
+	cio_reader_destroy(&parser->reader);
+	free(parser->offsets);
+	free(parser->lengths);
+	free(parser->fields);
+	free(parser->records);
+	parser->offsets = NULL;
+	parser->lengths = NULL;
+	parser->fields = NULL;
+	parser->records = NULL;
+	parser->max_fields = 0;
+	parser->max_records = 0;
+}
+
+cec csv_next_record(struct csv_parser *parser, struct csv_field **fields, int *num) {
+	char *data = NULL;
+	int consumed = 0;
+	int i;
+	int rv;
+
+	parser->num_fields = 0;
+	rv = __csv_parse_record(parser, 0, &consumed);
+	if (rv)
+		return rv;
+
+	/* turn the offsets into views */
+	data = parser->reader.buf+parser->reader.start;
+	for (i = 0; i < parser->num_fields; i++) {
+		parser->fields[i].ptr = data+parser->offsets[i];
+		parser->fields[i].len = parser->lengths[i];
+	}
+	parser->reader.start += consumed;
+	parser->record++;
+
+	/* save the results and return */
+	if (num != NULL)
+		*num = parser->num_fields;
+	*fields = parser->fields;
+
+	return 0;
+}
+
+cec csv_next_batch(struct csv_parser *parser, struct csv_batch *batch, int max_records) {
+	int *temp_ptr = NULL;
+	int consumed = 0;
+	int total = 0;
+	int num_records = 0;
+	int rv = 0;
+
+	if (max_records <= 0)
+		return 0;
+
+	/* make room for the record boundaries */
+	if (max_records+1 > parser->max_records) {
+		temp_ptr = (int *)realloc(parser->records, (max_records+1)*sizeof(int));
+		if (temp_ptr == NULL)
+			return CIO_ALLOC_ERROR;
+		parser->records = temp_ptr;
+		parser->max_records = max_records+1;
+	}
+
+	/* parse the records back to back, the reader's start stays fixed meanwhile */
+	parser->num_fields = 0;
+	while (num_records < max_records) {
+		parser->records[num_records] = parser->num_fields;
+		rv = __csv_parse_record(parser, total, &consumed);
+		if (rv)
+			break;
+		total += consumed;
+		num_records++;
+	}
+	parser->records[num_records] = parser->num_fields;
+
+	if (rv && rv != CIO_EOF)
+		return rv;
+	if (num_records == 0)
+		return CIO_EOF;
+
+	/* save the results and return */
+	batch->data = parser->reader.buf+parser->reader.start;
+	batch->offsets = parser->offsets;
+	batch->lengths = parser->lengths;
+	batch->records = parser->records;
+	batch->num_records = num_records;
+	batch->num_fields = parser->num_fields;
+	parser->reader.start += total;
+	parser->record += num_records;
+
+	return 0;
+}
+
+/*
+ * undefining the convenient macros
+ */
+#undef cec
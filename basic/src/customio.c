@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "customio.h"
 
 /*
@@ -7,6 +11,18 @@
  */
 #define cec cio_error_code
 
+/* powers of ten that are exact in a double */
+static const double __cio_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* all two-digit numbers, for formatting integers two digits at a time */
+static const char __cio_digit_pairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
 int __cio_is_delim(char c, const char *delims, int ws) {
 	int i = 0;
 
@@ -217,6 +233,607 @@ void cio_trim(char *str) {
 	cio_trim_after(str);
 }
 
+cec cio_reader_init(struct cio_reader *reader, FILE *stream, int buf_size) {
+	return cio_reader_init_with_allocator(reader, stream, buf_size, NULL);
+}
+
+cec cio_reader_init_arena(struct cio_reader *reader, FILE *stream, int buf_size, struct ba_arena *arena) {
+	return cio_reader_init_with_allocator(reader, stream, buf_size, ba_allocator(arena));
+}
+
+cec cio_reader_init_with_allocator(struct cio_reader *reader, FILE *stream, int buf_size, const struct bm_allocator *alloc) {
+	if (buf_size <= 0)
+		buf_size = CIO_READER_BUF_SIZE;
+
+	/* keep one extra byte to null-terminate the last line */
+	reader->buf = (char *)bm_alloc(alloc, buf_size+1);
+	if (reader->buf == NULL)
+		return CIO_ALLOC_ERROR;
+
+	reader->alloc = alloc;
+
+	reader->stream = stream;
+	reader->buf_size = buf_size;
+	reader->start = 0;
+	reader->end = 0;
+	reader->eof = 0;
+	reader->line = 0;
+
+	return 0;
+}
+
+void cio_reader_destroy(struct cio_reader *reader) {
+	bm_free(reader->alloc, reader->buf, reader->buf_size+1);
+	reader->buf = NULL;
+	reader->buf_size = 0;
+	reader->start = 0;
+	reader->end = 0;
+}
+
+cec __cio_reader_fill(struct cio_reader *reader) {
+	char *temp_ptr = NULL;
+	int len = reader->end - reader->start;
+	size_t n;
+
+	/* move the unread data to the front of the buffer */
+	if (reader->start > 0) {
+		memmove(reader->buf, reader->buf+reader->start, len);
+		reader->start = 0;
+		reader->end = len;
+	}
+
+	/* if the buffer is full of unread data, expand the buffer */
+	if (reader->end == reader->buf_size) {
+		temp_ptr = (char *)bm_realloc(reader->alloc, reader->buf, reader->buf_size+1, reader->buf_size*2+1);
+		if (temp_ptr == NULL)
+			return CIO_ALLOC_ERROR;
+		reader->buf = temp_ptr;
+		reader->buf_size *= 2;
+	}
+
+	/* read the next block */
+	n = fread(reader->buf+reader->end, 1, reader->buf_size-reader->end, reader->stream);
+	if (n == 0) {
+		if (ferror(reader->stream))
+			return CIO_READ_ERROR;
+		reader->eof = 1;
+	}
+	reader->end += n;
+
+	return 0;
+}
+
+cec __cio_reader_ensure(struct cio_reader *reader, int offset) {
+	int rv;
+
+	/* read more until the byte at offset is available */
+	while (reader->start+offset >= reader->end) {
+		if (reader->eof)
+			return 0;
+		rv = __cio_reader_fill(reader);
+		if (rv)
+			return rv;
+	}
+	return 1;
+}
+
+cec __cio_skip_ws(struct cio_reader *reader) {
+	int rv;
+
+	while (1) {
+		while (reader->start < reader->end && cio_is_ws(reader->buf[reader->start]))
+			reader->start++;
+		if (reader->start < reader->end)
+			return 1;
+
+		/* the buffer is used up, read more */
+		rv = __cio_reader_ensure(reader, 0);
+		if (rv <= 0)
+			return rv;
+	}
+}
+
+cec __cio_get_digits(struct cio_reader *reader, uint64_t *val, int *neg) {
+	const char *p = NULL;
+	uint64_t v = 0;
+	unsigned int d;
+	int i = 0, first, len;
+	int range = 0;
+	int rv;
+
+	rv = __cio_skip_ws(reader);
+	if (rv < 0)
+		return rv;
+	if (rv == 0)
+		return CIO_EOF;
+
+	/* make sure the whole number is in the buffer */
+	rv = __cio_reader_ensure(reader, CIO_NUM_MAX_LEN-1);
+	if (rv < 0)
+		return rv;
+	p = reader->buf+reader->start;
+	len = reader->end-reader->start;
+	if (len > CIO_NUM_MAX_LEN)
+		len = CIO_NUM_MAX_LEN;
+
+	/* only signed numbers may have a minus sign */
+	if (neg != NULL)
+		*neg = 0;
+	if (p[i] == '+') {
+		i++;
+	} else if (p[i] == '-' && neg != NULL) {
+		*neg = 1;
+		i++;
+	}
+
+	first = i;
+	while (i < len && (d = (unsigned int)(p[i]-'0')) < 10) {
+		if (v > (UINT64_MAX-d)/10)
+			range = 1;
+		else
+			v = v*10+d;
+		i++;
+	}
+	if (i == first || i == CIO_NUM_MAX_LEN)
+		return CIO_FORMAT_ERROR;
+
+	reader->start += i;
+	if (range)
+		return CIO_RANGE_ERROR;
+	*val = v;
+
+	return 0;
+}
+
+cec cio_get_int64(struct cio_reader *reader, int64_t *val) {
+	uint64_t v = 0;
+	int neg = 0;
+	int rv;
+
+	rv = __cio_get_digits(reader, &v, &neg);
+	if (rv)
+		return rv;
+
+	if (v > (uint64_t)INT64_MAX+neg)
+		return CIO_RANGE_ERROR;
+	if (neg)
+		*val = (v == (uint64_t)INT64_MAX+1) ? INT64_MIN : -(int64_t)v;
+	else
+		*val = (int64_t)v;
+
+	return 0;
+}
+
+cec cio_get_uint64(struct cio_reader *reader, uint64_t *val) {
+	return __cio_get_digits(reader, val, NULL);
+}
+
+cec cio_get_double(struct cio_reader *reader, double *val) {
+	char tmp[CIO_NUM_MAX_LEN+1];
+	char *endptr = NULL;
+	const char *p = NULL;
+	uint64_t m = 0;
+	unsigned int d;
+	int i = 0, j, len;
+	int neg = 0, digits = 0, sig = 0, exact = 1;
+	int exp = 0, e = 0, eneg = 0;
+	double v;
+	int rv;
+
+	rv = __cio_skip_ws(reader);
+	if (rv < 0)
+		return rv;
+	if (rv == 0)
+		return CIO_EOF;
+
+	/* make sure the whole number is in the buffer */
+	rv = __cio_reader_ensure(reader, CIO_NUM_MAX_LEN-1);
+	if (rv < 0)
+		return rv;
+	p = reader->buf+reader->start;
+	len = reader->end-reader->start;
+	if (len > CIO_NUM_MAX_LEN)
+		len = CIO_NUM_MAX_LEN;
+
+	if (p[i] == '+' || p[i] == '-') {
+		neg = (p[i] == '-');
+		i++;
+	}
+
+	/* integer part, keep up to 19 significant digits in m */
+	while (i < len && (d = (unsigned int)(p[i]-'0')) < 10) {
+		if (m != 0 || d != 0) {
+			if (++sig <= 19)
+				m = m*10+d;
+			else
+				exact = 0;
+		}
+		digits++;
+		i++;
+	}
+
+	/* fraction part */
+	if (i < len && p[i] == '.') {
+		i++;
+		while (i < len && (d = (unsigned int)(p[i]-'0')) < 10) {
+			if (m == 0 && d == 0) {
+				exp--;
+			} else if (++sig <= 19) {
+				m = m*10+d;
+				exp--;
+			} else {
+				exact = 0;
+			}
+			digits++;
+			i++;
+		}
+	}
+
+	/* no digit at all, it may still be inf or nan */
+	if (digits == 0) {
+		memcpy(tmp, p, len);
+		tmp[len] = '\0';
+		v = strtod(tmp, &endptr);
+		if (endptr == tmp)
+			return CIO_FORMAT_ERROR;
+		reader->start += endptr-tmp;
+		*val = v;
+		return 0;
+	}
+
+	/* exponent part, only taken if it has digits */
+	if (i < len && (p[i] == 'e' || p[i] == 'E')) {
+		j = i+1;
+		if (j < len && (p[j] == '+' || p[j] == '-')) {
+			eneg = (p[j] == '-');
+			j++;
+		}
+		if (j < len && (unsigned int)(p[j]-'0') < 10) {
+			while (j < len && (d = (unsigned int)(p[j]-'0')) < 10) {
+				if (e < 100000)
+					e = e*10+d;
+				j++;
+			}
+			i = j;
+			exp += eneg ? -e : e;
+		}
+	}
+
+	if (i == CIO_NUM_MAX_LEN)
+		return CIO_FORMAT_ERROR;
+
+	if (m == 0) {
+		/* zero, whatever the exponent */
+		v = 0.0;
+	} else if (exact && m <= (1ULL << 53) && exp >= -22 && exp <= 22) {
+		/* both m and the power of ten are exact, so one operation rounds correctly */
+		v = (double)m;
+		if (exp < 0)
+			v /= __cio_pow10[-exp];
+		else
+			v *= __cio_pow10[exp];
+	} else {
+		/* slow path, let the C library do the rounding */
+		memcpy(tmp, p, i);
+		tmp[i] = '\0';
+		errno = 0;
+		v = strtod(tmp, NULL);
+		reader->start += i;
+		if (errno == ERANGE && (v == HUGE_VAL || v == -HUGE_VAL))
+			return CIO_RANGE_ERROR;
+		*val = v;
+		return 0;
+	}
+
+	reader->start += i;
+	*val = neg ? -v : v;
+
+	return 0;
+}
+
+cec cio_getline(struct cio_reader *reader, char **line, int *num, int strip_cr) {
+	char *ptr1 = NULL;
+	char *nl = NULL;
+	int scanned = 0;
+	int len;
+	int rv;
+
+	/* search for the newline, only scanning the newly read data each round */
+	while ((nl = (char *)memchr(reader->buf+reader->start+scanned, '\n',
+			reader->end-reader->start-scanned)) == NULL) {
+		scanned = reader->end-reader->start;
+
+		/* the last line may have no newline */
+		if (reader->eof) {
+			if (scanned == 0)
+				return CIO_EOF;
+			nl = reader->buf+reader->end;
+			break;
+		}
+
+		rv = __cio_reader_fill(reader);
+		if (rv)
+			return rv;
+	}
+
+	ptr1 = reader->buf+reader->start;
+	len = nl-ptr1;
+
+	/* move past the line and its newline, if any */
+	reader->start += len;
+	if (reader->start < reader->end)
+		reader->start++;
+
+	if (strip_cr && len > 0 && ptr1[len-1] == '\r')
+		len--;
+
+	/* save the results and return */
+	ptr1[len] = '\0';
+	reader->line++;
+	if (num != NULL)
+		*num = len;
+	*line = ptr1;
+
+	return 0;
+}
+
+cec cio_getline_copy(struct cio_reader *reader, char **ptr, int size, int *num, int strip_cr) {
+	char *line = NULL;
+	char *ptr1 = *ptr;
+	char *temp_ptr = NULL;
+	int n = 0;
+	int rv;
+
+	rv = cio_getline(reader, &line, &n, strip_cr);
+	if (rv)
+		return rv;
+
+	/* allocate or expand the buffer if necessary */
+	if (ptr1 == NULL || n+1 > size) {
+		temp_ptr = (char *)realloc(ptr1, n+1);
+		if (temp_ptr == NULL)
+			return CIO_ALLOC_ERROR;
+		ptr1 = temp_ptr;
+	}
+
+	/* save the results and return */
+	memcpy(ptr1, line, n+1);
+	if (num != NULL)
+		*num = n;
+	*ptr = ptr1;
+
+	return 0;
+}
+
+cec cio_writer_init(struct cio_writer *writer, int fd, int buf_size) {
+	return cio_writer_init_with_allocator(writer, fd, buf_size, NULL);
+}
+
+cec cio_writer_init_arena(struct cio_writer *writer, int fd, int buf_size, struct ba_arena *arena) {
+	return cio_writer_init_with_allocator(writer, fd, buf_size, ba_allocator(arena));
+}
+
+cec cio_writer_init_with_allocator(struct cio_writer *writer, int fd, int buf_size, const struct bm_allocator *alloc) {
+	if (buf_size <= 0)
+		buf_size = CIO_WRITER_BUF_SIZE;
+
+	writer->buf = (char *)bm_alloc(alloc, buf_size);
+	if (writer->buf == NULL)
+		return CIO_ALLOC_ERROR;
+
+	writer->alloc = alloc;
+
+	writer->fd = fd;
+	writer->buf_size = buf_size;
+	writer->len = 0;
+
+	return 0;
+}
+
+/* write all the given vectors, retrying on partial writes */
+static cec __cio_writev_all(int fd, struct iovec *iov, int cnt) {
+	ssize_t n;
+
+	while (cnt > 0) {
+		n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return CIO_WRITE_ERROR;
+		}
+
+		/* skip what has been written */
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base+n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+cec cio_writer_flush(struct cio_writer *writer) {
+	struct iovec iov;
+	int rv;
+
+	if (writer->len == 0)
+		return 0;
+
+	iov.iov_base = writer->buf;
+	iov.iov_len = writer->len;
+	rv = __cio_writev_all(writer->fd, &iov, 1);
+	writer->len = 0;
+
+	return rv;
+}
+
+cec cio_writer_destroy(struct cio_writer *writer) {
+	int rv;
+
+	rv = cio_writer_flush(writer);
+	bm_free(writer->alloc, writer->buf, writer->buf_size);
+	writer->buf = NULL;
+	writer->buf_size = 0;
+
+	return rv;
+}
+
+cec cio_put(struct cio_writer *writer, const char *data, int len) {
+	struct iovec iov[2];
+	int rv;
+
+	/* the common case, it fits in the buffer */
+	if (len <= writer->buf_size-writer->len) {
+		memcpy(writer->buf+writer->len, data, len);
+		writer->len += len;
+		return 0;
+	}
+
+	/* large data goes straight to the file along with the buffer, in one call */
+	if (len >= writer->buf_size) {
+		iov[0].iov_base = writer->buf;
+		iov[0].iov_len = writer->len;
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = len;
+		rv = __cio_writev_all(writer->fd, iov, 2);
+		writer->len = 0;
+		return rv;
+	}
+
+	rv = cio_writer_flush(writer);
+	if (rv)
+		return rv;
+	memcpy(writer->buf, data, len);
+	writer->len = len;
+
+	return 0;
+}
+
+int __cio_format_uint64(char *end, uint64_t val) {
+	char *ptr = end;
+
+	/* fill the digits backward, two at a time */
+	while (val >= 100) {
+		ptr -= 2;
+		memcpy(ptr, __cio_digit_pairs+(val%100)*2, 2);
+		val /= 100;
+	}
+	if (val >= 10) {
+		ptr -= 2;
+		memcpy(ptr, __cio_digit_pairs+val*2, 2);
+	} else {
+		*--ptr = '0'+val;
+	}
+
+	return end-ptr;
+}
+
+cec cio_put_uint64(struct cio_writer *writer, uint64_t val) {
+	char tmp[24];
+	int n;
+
+	n = __cio_format_uint64(tmp+sizeof(tmp), val);
+	return cio_put(writer, tmp+sizeof(tmp)-n, n);
+}
+
+cec cio_put_int64(struct cio_writer *writer, int64_t val) {
+	char tmp[24];
+	uint64_t v = (uint64_t)val;
+	int n;
+
+	if (val < 0)
+		v = 0-v;
+	n = __cio_format_uint64(tmp+sizeof(tmp), v);
+	if (val < 0)
+		tmp[sizeof(tmp)-(++n)] = '-';
+
+	return cio_put(writer, tmp+sizeof(tmp)-n, n);
+}
+
+cec cio_put_double(struct cio_writer *writer, double val) {
+	char tmp[40];
+	char *end = tmp+sizeof(tmp);
+	double x = (val < 0) ? -val : val;
+	uint64_t m;
+	int d, n;
+
+	if (val != val)
+		return cio_put(writer, "nan", 3);
+	if (x == HUGE_VAL)
+		return (val < 0) ? cio_put(writer, "-inf", 4) : cio_put(writer, "inf", 3);
+
+	/*
+	 * Look for the fewest decimals d such that m / 10^d gives back x, with m and 10^d
+	 * both exact. Reading the result back does that same single division, so the
+	 * value is preserved.
+	 */
+	for (d = 0; d <= 17 && x*__cio_pow10[d] < 9007199254740992.0; d++) {
+		m = (uint64_t)(x*__cio_pow10[d]+0.5);
+		if ((double)m/__cio_pow10[d] != x)
+			continue;
+
+		n = __cio_format_uint64(end, m);
+		if (d > 0) {
+			/* pad with zeros so that there is a digit before the point */
+			while (n <= d)
+				end[-(++n)] = '0';
+			memmove(end-n-1, end-n, n-d);
+			end[-d-1] = '.';
+			n++;
+		}
+		if (val < 0 || (val == 0 && 1/val < 0))
+			end[-(++n)] = '-';
+
+		return cio_put(writer, end-n, n);
+	}
+
+	/* no short form, 17 significant digits always read back to the same value */
+	n = snprintf(tmp, sizeof(tmp), "%.17g", val);
+	return cio_put(writer, tmp, n);
+}
+
+cec cio_put_field(struct cio_writer *writer, const char *data, int len, char delim, char quote) {
+	const char *ptr = data;
+	const char *end = data+len;
+	const char *q = NULL;
+	int i;
+	int rv;
+
+	/* check if the field needs quoting at all */
+	if (quote != '\0') {
+		for (i = 0; i < len; i++) {
+			if (data[i] == delim || data[i] == quote || data[i] == '\n' || data[i] == '\r')
+				break;
+		}
+	}
+	if (quote == '\0' || i == len)
+		return cio_put(writer, data, len);
+
+	rv = cio_put_char(writer, quote);
+	if (rv)
+		return rv;
+
+	/* write the field in runs, doubling every quote */
+	while ((q = (const char *)memchr(ptr, quote, end-ptr)) != NULL) {
+		rv = cio_put(writer, ptr, q-ptr+1);
+		if (rv)
+			return rv;
+		rv = cio_put_char(writer, quote);
+		if (rv)
+			return rv;
+		ptr = q+1;
+	}
+	rv = cio_put(writer, ptr, end-ptr);
+	if (rv)
+		return rv;
+
+	return cio_put_char(writer, quote);
+}
+
 /*
  * undefining the convenient macros
  */
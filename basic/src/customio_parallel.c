@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "customio_parallel.h"
+
+/*
+ * convenient macros for shortening code lines, will be undefined at the end
+ */
+#define cec cio_error_code
+#define ccr cio_chunk_ret
+#define cca cio_chunk_args
+
+/* per-thread state */
+struct __cio_worker {
+	pthread_t thread;
+	struct cio_chunk *chunk;
+	cio_chunk_func func;
+	cca args;
+	ccr ret;
+	int started;
+};
+
+static void *__cio_worker_main(void *arg) {
+	struct __cio_worker *worker = (struct __cio_worker *)arg;
+
+	worker->ret = worker->func(worker->chunk, worker->args);
+	return NULL;
+}
+
+void __cio_split_chunks(const char *data, size_t size, int num_chunks, char delim, struct cio_chunk *chunks) {
+	const char *found = NULL;
+	size_t start = 0;
+	size_t end, from;
+	int i;
+
+	for (i = 0; i < num_chunks; i++) {
+		/* the nominal end, moved forward to just after the next delimiter */
+		if (i == num_chunks-1) {
+			end = size;
+		} else {
+			end = size/num_chunks*(i+1);
+			from = (end > start) ? end-1 : start;
+			found = (from < size) ? (const char *)memchr(data+from, delim, size-from) : NULL;
+			end = (found == NULL) ? size : (size_t)(found-data)+1;
+		}
+
+		chunks[i].data = data+start;
+		chunks[i].len = end-start;
+		chunks[i].offset = start;
+		chunks[i].index = i;
+		chunks[i].delim = delim;
+		chunks[i].pos = 0;
+		start = end;
+	}
+}
+
+cec cio_parallel_buffer(const char *data, size_t size, int num_chunks, char delim,
+		cio_chunk_func work_func, cca work_args, cio_chunk_done_func done_func, cca done_args) {
+	struct cio_chunk *chunks = NULL;
+	struct __cio_worker *workers = NULL;
+	int i;
+
+	if (num_chunks <= 0)
+		num_chunks = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_chunks <= 0)
+		num_chunks = 1;
+
+	/* don't bother splitting tiny inputs into empty chunks */
+	if ((size_t)num_chunks > size)
+		num_chunks = (size > 0) ? (int)size : 1;
+
+	chunks = (struct cio_chunk *)malloc(num_chunks*sizeof(struct cio_chunk));
+	workers = (struct __cio_worker *)malloc(num_chunks*sizeof(struct __cio_worker));
+	if (chunks == NULL || workers == NULL) {
+		free(chunks);
+		free(workers);
+		return CIO_ALLOC_ERROR;
+	}
+
+	__cio_split_chunks(data, size, num_chunks, delim, chunks);
+
+	/* the calling thread takes the first chunk itself */
+	for (i = 0; i < num_chunks; i++) {
+		workers[i].chunk = &chunks[i];
+		workers[i].func = work_func;
+		workers[i].args = work_args;
+		workers[i].ret = NULL;
+		workers[i].started = 0;
+		if (i > 0)
+			workers[i].started = !pthread_create(&workers[i].thread, NULL, __cio_worker_main, &workers[i]);
+	}
+
+	/* run the chunks that could not get a thread here as well */
+	for (i = 0; i < num_chunks; i++) {
+		if (!workers[i].started)
+			__cio_worker_main(&workers[i]);
+	}
+
+	/* wait for all workers, then hand the results over in order */
+	for (i = 0; i < num_chunks; i++) {
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+	}
+	if (done_func != NULL) {
+		for (i = 0; i < num_chunks; i++) {
+			cio_chunk_rewind(&chunks[i]);
+			done_func(&chunks[i], workers[i].ret, done_args);
+		}
+	}
+
+	free(workers);
+	free(chunks);
+
+	return 0;
+}
+
+cec cio_parallel_file(const char *path, int num_chunks, char delim,
+		cio_chunk_func work_func, cca work_args, cio_chunk_done_func done_func, cca done_args) {
+	struct stat st;
+	void *data = NULL;
+	size_t size;
+	int fd;
+	int rv;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return CIO_READ_ERROR;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return CIO_READ_ERROR;
+	}
+	size = (size_t)st.st_size;
+
+	/* an empty file can't be mapped, process it as an empty buffer */
+	if (size == 0) {
+		close(fd);
+		return cio_parallel_buffer("", 0, num_chunks, delim, work_func, work_args, done_func, done_args);
+	}
+
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return CIO_READ_ERROR;
+
+	/* every chunk is read front to back once */
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	rv = cio_parallel_buffer((const char *)data, size, num_chunks, delim,
+		work_func, work_args, done_func, done_args);
+
+	munmap(data, size);
+
+	return rv;
+}
+
+/*
+ * undefining the convenient macros
+ */
+#undef cec
+#undef ccr
+#undef cca
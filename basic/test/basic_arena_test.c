@@ -0,0 +1,153 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <basic_general.h>
+#include <basic_arena.h>
+
+static int count_chunks(struct ba_arena *arena) {
+	struct ba_chunk *ptr;
+	int n = 0;
+
+	for (ptr = arena->chunk; ptr != NULL; ptr = ptr->prev)
+		n++;
+	return n;
+}
+
+static void test_init(void **state) {
+	struct ba_arena arena;
+
+	ba_init(&arena, 0, 0);
+	assert_int_equal(NULL, arena.chunk);
+	assert_int_equal(BA_CHUNK_SIZE, arena.chunk_size);
+	assert_int_equal(BA_ALIGN, arena.align);
+
+	ba_init(&arena, 100, 4);
+	assert_int_equal(100, arena.chunk_size);
+	assert_int_equal(4, arena.align);
+	ba_destroy(&arena);
+}
+
+static void test_alloc(void **state) {
+	struct ba_arena arena;
+	char *p1, *p2, *p3;
+	int i;
+
+	ba_init(&arena, 256, 8);
+	p1 = (char *)ba_alloc(&arena, 3);
+	p2 = (char *)ba_alloc(&arena, 5);
+	assert_int_equal(0, (uintptr_t)p1 % 8);
+	assert_int_equal(8, p2-p1);
+	assert_int_equal(1, count_chunks(&arena));
+
+	p3 = (char *)ba_alloc_aligned(&arena, 1, 64);
+	assert_int_equal(0, (uintptr_t)p3 % 64);
+
+	/* fill up the first chunk, then chain a new one */
+	for (i = 0; i < 40; i++)
+		memset(ba_alloc(&arena, 8), i, 8);
+	assert_int_equal(2, count_chunks(&arena));
+
+	/* oversized allocations get their own chunk */
+	p1 = (char *)ba_alloc(&arena, 10000);
+	memset(p1, 0, 10000);
+	assert_int_equal(3, count_chunks(&arena));
+	ba_destroy(&arena);
+	assert_int_equal(0, count_chunks(&arena));
+}
+
+static void test_realloc(void **state) {
+	struct ba_arena arena;
+	char *p1, *p2;
+
+	ba_init(&arena, 256, 8);
+	p1 = (char *)ba_realloc(&arena, NULL, 0, 16);
+	strcpy(p1, "hello");
+
+	/* the last allocation grows in place */
+	p2 = (char *)ba_realloc(&arena, p1, 16, 64);
+	assert_int_equal(p1, p2);
+
+	/* otherwise it is copied */
+	ba_alloc(&arena, 8);
+	p2 = (char *)ba_realloc(&arena, p1, 64, 128);
+	assert_int_not_equal(p1, p2);
+	assert_string_equal("hello", p2);
+	ba_destroy(&arena);
+}
+
+static void test_mark(void **state) {
+	struct ba_arena arena;
+	struct ba_mark mark;
+	char *p1, *p2;
+	int i;
+
+	ba_init(&arena, 256, 8);
+	ba_alloc(&arena, 8);
+	mark = ba_mark(&arena);
+	p1 = (char *)ba_alloc(&arena, 8);
+	for (i = 0; i < 100; i++)
+		ba_alloc(&arena, 8);
+	assert_true(count_chunks(&arena) > 1);
+
+	ba_reset_to_mark(&arena, mark);
+	assert_int_equal(1, count_chunks(&arena));
+	p2 = (char *)ba_alloc(&arena, 8);
+	assert_int_equal(p1, p2);
+
+	/* a mark taken on an empty arena releases everything */
+	ba_destroy(&arena);
+	mark = ba_mark(&arena);
+	ba_alloc(&arena, 8);
+	ba_reset_to_mark(&arena, mark);
+	assert_int_equal(0, count_chunks(&arena));
+}
+
+static void test_reset(void **state) {
+	struct ba_arena arena;
+	char *p1;
+	int i;
+
+	ba_init(&arena, 256, 8);
+	ba_reset(&arena);
+	for (i = 0; i < 100; i++)
+		ba_alloc(&arena, 8);
+	assert_true(count_chunks(&arena) > 1);
+
+	ba_reset(&arena);
+	assert_int_equal(1, count_chunks(&arena));
+	p1 = (char *)ba_alloc(&arena, 8);
+	assert_int_equal((char *)(arena.chunk+1), p1);
+	ba_destroy(&arena);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_alloc),
+		unit_test(test_realloc),
+		unit_test(test_mark),
+		unit_test(test_reset)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks of the containers through cmocka_benchmark(). Run with
+ * CMOCKA_BENCHMARK_SAVE=file to record a baseline, and later with
+ * CMOCKA_BENCHMARK_BASELINE=file to fail on regressions. The hardware
+ * counter checks pass without checking where perf events are unavailable.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <basic_stack.h>
+#include <basic_queue.h>
+#include <basic_vector.h>
+#include <basic_hash.h>
+
+#define NUM_KEYS 65536
+
+BS_DEFINE(long_stack, long)
+BQ_DEFINE(long_queue, long)
+BV_DEFINE(long_vec, long)
+BH_DEFINE(bench_map, uint64_t, uint64_t, bh_hash_uint64, bh_eq_scalar)
+
+/* keeps results from being optimized away */
+static volatile long sink;
+
+static void stack_setup(void **state) {
+	struct bs_stack *stack = (struct bs_stack *)malloc(sizeof(struct bs_stack));
+
+	bs_init(stack);
+	*state = stack;
+}
+
+static void stack_teardown(void **state) {
+	bs_destroy((struct bs_stack *)*state, NULL, NULL);
+	free(*state);
+}
+
+static void stack_push_pop(void **state, size_t iterations) {
+	struct bs_stack *stack = (struct bs_stack *)*state;
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		bs_push((bs_data)i, stack);
+		sink = (long)bs_pop(stack);
+	}
+}
+
+static void test_stack(void **state) {
+	cmocka_benchmark(stack_push_pop, state);
+}
+
+static void queue_setup(void **state) {
+	struct bq_queue *queue = (struct bq_queue *)malloc(sizeof(struct bq_queue));
+
+	bq_init(queue);
+	*state = queue;
+}
+
+static void queue_teardown(void **state) {
+	bq_destroy((struct bq_queue *)*state, NULL, NULL);
+	free(*state);
+}
+
+static void queue_push_pop(void **state, size_t iterations) {
+	struct bq_queue *queue = (struct bq_queue *)*state;
+	size_t i;
+
+	for (i = 0; i < iterations; i++) {
+		bq_push((bq_data)i, queue);
+		sink = (long)bq_pop(queue);
+	}
+}
+
+static void test_queue(void **state) {
+	cmocka_benchmark(queue_push_pop, state);
+}
+
+static void typed_stack_push_pop(void **state, size_t iterations) {
+	struct long_stack stack;
+	long value = 0;
+	size_t i;
+
+	(void)state;
+	long_stack_init(&stack);
+	for (i = 0; i < iterations; i++) {
+		long_stack_push((long)i, &stack);
+		long_stack_pop(&stack, &value);
+		sink = value;
+	}
+	long_stack_destroy(&stack, NULL, NULL);
+}
+
+static void test_typed_stack(void **state) {
+	cmocka_benchmark(typed_stack_push_pop, state);
+}
+
+static void typed_queue_push_pop(void **state, size_t iterations) {
+	struct long_queue queue;
+	long value = 0;
+	size_t i;
+
+	(void)state;
+	long_queue_init(&queue);
+	for (i = 0; i < iterations; i++) {
+		long_queue_push((long)i, &queue);
+		long_queue_pop(&queue, &value);
+		sink = value;
+	}
+	long_queue_destroy(&queue, NULL, NULL);
+}
+
+static void test_typed_queue(void **state) {
+	cmocka_benchmark(typed_queue_push_pop, state);
+}
+
+static void vector_push(void **state, size_t iterations) {
+	struct long_vec vec;
+	size_t i;
+
+	(void)state;
+	long_vec_init(&vec);
+	for (i = 0; i < iterations; i++)
+		long_vec_push(&vec, (long)i);
+	sink = *long_vec_at(&vec, iterations-1);
+	long_vec_destroy(&vec);
+}
+
+static void test_vector(void **state) {
+	cmocka_benchmark(vector_push, state);
+}
+
+static void map_setup(void **state) {
+	struct bench_map *map = (struct bench_map *)malloc(sizeof(struct bench_map));
+	uint64_t i;
+
+	bench_map_init(map);
+	for (i = 0; i < NUM_KEYS; i++)
+		bench_map_insert(map, i*0x9e3779b97f4a7c15ULL, i);
+	*state = map;
+}
+
+static void map_teardown(void **state) {
+	bench_map_destroy((struct bench_map *)*state);
+	free(*state);
+}
+
+static void map_find_hit(void **state, size_t iterations) {
+	struct bench_map *map = (struct bench_map *)*state;
+	size_t i;
+
+	for (i = 0; i < iterations; i++)
+		sink = (long)*bench_map_find(map, ((i*7919) % NUM_KEYS)*0x9e3779b97f4a7c15ULL);
+}
+
+static void test_map_hit(void **state) {
+	cmocka_benchmark(map_find_hit, state);
+}
+
+static void map_find_miss(void **state, size_t iterations) {
+	struct bench_map *map = (struct bench_map *)*state;
+	size_t i;
+
+	for (i = 0; i < iterations; i++)
+		sink = bench_map_find(map, (NUM_KEYS+i)*0x9e3779b97f4a7c15ULL) != NULL;
+}
+
+static void test_map_miss(void **state) {
+	cmocka_benchmark(map_find_miss, state);
+}
+
+/* instructions are much steadier than time, so the limit can be tight */
+static void test_map_counters(void **state) {
+	map_find_hit(state, NUM_KEYS);
+
+	perf_counters_begin();
+	map_find_hit(state, NUM_KEYS);
+	perf_counters_end("map_find_hit", NUM_KEYS);
+	assert_perf_counter_max(PERF_COUNTER_INSTRUCTIONS, 200);
+}
+
+int main(int argc, char *argv[]) {
+	const UnitTest tests[] = {
+		unit_test_setup_teardown(test_stack, stack_setup, stack_teardown),
+		unit_test_setup_teardown(test_queue, queue_setup, queue_teardown),
+		unit_test(test_typed_stack),
+		unit_test(test_typed_queue),
+		unit_test(test_vector),
+		unit_test_setup_teardown(test_map_hit, map_setup, map_teardown),
+		unit_test_setup_teardown(test_map_miss, map_setup, map_teardown),
+		unit_test_setup_teardown(test_map_counters, map_setup, map_teardown),
+	};
+
+	if (cmocka_parse_args(argc, argv))
+		return 1;
+	return run_tests(tests);
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <basic_general.h>
+#include <basic_deque.h>
+
+#define NUM_THIEVES 4
+#define NUM_ITEMS 200000
+
+/* the owner stops pushing after this many items in a stress run */
+#define NUM_STRESS_ITEMS (1 << 22)
+#define MAX_STRESS_THREADS 8
+
+struct steal_args {
+	struct bd_deque *deque;
+	atomic_int *seen;
+	atomic_int *done;
+};
+
+/* thread 0 owns the deque, the others steal from it */
+struct stress_args {
+	struct bd_deque deque;
+	atomic_uchar *seen;
+	/* the last item pushed, owner only */
+	long pushed;
+	/* the last item each thief stole */
+	long stolen[MAX_STRESS_THREADS];
+};
+
+static void test_init(void **state) {
+	struct bd_deque deque;
+	bd_data data;
+
+	assert_int_equal(0, bd_init(&deque, 0));
+	assert_int_equal(BD_INIT_CAPACITY, deque.array->size);
+	assert_int_equal(0, bd_num_elem(&deque));
+	assert_int_equal(NULL, bd_pop(&deque));
+	assert_int_equal(BD_EMPTY, bd_steal(&deque, &data));
+	bd_destroy(&deque);
+
+	assert_int_equal(0, bd_init(&deque, 100));
+	assert_int_equal(128, deque.array->size);
+	bd_destroy(&deque);
+}
+
+static void test_push_pop_steal(void **state) {
+	struct bd_deque deque;
+	bd_data data;
+	long i;
+
+	bd_init(&deque, 4);
+	for (i = 1; i <= 100; i++)
+		assert_int_equal(0, bd_push(&deque, (bd_data)i));
+	assert_int_equal(100, bd_num_elem(&deque));
+	assert_true(deque.array->size >= 100);
+
+	/* the owner works at the bottom, thieves at the top */
+	assert_int_equal(100, (long)bd_pop(&deque));
+	assert_int_equal(0, bd_steal(&deque, &data));
+	assert_int_equal(1, (long)data);
+	assert_int_equal(99, (long)bd_pop(&deque));
+	assert_int_equal(0, bd_steal(&deque, &data));
+	assert_int_equal(2, (long)data);
+
+	for (i = 98; i >= 3; i--)
+		assert_int_equal(i, (long)bd_pop(&deque));
+	assert_int_equal(NULL, bd_pop(&deque));
+	assert_int_equal(BD_EMPTY, bd_steal(&deque, &data));
+	assert_int_equal(0, bd_num_elem(&deque));
+	bd_destroy(&deque);
+}
+
+static void *thief(void *ptr) {
+	struct steal_args *args = (struct steal_args *)ptr;
+	bd_data data;
+
+	while (!atomic_load(args->done) || bd_num_elem(args->deque) > 0) {
+		if (bd_steal(args->deque, &data) == 0)
+			atomic_fetch_add(&args->seen[(long)data-1], 1);
+	}
+	return NULL;
+}
+
+static void test_threads(void **state) {
+	struct bd_deque deque;
+	struct steal_args args;
+	pthread_t threads[NUM_THIEVES];
+	atomic_int *seen;
+	atomic_int done;
+	bd_data data;
+	long i, j;
+
+	seen = (atomic_int *)calloc(NUM_ITEMS, sizeof(atomic_int));
+	atomic_init(&done, 0);
+	bd_init(&deque, 2);
+	args.deque = &deque;
+	args.seen = seen;
+	args.done = &done;
+
+	for (i = 0; i < NUM_THIEVES; i++)
+		assert_int_equal(0, pthread_create(&threads[i], NULL, thief, &args));
+
+	/* push in bursts and pop some back, the deque grows while being robbed */
+	for (i = 0; i < NUM_ITEMS; i += 100) {
+		for (j = i; j < i+100; j++)
+			assert_int_equal(0, bd_push(&deque, (bd_data)(j+1)));
+		for (j = 0; j < 30; j++) {
+			data = bd_pop(&deque);
+			if (data != NULL)
+				atomic_fetch_add(&seen[(long)data-1], 1);
+		}
+	}
+	while ((data = bd_pop(&deque)) != NULL)
+		atomic_fetch_add(&seen[(long)data-1], 1);
+	atomic_store(&done, 1);
+
+	for (i = 0; i < NUM_THIEVES; i++)
+		pthread_join(threads[i], NULL);
+
+	/* every element was taken exactly once */
+	for (i = 0; i < NUM_ITEMS; i++)
+		assert_int_equal(1, atomic_load(&seen[i]));
+
+	bd_destroy(&deque);
+	free(seen);
+}
+
+static void stress_setup(void **state) {
+	/* the deque is cache line aligned, more than malloc guarantees */
+	struct stress_args *args = (struct stress_args *)aligned_alloc(_Alignof(struct stress_args),
+		sizeof(struct stress_args));
+
+	args->seen = (atomic_uchar *)calloc(NUM_STRESS_ITEMS, sizeof(atomic_uchar));
+	*state = args;
+}
+
+static void stress_teardown(void **state) {
+	struct stress_args *args = (struct stress_args *)*state;
+
+	free(args->seen);
+	free(args);
+}
+
+static void take(struct stress_args *args, bd_data data) {
+	atomic_fetch_add(&args->seen[(long)data-1], 1);
+}
+
+static void push_pop_steal(void **state, int thread, int num_threads) {
+	struct stress_args *args = (struct stress_args *)*state;
+	bd_data data;
+
+	if (thread == 0) {
+		/* push two and pop one, so the deque grows while being robbed */
+		if (args->pushed < NUM_STRESS_ITEMS) {
+			assert_int_equal(0, bd_push(&args->deque, (bd_data)++args->pushed));
+			assert_int_equal(0, bd_push(&args->deque, (bd_data)++args->pushed));
+		}
+		data = bd_pop(&args->deque);
+		if (data != NULL)
+			take(args, data);
+	} else if (bd_steal(&args->deque, &data) == 0) {
+		/* the top only moves up, over items pushed in increasing order */
+		assert_true((long)data > args->stolen[thread]);
+		args->stolen[thread] = (long)data;
+		take(args, data);
+	}
+}
+
+static void test_stress(void **state) {
+	struct stress_args *args = (struct stress_args *)*state;
+	bd_data data;
+	int threads;
+	long i;
+
+	for (threads = 2; threads <= MAX_STRESS_THREADS; threads *= 2) {
+		memset(args->seen, 0, NUM_STRESS_ITEMS*sizeof(atomic_uchar));
+		memset(args->stolen, 0, sizeof(args->stolen));
+		args->pushed = 0;
+		bd_init(&args->deque, 2);
+
+		cmocka_stress(push_pop_steal, state, threads);
+		while ((data = bd_pop(&args->deque)) != NULL)
+			take(args, data);
+
+		/* every item pushed was taken exactly once */
+		for (i = 0; i < args->pushed; i++)
+			assert_int_equal(1, atomic_load(&args->seen[i]));
+		bd_destroy(&args->deque);
+	}
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_push_pop_steal),
+		unit_test(test_threads),
+		unit_test_setup_teardown(test_stress, stress_setup, stress_teardown)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,150 @@
+/*
+ * Benchmark of the basic_hash.h flat map against a chained hash table built from
+ * bl_head buckets, with uint64_t keys and values.
+ *
+ * usage: basic_hash_bench [num_entries ...]
+ * The default runs 1M and 10M entries; 100M needs about 8GB of memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <basic_general.h>
+#include <basic_list.h>
+#include <basic_hash.h>
+
+BH_DEFINE(bench_map, uint64_t, uint64_t, bh_hash_uint64, bh_eq_scalar)
+
+struct chain_node {
+	struct bl_head list;
+	uint64_t key;
+	uint64_t value;
+};
+
+struct chain_map {
+	struct bl_head *buckets;
+	struct chain_node *nodes;
+	size_t mask;
+	size_t size;
+};
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+/* the keys are spread out but not random, like ids */
+static uint64_t make_key(size_t i) {
+	return i*0x9e3779b97f4a7c15ULL;
+}
+
+static void chain_init(struct chain_map *map, size_t num) {
+	size_t num_buckets = 1;
+	size_t i;
+
+	while (num_buckets < num)
+		num_buckets *= 2;
+	map->buckets = (struct bl_head *)malloc(num_buckets*sizeof(struct bl_head));
+	map->nodes = (struct chain_node *)malloc(num*sizeof(struct chain_node));
+	for (i = 0; i < num_buckets; i++)
+		BL_INIT_HEAD(&map->buckets[i]);
+	map->mask = num_buckets-1;
+	map->size = 0;
+}
+
+static void chain_insert(struct chain_map *map, uint64_t key, uint64_t value) {
+	struct bl_head *head = &map->buckets[bh_hash_uint64(key) & map->mask];
+	struct chain_node *node;
+
+	bl_for_each_entry(node, head, list) {
+		if (node->key == key) {
+			node->value = value;
+			return;
+		}
+	}
+	node = &map->nodes[map->size++];
+	node->key = key;
+	node->value = value;
+	bl_add(&node->list, head);
+}
+
+static uint64_t *chain_find(struct chain_map *map, uint64_t key) {
+	struct bl_head *head = &map->buckets[bh_hash_uint64(key) & map->mask];
+	struct chain_node *node;
+
+	bl_for_each_entry(node, head, list) {
+		if (node->key == key)
+			return &node->value;
+	}
+	return NULL;
+}
+
+static void chain_destroy(struct chain_map *map) {
+	free(map->buckets);
+	free(map->nodes);
+}
+
+static void run(size_t num) {
+	struct bench_map flat;
+	struct chain_map chain;
+	uint64_t sum = 0;
+	uint64_t *value;
+	double start;
+	size_t i;
+
+	printf("%zu entries\n", num);
+
+	bench_map_init(&flat);
+	start = now();
+	for (i = 0; i < num; i++)
+		bench_map_insert(&flat, make_key(i), i);
+	printf("  flat    insert %8.1f ns/op\n", (now()-start)*1e9/num);
+	start = now();
+	for (i = 0; i < num; i++) {
+		value = bench_map_find(&flat, make_key((i*7919) % num));
+		sum += *value;
+	}
+	printf("  flat    hit    %8.1f ns/op\n", (now()-start)*1e9/num);
+	start = now();
+	for (i = 0; i < num; i++)
+		sum += bench_map_find(&flat, make_key(num+i)) != NULL;
+	printf("  flat    miss   %8.1f ns/op\n", (now()-start)*1e9/num);
+	bench_map_destroy(&flat);
+
+	chain_init(&chain, num);
+	start = now();
+	for (i = 0; i < num; i++)
+		chain_insert(&chain, make_key(i), i);
+	printf("  chained insert %8.1f ns/op\n", (now()-start)*1e9/num);
+	start = now();
+	for (i = 0; i < num; i++) {
+		value = chain_find(&chain, make_key((i*7919) % num));
+		sum += *value;
+	}
+	printf("  chained hit    %8.1f ns/op\n", (now()-start)*1e9/num);
+	start = now();
+	for (i = 0; i < num; i++)
+		sum += chain_find(&chain, make_key(num+i)) != NULL;
+	printf("  chained miss   %8.1f ns/op\n", (now()-start)*1e9/num);
+	chain_destroy(&chain);
+
+	/* keeps the lookups from being optimized away */
+	if (sum == 42)
+		printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	int i;
+
+	if (argc < 2) {
+		run(1000000);
+		run(10000000);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++)
+		run((size_t)strtoull(argv[i], NULL, 10));
+	return 0;
+}
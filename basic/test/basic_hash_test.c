@@ -0,0 +1,201 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <basic_general.h>
+#include <basic_arena.h>
+#include <basic_hash.h>
+
+/* a bad hash that puts all keys on the same probe sequence */
+#define same_hash(key) ((uint64_t)(key) & 0x7f)
+
+BH_DEFINE(int_map, uint64_t, int, bh_hash_uint64, bh_eq_scalar)
+BH_DEFINE(str_map, const char *, int, bh_hash_str, bh_eq_str)
+BH_DEFINE(bad_map, uint64_t, int, same_hash, bh_eq_scalar)
+
+static void test_init(void **state) {
+	struct int_map map;
+
+	int_map_init(&map);
+	assert_int_equal(0, int_map_size(&map));
+	assert_int_equal(0, map.capacity);
+	assert_int_equal(NULL, int_map_find(&map, 1));
+	assert_int_equal(0, int_map_erase(&map, 1));
+	int_map_destroy(&map);
+}
+
+static void test_insert_find(void **state) {
+	struct int_map map;
+	int *value;
+	int inserted;
+	uint64_t i;
+
+	int_map_init(&map);
+	for (i = 0; i < 10000; i++)
+		assert_int_equal(0, int_map_insert(&map, i*7, (int)i));
+	assert_int_equal(10000, int_map_size(&map));
+	assert_true(map.size <= map.capacity-map.capacity/8);
+
+	for (i = 0; i < 10000; i++) {
+		value = int_map_find(&map, i*7);
+		assert_non_null(value);
+		assert_int_equal(i, *value);
+		assert_int_equal(NULL, int_map_find(&map, i*7+1));
+	}
+
+	/* existing keys are replaced */
+	assert_int_equal(0, int_map_insert(&map, 14, -1));
+	assert_int_equal(-1, *int_map_find(&map, 14));
+	value = int_map_emplace(&map, 14, &inserted);
+	assert_int_equal(0, inserted);
+	assert_int_equal(-1, *value);
+	value = int_map_emplace(&map, 15, &inserted);
+	assert_int_equal(1, inserted);
+	assert_int_equal(10001, int_map_size(&map));
+
+	int_map_destroy(&map);
+}
+
+static void test_erase(void **state) {
+	struct int_map map;
+	uint64_t i;
+
+	int_map_init(&map);
+	for (i = 0; i < 1000; i++)
+		int_map_insert(&map, i, (int)i);
+	for (i = 0; i < 1000; i += 2)
+		assert_int_equal(1, int_map_erase(&map, i));
+	assert_int_equal(0, int_map_erase(&map, 0));
+	assert_int_equal(500, int_map_size(&map));
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 2)
+			assert_int_equal(i, *int_map_find(&map, i));
+		else
+			assert_int_equal(NULL, int_map_find(&map, i));
+	}
+
+	int_map_clear(&map);
+	assert_int_equal(0, int_map_size(&map));
+	assert_int_equal(NULL, int_map_find(&map, 1));
+	int_map_destroy(&map);
+}
+
+static void test_tombstones(void **state) {
+	struct bad_map map;
+	size_t capacity;
+	uint64_t i;
+
+	/* all keys collide, so erasing from full groups leaves tombstones */
+	bad_map_init(&map);
+	for (i = 0; i < 40; i++)
+		bad_map_insert(&map, i << 7, (int)i);
+	capacity = map.capacity;
+	for (i = 0; i < 40; i++)
+		assert_int_equal(i, *bad_map_find(&map, i << 7));
+
+	/* churn at a constant size must not grow the table */
+	for (i = 40; i < 4000; i++) {
+		assert_int_equal(1, bad_map_erase(&map, (i-40) << 7));
+		assert_int_equal(0, bad_map_insert(&map, i << 7, (int)i));
+	}
+	assert_int_equal(40, bad_map_size(&map));
+	assert_int_equal(capacity, map.capacity);
+	for (i = 3960; i < 4000; i++)
+		assert_int_equal(i, *bad_map_find(&map, i << 7));
+	assert_int_equal(NULL, bad_map_find(&map, 0));
+
+	bad_map_destroy(&map);
+}
+
+static void test_str(void **state) {
+	struct str_map map;
+	struct str_map_slot *pos;
+	char key[] = "three";
+	int sum = 0;
+
+	str_map_init(&map);
+	str_map_insert(&map, "one", 1);
+	str_map_insert(&map, "two", 2);
+	str_map_insert(&map, "three", 3);
+
+	/* keys are compared by content */
+	assert_int_equal(3, *str_map_find(&map, key));
+	assert_int_equal(NULL, str_map_find(&map, "four"));
+
+	BH_FOREACH(pos, &map)
+		sum += pos->value;
+	assert_int_equal(6, sum);
+	str_map_destroy(&map);
+}
+
+static void test_bulk(void **state) {
+	struct int_map map;
+	uint64_t keys[1000];
+	int values[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		keys[i] = 3*i;
+		values[i] = -i;
+	}
+
+	int_map_init(&map);
+	int_map_insert(&map, 0, 100);
+	assert_int_equal(0, int_map_insert_bulk(&map, keys, values, 1000));
+	assert_int_equal(1000, int_map_size(&map));
+	for (i = 0; i < 1000; i++)
+		assert_int_equal(-i, *int_map_find(&map, 3*i));
+	int_map_destroy(&map);
+}
+
+static void test_arena(void **state) {
+	struct ba_arena arena;
+	struct int_map map;
+	uint64_t i;
+
+	ba_init(&arena, 0, 0);
+	int_map_init_with_allocator(&map, ba_allocator(&arena));
+	assert_int_equal(0, int_map_reserve(&map, 100));
+	assert_true(map.capacity-map.capacity/8 >= 100);
+	for (i = 0; i < 100; i++)
+		int_map_insert(&map, i, (int)i);
+	assert_true((char *)map.slots >= (char *)(arena.chunk+1));
+	assert_int_equal(99, *int_map_find(&map, 99));
+
+	/* the table is released with the arena */
+	ba_destroy(&arena);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_insert_find),
+		unit_test(test_erase),
+		unit_test(test_tombstones),
+		unit_test(test_str),
+		unit_test(test_bulk),
+		unit_test(test_arena)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <basic_general.h>
+#include <basic_pool.h>
+#include <basic_stack.h>
+
+#define NUM_THREADS 8
+#define NUM_ROUNDS 200
+
+static int count_slabs(struct bp_pool *pool) {
+	struct bp_slab *ptr;
+	int n = 0;
+
+	for (ptr = pool->slabs; ptr != NULL; ptr = ptr->next)
+		n++;
+	return n;
+}
+
+static void test_init(void **state) {
+	struct bp_pool pool;
+
+	bp_init(&pool, 1, 0);
+	assert_int_equal(sizeof(void *), pool.obj_size);
+	assert_int_equal(BP_SLAB_OBJECTS, pool.slab_objects);
+	bp_destroy(&pool);
+
+	bp_init(&pool, sizeof(void *)+1, 10);
+	assert_int_equal(2*sizeof(void *), pool.obj_size);
+	assert_int_equal(10, pool.slab_objects);
+	assert_int_equal(0, count_slabs(&pool));
+	bp_destroy(&pool);
+}
+
+static void test_alloc_free(void **state) {
+	struct bp_pool pool;
+	char *p1, *p2, *p3;
+	int i;
+
+	bp_init(&pool, 16, 4);
+	p1 = (char *)bp_alloc(&pool);
+	p2 = (char *)bp_alloc(&pool);
+	assert_int_equal(16, p2-p1);
+	assert_int_equal(1, count_slabs(&pool));
+
+	/* freed objects are reused first */
+	bp_free(&pool, p1);
+	p3 = (char *)bp_alloc(&pool);
+	assert_int_equal(p1, p3);
+
+	for (i = 0; i < 3; i++)
+		memset(bp_alloc(&pool), i, 16);
+	assert_int_equal(2, count_slabs(&pool));
+	bp_destroy(&pool);
+}
+
+static void test_cache(void **state) {
+	struct bp_pool pool;
+	struct bp_cache cache;
+	void *ptrs[3*BP_MAGAZINE_SIZE];
+	void *ptr;
+	int i;
+
+	bp_init(&pool, 32, 0);
+	bp_cache_init(&cache, &pool);
+
+	for (i = 0; i < 3*BP_MAGAZINE_SIZE; i++) {
+		ptrs[i] = bp_cache_alloc(&cache);
+		assert_non_null(ptrs[i]);
+		memset(ptrs[i], i, 32);
+	}
+	for (i = 0; i < 3*BP_MAGAZINE_SIZE; i++)
+		bp_cache_free(&cache, ptrs[i]);
+
+	/* more than two magazines were freed, the rest went to the depot */
+	assert_non_null(pool.full);
+	assert_int_equal(BP_MAGAZINE_SIZE, cache.loaded->num+cache.previous->num-BP_MAGAZINE_SIZE);
+
+	/* the last freed object comes back first */
+	ptr = bp_cache_alloc(&cache);
+	assert_int_equal(ptrs[3*BP_MAGAZINE_SIZE-1], ptr);
+	bp_cache_free(&cache, ptr);
+
+	bp_cache_destroy(&cache);
+	assert_int_equal(NULL, cache.loaded);
+	bp_destroy(&pool);
+}
+
+static void test_allocator(void **state) {
+	struct bp_pool pool;
+	struct bp_cache cache;
+	struct bs_stack stack;
+	struct bm_allocator *alloc;
+	char *ptr;
+	int i;
+
+	bp_init(&pool, sizeof(bs_elem), 0);
+	bp_cache_init(&cache, &pool);
+	bs_init_with_allocator(&stack, bp_cache_allocator(&cache));
+
+	for (i = 0; i < 1000; i++)
+		bs_push((void *)(long)i, &stack);
+	assert_int_equal(1, count_slabs(&pool));
+	for (i = 999; i >= 500; i--)
+		assert_int_equal(i, (long)bs_pop(&stack));
+	bs_destroy(&stack, NULL, NULL);
+
+	/* bigger blocks go to malloc */
+	alloc = bp_allocator(&pool);
+	ptr = (char *)bm_alloc(alloc, 1000);
+	memset(ptr, 0, 1000);
+	ptr = (char *)bm_realloc(alloc, ptr, 1000, 8);
+	bm_free(alloc, ptr, 8);
+
+	bp_cache_destroy(&cache);
+	bp_destroy(&pool);
+}
+
+static void *pool_thread(void *args) {
+	struct bp_pool *pool = (struct bp_pool *)args;
+	struct bp_cache cache;
+	struct bs_stack stack;
+	int i, j;
+
+	bp_cache_init(&cache, pool);
+	bs_init_with_allocator(&stack, bp_cache_allocator(&cache));
+	for (i = 0; i < NUM_ROUNDS; i++) {
+		for (j = 0; j < 100; j++)
+			bs_push((void *)(long)j, &stack);
+		for (j = 99; j >= 0; j--)
+			if ((long)bs_pop(&stack) != j)
+				return (void *)1;
+	}
+	bs_destroy(&stack, NULL, NULL);
+	bp_cache_destroy(&cache);
+
+	return NULL;
+}
+
+static void test_threads(void **state) {
+	struct bp_pool pool;
+	pthread_t threads[NUM_THREADS];
+	void *ret;
+	int i;
+
+	bp_init(&pool, sizeof(bs_elem), 0);
+	for (i = 0; i < NUM_THREADS; i++)
+		assert_int_equal(0, pthread_create(&threads[i], NULL, pool_thread, &pool));
+	for (i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], &ret);
+		assert_int_equal(NULL, ret);
+	}
+	bp_destroy(&pool);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_alloc_free),
+		unit_test(test_cache),
+		unit_test(test_allocator),
+		unit_test(test_threads)
+	};
+
+	return run_tests(tests);
+}
@@ -32,6 +32,8 @@ int test_num1;
 int test_num2;
 int test_num3;
 
+BQ_DEFINE(int_queue, int)
+
 static void cleanup_func(void *e, void *args) {
 	int data = *((int *)args);
 
@@ -403,7 +405,142 @@ static void test_destroy(void **state) {
 	assert_int_equal(1, bq_is_empty(&queue));
 }
 
+static void sum_cleanup(int *data, void *args) {
+	*(int *)args += *data;
+}
+
+static void test_define(void **state) {
+	struct int_queue queue;
+	int *pos;
+	int data, sum = 0;
+	int i;
+
+	int_queue_init(&queue);
+	assert_int_equal(1, int_queue_is_empty(&queue));
+	assert_int_equal(NULL, int_queue_peek(&queue));
+	assert_int_equal(0, int_queue_pop_tail(&queue, &data));
+
+	/* push on both ends so that the ring wraps around while growing */
+	for (i = 0; i < 20; i++) {
+		assert_int_equal(0, int_queue_push_head(-i-1, &queue));
+		assert_int_equal(0, int_queue_push(i, &queue));
+	}
+	assert_int_equal(40, int_queue_num_elem(&queue));
+	assert_int_equal(-20, *int_queue_peek_head(&queue));
+	assert_int_equal(19, *int_queue_peek_tail(&queue));
+
+	data = -20;
+	BQ_TYPED_FOREACH(pos, i, &queue)
+		assert_int_equal(data++, *pos);
+	assert_int_equal(40, i);
+
+	assert_int_equal(1, int_queue_pop(&queue, &data));
+	assert_int_equal(-20, data);
+	assert_int_equal(1, int_queue_pop_tail(&queue, &data));
+	assert_int_equal(19, data);
+	assert_int_equal(1, int_queue_pop_head(&queue, NULL));
+	assert_int_equal(37, int_queue_num_elem(&queue));
+
+	/* -18..18 sum to 0 */
+	sum = 5;
+	int_queue_destroy(&queue, sum_cleanup, &sum);
+	assert_int_equal(5, sum);
+	assert_int_equal(1, int_queue_is_empty(&queue));
+	assert_int_equal(NULL, queue.elems);
+}
+
+/* allocator going through cmocka, so that its allocations are checked */
+static void *tracked_alloc(void *ctx, size_t size) {
+	return test_malloc(size);
+}
+
+static void *tracked_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+	void *neww = test_malloc(new_size);
+
+	if (ptr != NULL) {
+		memcpy(neww, ptr, old_size < new_size ? old_size : new_size);
+		test_free(ptr);
+	}
+	return neww;
+}
+
+static void tracked_free(void *ctx, void *ptr, size_t size) {
+	if (ptr != NULL)
+		test_free(ptr);
+}
+
+static void test_no_alloc(void **state) {
+	struct bm_allocator alloc;
+	struct bq_queue queue;
+	struct int_queue ints;
+	teste e1, e2;
+	int data;
+	int i;
+
+	bm_init(&alloc, tracked_alloc, tracked_realloc, tracked_free, NULL);
+	bq_init_with_allocator(&queue, &alloc);
+	e1.num = 1;
+	e2.num = 2;
+
+	/* a push allocates one element, and a pop only frees it */
+	assert_allocations_begin(1, sizeof(bq_elem));
+	bq_push((void *)&e1, &queue);
+	assert_allocations_end();
+	bq_push((void *)&e2, &queue);
+	assert_no_allocations_begin();
+	assert_int_equal(&e1, bq_pop(&queue));
+	assert_no_allocations_end();
+	bq_destroy(&queue, NULL, NULL);
+
+	/* the ring buffer doesn't allocate once it has grown large enough */
+	int_queue_init_with_allocator(&ints, &alloc);
+	assert_max_allocations_begin(8);
+	for (i = 0; i < 16; i++)
+		int_queue_push(i, &ints);
+	while (int_queue_pop(&ints, &data))
+		;
+	assert_allocations_end();
+
+	assert_no_allocations_begin();
+	for (i = 0; i < 1000; i++) {
+		int_queue_push(i, &ints);
+		int_queue_push_head(-i, &ints);
+		int_queue_pop_tail(&ints, &data);
+		assert_int_equal(i, data);
+		int_queue_pop(&ints, &data);
+		assert_int_equal(-i, data);
+	}
+	assert_no_allocations_end();
+	int_queue_destroy(&ints, NULL, NULL);
+}
+
 /* main function */
+static void test_arena(void **state) {
+	struct ba_arena arena;
+	struct bq_queue queue;
+	teste e1, e2, e3, *e;
+
+	ba_init(&arena, 0, 0);
+	bq_init_arena(&queue, &arena);
+	assert_int_equal(ba_allocator(&arena), queue.alloc);
+	e1.num = 1;
+	e2.num = 2;
+	e3.num = 3;
+
+	bq_push((void *)&e1, &queue);
+	bq_push((void *)&e2, &queue);
+	bq_push_head((void *)&e3, &queue);
+	verify_queue(&queue, 3, 3, 1, 2);
+
+	e = (teste *)bq_pop_tail(&queue);
+	assert_int_equal(2, e->num);
+	verify_queue(&queue, 2, 3, 1);
+
+	bq_destroy(&queue, NULL, NULL);
+	assert_int_equal(1, bq_is_empty(&queue));
+	ba_destroy(&arena);
+}
+
 int main(void) {
 	const UnitTest tests[] = {
 		unit_test(test_init),
@@ -412,7 +549,10 @@ int main(void) {
 		unit_test(test_reverse),
 		unit_test(test_num_elem),
 		unit_test(test_foreach),
-		unit_test(test_destroy)
+		unit_test(test_destroy),
+		unit_test(test_arena),
+		unit_test(test_define),
+		unit_test(test_no_alloc)
 	};
 
 	return run_tests(tests);
@@ -31,6 +31,9 @@ typedef struct test_entry teste;
 int test_num1;
 int test_num2;
 
+BS_DEFINE(teste_stack, teste)
+BS_SMALL_DEFINE(small_stack, 4)
+
 static void cleanup_func(void *e, void *args) {
 	int data = *((int *)args);
 
@@ -300,6 +303,257 @@ static void test_destroy(void **state) {
 	assert_int_equal(1, bs_is_empty(&stack));
 }
 
+static void test_arena(void **state) {
+	struct ba_arena arena;
+	struct bs_stack stack;
+	teste e1, e2, *e;
+	int i;
+
+	ba_init(&arena, 0, 0);
+	bs_init_arena(&stack, &arena);
+	assert_int_equal(ba_allocator(&arena), stack.alloc);
+	e1.num = 1;
+	e2.num = 2;
+
+	bs_push((void *)&e1, &stack);
+	bs_push((void *)&e2, &stack);
+	verify_stack(&stack, 2, 2, 1);
+	assert_true((char *)stack.top >= (char *)(arena.chunk+1));
+	assert_true((char *)stack.top < arena.chunk->end);
+
+	e = (teste *)bs_pop(&stack);
+	assert_int_equal(2, e->num);
+	verify_stack(&stack, 1, 1);
+
+	for (i = 0; i < 10000; i++)
+		bs_push((void *)&e1, &stack);
+	assert_int_equal(10001, bs_num_elem(&stack));
+
+	/* everything is released with the arena */
+	ba_destroy(&arena);
+	bs_init_arena(&stack, &arena);
+	assert_int_equal(1, bs_is_empty(&stack));
+
+	/* no arena means malloc/free */
+	bs_init_arena(&stack, NULL);
+	assert_null(stack.alloc);
+	bs_push((void *)&e1, &stack);
+	bs_destroy(&stack, NULL, NULL);
+}
+
+/* counts the bytes in use through the allocator */
+static void *count_alloc(void *ctx, size_t size) {
+	*(size_t *)ctx += size;
+	return malloc(size);
+}
+
+static void *count_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+	*(size_t *)ctx += new_size-old_size;
+	return realloc(ptr, new_size);
+}
+
+static void count_free(void *ctx, void *ptr, size_t size) {
+	*(size_t *)ctx -= size;
+	free(ptr);
+}
+
+static void test_allocator(void **state) {
+	struct bm_allocator alloc;
+	struct bs_stack stack;
+	size_t in_use = 0;
+	teste e1;
+
+	bm_init(&alloc, count_alloc, count_realloc, count_free, &in_use);
+	bs_init_with_allocator(&stack, &alloc);
+	assert_int_equal(&alloc, stack.alloc);
+
+	bs_push((void *)&e1, &stack);
+	bs_push((void *)&e1, &stack);
+	assert_true(in_use > 0);
+
+	bs_pop(&stack);
+	bs_destroy(&stack, NULL, NULL);
+	assert_int_equal(0, in_use);
+}
+
+static void sum_cleanup(teste *e, void *args) {
+	*(int *)args += e->num;
+}
+
+static void test_define(void **state) {
+	struct teste_stack stack;
+	teste e, *pos;
+	int sum = 0;
+	int i;
+
+	teste_stack_init(&stack);
+	assert_int_equal(1, teste_stack_is_empty(&stack));
+	assert_int_equal(NULL, teste_stack_peek(&stack));
+	assert_int_equal(0, teste_stack_pop(&stack, &e));
+
+	/* elements are stored by value */
+	for (i = 0; i < 100; i++) {
+		e.num = i;
+		e.str = NULL;
+		assert_int_equal(0, teste_stack_push(e, &stack));
+	}
+	e.num = -1;
+	assert_int_equal(100, teste_stack_num_elem(&stack));
+	assert_int_equal(99, teste_stack_peek(&stack)->num);
+
+	i = 99;
+	BS_TYPED_FOREACH(pos, &stack)
+		assert_int_equal(i--, pos->num);
+	assert_int_equal(-1, i);
+
+	assert_int_equal(1, teste_stack_pop(&stack, &e));
+	assert_int_equal(99, e.num);
+	assert_int_equal(1, teste_stack_pop(&stack, NULL));
+	assert_int_equal(98, teste_stack_num_elem(&stack));
+
+	teste_stack_destroy(&stack, sum_cleanup, &sum);
+	assert_int_equal(97*98/2, sum);
+	assert_int_equal(1, teste_stack_is_empty(&stack));
+	assert_int_equal(NULL, stack.elems);
+
+	/* iterating over an empty stack */
+	BS_TYPED_FOREACH(pos, &stack)
+		fail();
+}
+
+static void test_small(void **state) {
+	struct small_stack small;
+	struct bs_stack *stack;
+	struct bm_allocator alloc;
+	size_t in_use = 0;
+	teste e1, e2, e3, **pos;
+	int i;
+
+	bm_init(&alloc, count_alloc, count_realloc, count_free, &in_use);
+	stack = small_stack_init_with_allocator(&small, &alloc);
+	e1.num = 1;
+	e2.num = 2;
+	e3.num = 3;
+
+	/* the inline elements need no allocation */
+	bs_push((void *)&e1, stack);
+	bs_push((void *)&e2, stack);
+	bs_push((void *)&e3, stack);
+	bs_push((void *)&e1, stack);
+	assert_int_equal(0, in_use);
+	verify_stack(stack, 4, 1, 3, 2, 1);
+
+	/* the next ones spill to the allocator */
+	bs_push((void *)&e2, stack);
+	bs_push((void *)&e3, stack);
+	assert_int_equal(2*sizeof(bs_elem), in_use);
+	verify_stack(stack, 6, 3, 2, 1, 3, 2, 1);
+
+	i = 0;
+	BS_FOREACH(pos, teste, stack)
+		i += (*pos)->num;
+	assert_int_equal(12, i);
+
+	assert_int_equal(3, ((teste *)bs_pop(stack))->num);
+	assert_int_equal(sizeof(bs_elem), in_use);
+
+	/* the inline elements are reused after being popped */
+	bs_destroy(stack, NULL, NULL);
+	assert_int_equal(0, in_use);
+	assert_int_equal(1, bs_is_empty(stack));
+	for (i = 0; i < 4; i++)
+		bs_push((void *)&e1, stack);
+	assert_int_equal(0, in_use);
+	bs_destroy(stack, NULL, NULL);
+}
+
+static void count_cleanup(void *data, void *args) {
+	(*(int *)args)++;
+}
+
+static void test_mark(void **state) {
+	struct bs_rstack rstack;
+	struct bs_stack *stack;
+	struct bm_allocator alloc;
+	struct bs_mark mark1, mark2;
+	size_t in_use = 0;
+	teste e1, e2, e3;
+	int count = 0;
+	int i;
+
+	bm_init(&alloc, count_alloc, count_realloc, count_free, &in_use);
+	stack = bs_rstack_init(&rstack, &alloc);
+	e1.num = 1;
+	e2.num = 2;
+	e3.num = 3;
+
+	bs_push((void *)&e1, stack);
+	mark1 = bs_mark(stack);
+	bs_push((void *)&e2, stack);
+	bs_push((void *)&e2, stack);
+	mark2 = bs_mark(stack);
+	bs_push((void *)&e3, stack);
+
+	bs_rollback(&rstack, mark2, count_cleanup, &count);
+	assert_int_equal(1, count);
+	verify_stack(stack, 3, 2, 2, 1);
+
+	/* the discarded element is reused without allocating */
+	bs_push((void *)&e3, stack);
+	assert_int_equal(4*sizeof(bs_elem), in_use);
+	verify_stack(stack, 4, 3, 2, 2, 1);
+
+	for (i = 0; i < 10; i++)
+		bs_push((void *)&e3, stack);
+	bs_rollback(&rstack, mark1, NULL, NULL);
+	verify_stack(stack, 1, 1);
+	assert_int_equal(14*sizeof(bs_elem), in_use);
+
+	/* rolling back to a mark that is not below the top does nothing */
+	bs_rollback(&rstack, mark2, NULL, NULL);
+	verify_stack(stack, 1, 1);
+
+	for (i = 0; i < 5; i++)
+		bs_push((void *)&e2, stack);
+	assert_int_equal(14*sizeof(bs_elem), in_use);
+	verify_stack(stack, 6, 2, 2, 2, 2, 2, 1);
+
+	/* the next rollback and destroy release the leftovers */
+	bs_rollback(&rstack, mark1, NULL, NULL);
+	bs_rollback(&rstack, mark1, NULL, NULL);
+	bs_push((void *)&e3, stack);
+	bs_rollback(&rstack, mark1, NULL, NULL);
+	assert_int_equal(2*sizeof(bs_elem), in_use);
+	bs_rstack_destroy(&rstack, NULL, NULL);
+	assert_int_equal(0, in_use);
+}
+
+static void test_define_mark(void **state) {
+	struct teste_stack stack;
+	teste e;
+	int mark;
+	int sum = 0;
+	int i;
+
+	teste_stack_init(&stack);
+	for (i = 0; i < 10; i++) {
+		e.num = i;
+		teste_stack_push(e, &stack);
+	}
+	mark = teste_stack_mark(&stack);
+	for (i = 10; i < 20; i++) {
+		e.num = i;
+		teste_stack_push(e, &stack);
+	}
+
+	teste_stack_rollback(&stack, mark, sum_cleanup, &sum);
+	assert_int_equal(145, sum);
+	assert_int_equal(10, teste_stack_num_elem(&stack));
+	teste_stack_rollback(&stack, 5, NULL, NULL);
+	assert_int_equal(4, teste_stack_peek(&stack)->num);
+	teste_stack_destroy(&stack, NULL, NULL);
+}
+
 /* main function */
 int main(void) {
 	const UnitTest tests[] = {
@@ -308,7 +562,13 @@ int main(void) {
 		unit_test(test_is_empty),
 		unit_test(test_foreach),
 		unit_test(test_num_elem),
-		unit_test(test_destroy)
+		unit_test(test_destroy),
+		unit_test(test_arena),
+		unit_test(test_allocator),
+		unit_test(test_define),
+		unit_test(test_small),
+		unit_test(test_mark),
+		unit_test(test_define_mark)
 		
 	};
 
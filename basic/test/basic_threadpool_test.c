@@ -0,0 +1,187 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <basic_general.h>
+#include <basic_threadpool.h>
+
+#define NUM_WORKERS 4
+
+struct fib_args {
+	struct btp_pool *pool;
+	int n;
+	long result;
+};
+
+static atomic_long total;
+
+static void add_task(btp_args args) {
+	atomic_fetch_add(&total, (long)args);
+}
+
+static void sum_range(long begin, long end, btp_args args) {
+	long *values = (long *)args;
+	long sum = 0;
+	long i;
+
+	for (i = begin; i < end; i++)
+		sum += values[i];
+	atomic_fetch_add(&total, sum);
+}
+
+/* nested fork/join, each task spawns two more */
+static void fib_task(btp_args ptr) {
+	struct fib_args *args = (struct fib_args *)ptr;
+	struct fib_args left, right;
+	struct btp_group group;
+
+	if (args->n < 2) {
+		args->result = args->n;
+		return;
+	}
+
+	left.pool = right.pool = args->pool;
+	left.n = args->n-1;
+	right.n = args->n-2;
+	btp_group_init(&group);
+	btp_spawn(args->pool, &group, fib_task, &left);
+	btp_spawn(args->pool, &group, fib_task, &right);
+	btp_group_wait(args->pool, &group);
+	args->result = left.result+right.result;
+}
+
+static void record_index(btp_args args) {
+	struct btp_pool *pool = (struct btp_pool *)args;
+	int index = btp_worker_index(pool);
+
+	/* -1 when run by the waiting thread */
+	if (index < -1 || index >= NUM_WORKERS)
+		atomic_fetch_add(&total, 1000000);
+}
+
+static void test_init(void **state) {
+	struct btp_pool pool;
+
+	assert_int_equal(0, btp_init(&pool, NUM_WORKERS, 0));
+	assert_int_equal(NUM_WORKERS, pool.num_workers);
+	assert_int_equal(-1, btp_worker_index(&pool));
+	btp_destroy(&pool);
+
+	assert_int_equal(0, btp_init(&pool, 0, BTP_PIN_CPUS));
+	assert_true(pool.num_workers > 0);
+	btp_destroy(&pool);
+}
+
+static void test_spawn(void **state) {
+	struct btp_pool pool;
+	struct btp_group group;
+	long i;
+
+	btp_init(&pool, NUM_WORKERS, 0);
+	btp_group_init(&group);
+	atomic_store(&total, 0);
+	for (i = 1; i <= 1000; i++)
+		assert_int_equal(0, btp_spawn(&pool, &group, add_task, (btp_args)i));
+	btp_group_wait(&pool, &group);
+	assert_int_equal(500500, atomic_load(&total));
+	assert_int_equal(0, atomic_load(&group.pending));
+
+	/* tasks run on the workers or on the waiting thread */
+	btp_group_init(&group);
+	for (i = 0; i < 100; i++)
+		btp_spawn(&pool, &group, record_index, &pool);
+	btp_group_wait(&pool, &group);
+	assert_int_equal(500500, atomic_load(&total));
+	btp_destroy(&pool);
+}
+
+static void test_fork_join(void **state) {
+	struct btp_pool pool;
+	struct btp_group group;
+	struct fib_args args;
+
+	btp_init(&pool, NUM_WORKERS, 0);
+	args.pool = &pool;
+	args.n = 20;
+	btp_group_init(&group);
+	btp_spawn(&pool, &group, fib_task, &args);
+	btp_group_wait(&pool, &group);
+	assert_int_equal(6765, args.result);
+	btp_destroy(&pool);
+}
+
+static void test_parallel_for(void **state) {
+	struct btp_pool pool;
+	long *values;
+	long i;
+
+	values = (long *)malloc(100000*sizeof(long));
+	for (i = 0; i < 100000; i++)
+		values[i] = i;
+
+	btp_init(&pool, NUM_WORKERS, 0);
+	atomic_store(&total, 0);
+	btp_parallel_for(&pool, 0, 100000, 0, sum_range, values);
+	assert_int_equal(4999950000L, atomic_load(&total));
+
+	atomic_store(&total, 0);
+	btp_parallel_for(&pool, 10, 20, 1, sum_range, values);
+	assert_int_equal(145, atomic_load(&total));
+
+	atomic_store(&total, 0);
+	btp_parallel_for(&pool, 5, 5, 0, sum_range, values);
+	assert_int_equal(0, atomic_load(&total));
+	btp_destroy(&pool);
+	free(values);
+}
+
+static void test_idle(void **state) {
+	struct btp_pool pool;
+	struct btp_group group;
+	int i;
+
+	btp_init(&pool, NUM_WORKERS, 0);
+
+	/* the workers go to sleep within a few seconds, and wake up for new work */
+	for (i = 0; i < 500 && atomic_load(&pool.sleepers) < NUM_WORKERS; i++)
+		usleep(10000);
+	assert_int_equal(NUM_WORKERS, atomic_load(&pool.sleepers));
+
+	atomic_store(&total, 0);
+	btp_group_init(&group);
+	btp_spawn(&pool, &group, add_task, (btp_args)7);
+	btp_group_wait(&pool, &group);
+	assert_int_equal(7, atomic_load(&total));
+	btp_destroy(&pool);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_spawn),
+		unit_test(test_fork_join),
+		unit_test(test_parallel_for),
+		unit_test(test_idle)
+	};
+
+	return run_tests(tests);
+}
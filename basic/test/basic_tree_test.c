@@ -553,6 +553,30 @@ static void test_traverse(void **state) {
 	assert_string_equal("", test_str);
 }
 
+static void test_arena(void **state) {
+	struct ba_arena arena;
+	btnode *root, *node;
+	int i;
+
+	ba_init(&arena, 0, 0);
+	root = bt_new_arena((void *)1, &arena);
+	assert_int_equal(ba_allocator(&arena), root->alloc);
+	assert_int_equal(1, bt_is_alone(root));
+
+	for (i = 0; i < 100; i++) {
+		node = bt_new_arena((void *)(long)i, &arena);
+		bt_append(node, root);
+	}
+	assert_int_equal(101, bt_num_nodes(root));
+	assert_int_equal(42, (long)bt_nth_child(root, 42)->data);
+
+	/* destroying arena nodes only cleans up the data */
+	test_num = 0;
+	bt_destroy(bt_unlink(node), NULL, NULL);
+	assert_int_equal(100, bt_num_nodes(root));
+	ba_destroy(&arena);
+}
+
 /*
  * private functions
  */
@@ -639,7 +663,8 @@ int main(void) {
 		unit_test_setup_teardown(test_is_leaf, setup_tree, teardown_tree),
 		unit_test_setup_teardown(test_is_alone, setup_tree, teardown_tree),
 		unit_test_setup_teardown(test_unlink, setup_tree, teardown_tree),
-		unit_test_setup_teardown(test_traverse, setup_tree, teardown_tree)
+		unit_test_setup_teardown(test_traverse, setup_tree, teardown_tree),
+		unit_test(test_arena)
 	};
 
 	return run_tests(tests);
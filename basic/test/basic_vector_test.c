@@ -0,0 +1,203 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <basic_general.h>
+#include <basic_arena.h>
+#include <basic_vector.h>
+
+struct point {
+	int x;
+	int y;
+};
+
+BV_DEFINE(int_vec, int)
+BV_DEFINE(point_vec, struct point)
+
+static void verify_vec(struct int_vec *vec, size_t size, ...) {
+	va_list ap;
+	size_t i;
+
+	assert_int_equal(size, int_vec_size(vec));
+	assert_true(vec->capacity >= vec->size);
+	va_start(ap, size);
+	for (i = 0; i < size; i++)
+		assert_int_equal(va_arg(ap, int), *int_vec_at(vec, i));
+	va_end(ap);
+}
+
+static void test_init(void **state) {
+	struct int_vec vec;
+
+	int_vec_init(&vec);
+	assert_int_equal(NULL, vec.data);
+	assert_int_equal(NULL, vec.alloc);
+	verify_vec(&vec, 0);
+	int_vec_destroy(&vec);
+}
+
+static void test_push_pop(void **state) {
+	struct int_vec vec;
+	int i;
+
+	int_vec_init(&vec);
+	for (i = 0; i < 1000; i++)
+		assert_int_equal(0, int_vec_push(&vec, i));
+	assert_int_equal(1000, int_vec_size(&vec));
+	assert_int_equal(1024, vec.capacity);
+
+	for (i = 999; i >= 0; i--)
+		assert_int_equal(i, int_vec_pop(&vec));
+	verify_vec(&vec, 0);
+	int_vec_destroy(&vec);
+}
+
+static void test_reserve_resize(void **state) {
+	struct int_vec vec;
+
+	int_vec_init(&vec);
+	assert_int_equal(0, int_vec_reserve(&vec, 100));
+	assert_int_equal(100, vec.capacity);
+	assert_int_equal(0, int_vec_reserve(&vec, 10));
+	assert_int_equal(100, vec.capacity);
+
+	int_vec_push(&vec, 7);
+	assert_int_equal(0, int_vec_resize(&vec, 3));
+	verify_vec(&vec, 3, 7, 0, 0);
+	assert_int_equal(0, int_vec_resize(&vec, 1));
+	verify_vec(&vec, 1, 7);
+
+	assert_int_equal(0, int_vec_shrink_to_fit(&vec));
+	assert_int_equal(1, vec.capacity);
+	verify_vec(&vec, 1, 7);
+
+	int_vec_clear(&vec);
+	assert_int_equal(0, int_vec_shrink_to_fit(&vec));
+	assert_int_equal(NULL, vec.data);
+	assert_int_equal(0, vec.capacity);
+	int_vec_destroy(&vec);
+}
+
+static void test_insert_erase(void **state) {
+	struct int_vec vec;
+	int buf[] = {1, 2, 3, 4, 5};
+
+	int_vec_init(&vec);
+	assert_int_equal(0, int_vec_append(&vec, buf, 5));
+	verify_vec(&vec, 5, 1, 2, 3, 4, 5);
+
+	assert_int_equal(0, int_vec_insert(&vec, 2, buf, 2));
+	verify_vec(&vec, 7, 1, 2, 1, 2, 3, 4, 5);
+	assert_int_equal(0, int_vec_insert(&vec, 7, buf+4, 1));
+	verify_vec(&vec, 8, 1, 2, 1, 2, 3, 4, 5, 5);
+	assert_int_equal(0, int_vec_insert(&vec, 0, buf, 0));
+	verify_vec(&vec, 8, 1, 2, 1, 2, 3, 4, 5, 5);
+
+	int_vec_erase(&vec, 0, 3);
+	verify_vec(&vec, 5, 2, 3, 4, 5, 5);
+	int_vec_erase(&vec, 3, 2);
+	verify_vec(&vec, 3, 2, 3, 4);
+	int_vec_destroy(&vec);
+}
+
+static void test_struct(void **state) {
+	struct point_vec vec;
+	struct point p, *pos;
+	int sum = 0;
+	int i;
+
+	point_vec_init(&vec);
+	for (i = 0; i < 10; i++) {
+		p.x = i;
+		p.y = 2*i;
+		point_vec_push(&vec, p);
+	}
+
+	BV_FOREACH(pos, &vec)
+		sum += pos->y-pos->x;
+	assert_int_equal(45, sum);
+
+	p = point_vec_pop(&vec);
+	assert_int_equal(9, p.x);
+	assert_int_equal(18, p.y);
+	point_vec_destroy(&vec);
+}
+
+static void test_move(void **state) {
+	struct int_vec vec1, vec2;
+	int *data;
+	size_t size, capacity;
+
+	int_vec_init(&vec1);
+	int_vec_init(&vec2);
+	int_vec_push(&vec1, 1);
+	int_vec_push(&vec1, 2);
+	int_vec_push(&vec2, 3);
+	data = vec1.data;
+
+	/* the buffer changes hands, nothing is copied */
+	int_vec_move(&vec2, &vec1);
+	assert_int_equal(data, vec2.data);
+	verify_vec(&vec2, 2, 1, 2);
+	verify_vec(&vec1, 0);
+
+	data = int_vec_release(&vec2, &size, &capacity);
+	assert_int_equal(2, size);
+	assert_int_equal(BV_INIT_CAPACITY, capacity);
+	assert_int_equal(2, data[1]);
+	verify_vec(&vec2, 0);
+	assert_int_equal(NULL, vec2.data);
+	bm_free(NULL, data, capacity*sizeof(int));
+
+	int_vec_destroy(&vec1);
+	int_vec_destroy(&vec2);
+}
+
+static void test_arena(void **state) {
+	struct ba_arena arena;
+	struct int_vec vec;
+	int i;
+
+	ba_init(&arena, 0, 0);
+	int_vec_init_with_allocator(&vec, ba_allocator(&arena));
+	for (i = 0; i < 100; i++)
+		int_vec_push(&vec, i);
+	assert_true((char *)vec.data >= (char *)(arena.chunk+1));
+	assert_true((char *)(vec.data+vec.size) <= arena.chunk->end);
+	assert_int_equal(99, *int_vec_at(&vec, 99));
+
+	/* the vector is released with the arena */
+	ba_destroy(&arena);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_init),
+		unit_test(test_push_pop),
+		unit_test(test_reserve_resize),
+		unit_test(test_insert_erase),
+		unit_test(test_struct),
+		unit_test(test_move),
+		unit_test(test_arena)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_OUTPUT 4096
+
+/* the suite run by the tests below, in a child process */
+static void inner_test(void **state) {
+}
+
+static void inner_setup(void **state) {
+}
+
+static void inner_teardown(void **state) {
+}
+
+static const UnitTest inner_tests[] = {
+	{"alpha_one", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"alpha_two", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"beta_one", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"beta_slow", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"gamma_setup", inner_setup, UNIT_TEST_FUNCTION_TYPE_SETUP},
+	{"gamma_one", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"gamma_two", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"gamma_teardown", inner_teardown, UNIT_TEST_FUNCTION_TYPE_TEARDOWN},
+	{"delta_one", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"delta_two", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+};
+
+static void failing_test(void **state) {
+	fail();
+}
+/* the line of the fail() above */
+static const int failing_line = __LINE__-3;
+
+/* names that need escaping in both reports */
+static const UnitTest report_tests[] = {
+	{"passes", inner_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+	{"fails<\"&>", failing_test, UNIT_TEST_FUNCTION_TYPE_TEST},
+};
+
+static const char *inner_names[] = {
+	"alpha_one", "alpha_two", "beta_one", "beta_slow", "gamma_one", "gamma_two",
+	"delta_one", "delta_two"
+};
+
+/*
+ * Runs tests in a child process, since run_tests() keeps its options in globals and
+ * can't be nested in a test, after calling configure with args there. Returns the
+ * result of run_tests() and leaves what it printed in output.
+ */
+static int run_inner(const UnitTest *tests, size_t num_tests, void (*configure)(void *),
+		void *args, char *output) {
+	char path[] = "/tmp/cmocka_runner_testXXXXXX";
+	int fd, status;
+	ssize_t size;
+	pid_t pid;
+
+	fd = mkstemp(path);
+	assert_true(fd >= 0);
+	fflush(NULL);
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		cmocka_set_jobs(1);
+		configure(args);
+		status = _run_tests(tests, num_tests);
+		fflush(NULL);
+		_exit(status < 0 ? 255 : status);
+	}
+	assert_int_equal(pid, waitpid(pid, &status, 0));
+	assert_true(WIFEXITED(status));
+
+	size = pread(fd, output, MAX_OUTPUT-1, 0);
+	assert_true(size >= 0);
+	output[size] = '\0';
+	close(fd);
+	unlink(path);
+	return WEXITSTATUS(status) == 255 ? -1 : WEXITSTATUS(status);
+}
+
+/* number of lines of output that are exactly name */
+static int count_lines(const char *output, const char *name) {
+	size_t len = strlen(name);
+	const char *line;
+	int count = 0;
+
+	for (line = output; *line; line = strchr(line, '\n')+1) {
+		if (strncmp(line, name, len) == 0 && line[len] == '\n')
+			count++;
+		if (strchr(line, '\n') == NULL)
+			break;
+	}
+	return count;
+}
+
+static int count_all_lines(const char *output) {
+	const char *pos;
+	int count = 0;
+
+	for (pos = output; (pos = strchr(pos, '\n')) != NULL; pos++)
+		count++;
+	return count;
+}
+
+struct list_args {
+	const char *filter;
+	int index;
+	int total;
+};
+
+static void list_configure(void *args) {
+	struct list_args *list = (struct list_args *)args;
+
+	cmocka_set_test_filter(list->filter);
+	cmocka_set_shard(list->index, list->total);
+	cmocka_set_list_tests(1);
+}
+
+static int list_inner(const char *filter, int index, int total, char *output) {
+	struct list_args args = {filter, index, total};
+
+	return run_inner(inner_tests, sizeof(inner_tests)/sizeof(inner_tests[0]),
+		list_configure, &args, output);
+}
+
+static void test_list(void **state) {
+	char output[MAX_OUTPUT];
+	size_t i;
+
+	assert_int_equal(0, list_inner(NULL, 0, 1, output));
+	assert_int_equal(8, count_all_lines(output));
+	for (i = 0; i < sizeof(inner_names)/sizeof(inner_names[0]); i++)
+		assert_int_equal(1, count_lines(output, inner_names[i]));
+}
+
+static void test_filter(void **state) {
+	char output[MAX_OUTPUT];
+
+	assert_int_equal(0, list_inner("alpha_*", 0, 1, output));
+	assert_int_equal(2, count_all_lines(output));
+	assert_int_equal(1, count_lines(output, "alpha_one"));
+	assert_int_equal(1, count_lines(output, "alpha_two"));
+
+	/* exclusions win over matches */
+	assert_int_equal(0, list_inner("beta_*:-*_slow", 0, 1, output));
+	assert_int_equal(1, count_all_lines(output));
+	assert_int_equal(1, count_lines(output, "beta_one"));
+
+	/* only exclusions run everything else */
+	assert_int_equal(0, list_inner("-*_one:-gamma_*", 0, 1, output));
+	assert_int_equal(3, count_all_lines(output));
+	assert_int_equal(1, count_lines(output, "alpha_two"));
+	assert_int_equal(1, count_lines(output, "beta_slow"));
+	assert_int_equal(1, count_lines(output, "delta_two"));
+
+	assert_int_equal(0, list_inner("a?pha_tw?:delta_one", 0, 1, output));
+	assert_int_equal(2, count_all_lines(output));
+	assert_int_equal(1, count_lines(output, "alpha_two"));
+	assert_int_equal(1, count_lines(output, "delta_one"));
+
+	assert_int_equal(0, list_inner("nothing", 0, 1, output));
+	assert_int_equal(0, count_all_lines(output));
+}
+
+static void test_shard(void **state) {
+	const int totals[] = {1, 2, 3, 5, 16};
+	char output[MAX_OUTPUT];
+	int seen[sizeof(inner_names)/sizeof(inner_names[0])];
+	int i, index, lines;
+	size_t j;
+
+	/* the shards of each total split the suite, every test is in exactly one */
+	for (i = 0; i < (int)(sizeof(totals)/sizeof(totals[0])); i++) {
+		memset(seen, 0, sizeof(seen));
+		lines = 0;
+		for (index = 0; index < totals[i]; index++) {
+			assert_int_equal(0, list_inner(NULL, index, totals[i], output));
+			lines += count_all_lines(output);
+			for (j = 0; j < sizeof(inner_names)/sizeof(inner_names[0]); j++)
+				seen[j] += count_lines(output, inner_names[j]);
+		}
+		assert_int_equal(8, lines);
+		for (j = 0; j < sizeof(inner_names)/sizeof(inner_names[0]); j++)
+			assert_int_equal(1, seen[j]);
+	}
+
+	/* a setup group stays in one shard */
+	for (index = 0; index < 3; index++) {
+		list_inner(NULL, index, 3, output);
+		assert_int_equal(count_lines(output, "gamma_one"), count_lines(output, "gamma_two"));
+	}
+
+	/* a shard is taken after the filter */
+	memset(seen, 0, sizeof(seen));
+	for (index = 0; index < 2; index++) {
+		assert_int_equal(0, list_inner("alpha_*:delta_*", index, 2, output));
+		for (j = 0; j < sizeof(inner_names)/sizeof(inner_names[0]); j++)
+			seen[j] += count_lines(output, inner_names[j]);
+	}
+	assert_int_equal(1, seen[0]);
+	assert_int_equal(1, seen[1]);
+	assert_int_equal(0, seen[2]);
+	assert_int_equal(1, seen[7]);
+
+	assert_int_equal(-1, list_inner(NULL, 3, 3, output));
+}
+
+static void parse_configure(void *args) {
+	/* static, the filter keeps pointing into its argument */
+	static char filter[] = "--filter=beta_*";
+	static char shard[] = "--shard=0/1";
+	static char own[] = "-json";
+	static char list[] = "--list";
+	static char name[] = "cmocka_runner_test";
+	char *argv[] = {name, filter, shard, own, list};
+
+	if (cmocka_parse_args(5, argv) != 0)
+		_exit(3);
+}
+
+static void test_parse_args(void **state) {
+	char output[MAX_OUTPUT];
+
+	/* the program's own -json argument is ignored */
+	assert_int_equal(0, run_inner(inner_tests, sizeof(inner_tests)/sizeof(inner_tests[0]),
+		parse_configure, NULL, output));
+	assert_int_equal(2, count_all_lines(output));
+	assert_int_equal(1, count_lines(output, "beta_one"));
+	assert_int_equal(1, count_lines(output, "beta_slow"));
+}
+
+struct report_args {
+	char junit[32];
+	char json[32];
+};
+
+static void report_configure(void *args) {
+	struct report_args *report = (struct report_args *)args;
+
+	cmocka_set_junit_report(report->junit);
+	cmocka_set_json_report(report->json);
+}
+
+/* reads a report into output and removes it */
+static void read_report(const char *path, char *output) {
+	FILE *f = fopen(path, "r");
+	size_t size;
+
+	assert_non_null(f);
+	size = fread(output, 1, MAX_OUTPUT-1, f);
+	output[size] = '\0';
+	fclose(f);
+	unlink(path);
+}
+
+static void test_reports(void **state) {
+	struct report_args args = {"/tmp/cmocka_junitXXXXXX", "/tmp/cmocka_jsonXXXXXX"};
+	char output[MAX_OUTPUT];
+	char report[MAX_OUTPUT];
+	char expected[256];
+	int fd;
+
+	fd = mkstemp(args.junit);
+	assert_true(fd >= 0);
+	close(fd);
+	fd = mkstemp(args.json);
+	assert_true(fd >= 0);
+	close(fd);
+
+	/* run_tests() returns the number of failed tests */
+	assert_int_equal(1, run_inner(report_tests, sizeof(report_tests)/sizeof(report_tests[0]),
+		report_configure, &args, output));
+
+	read_report(args.junit, report);
+	assert_non_null(strstr(report, "<testsuites tests=\"2\" failures=\"1\""));
+	assert_non_null(strstr(report, "<testcase name=\"passes\""));
+	assert_non_null(strstr(report, "<testcase name=\"fails&lt;&quot;&amp;&gt;\""));
+	sprintf(expected, "<failure message=\"%s:%d\"/>", __FILE__, failing_line);
+	assert_non_null(strstr(report, expected));
+
+	read_report(args.json, report);
+	assert_non_null(strstr(report, "\"tests\": 2,"));
+	assert_non_null(strstr(report, "\"failures\": 1,"));
+	assert_non_null(strstr(report, "{\"name\": \"passes\", \"status\": \"passed\""));
+	sprintf(expected, "{\"name\": \"fails<\\\"&>\", \"status\": \"failed\", "
+		"\"failure\": \"%s\", \"failure_line\": %d,", __FILE__, failing_line);
+	assert_non_null(strstr(report, expected));
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_list),
+		unit_test(test_filter),
+		unit_test(test_shard),
+		unit_test(test_parse_args),
+		unit_test(test_reports)
+	};
+
+	return run_tests(tests);
+}
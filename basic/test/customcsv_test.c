@@ -0,0 +1,170 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <customcsv.h>
+
+static void verify_record(struct csv_field *fields, int num, int n, ...) {
+	int i;
+	const char *str;
+	va_list a_list;
+
+	va_start(a_list, n);
+
+	assert_int_equal(n, num);
+	for (i = 0; i < n; i++) {
+		str = va_arg(a_list, const char *);
+		assert_string_equal(str, fields[i].ptr);
+		assert_int_equal(strlen(str), fields[i].len);
+	}
+	va_end(a_list);
+}
+
+static void test_next_record(void **state) {
+	char test_data[] = "aa,bb,cc\r\n\"d,d\",\"e\"\"e\",\n\"f\nf\"\r\n,\n\"gg\"x,\"hh";
+	struct csv_parser parser;
+	struct csv_field *fields;
+	int num = 0;
+	FILE *f = NULL;
+
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, csv_init(&parser, f, CSV_DELIM, CSV_QUOTE));
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 3, "aa", "bb", "cc");
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 3, "d,d", "e\"e", "");
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 1, "f\nf");
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 2, "", "");
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 2, "ggx", "hh");
+	assert_int_equal(5, csv_record_number(&parser));
+
+	assert_int_equal(CIO_EOF, csv_next_record(&parser, &fields, &num));
+	assert_int_equal(5, csv_record_number(&parser));
+	csv_destroy(&parser);
+	fclose(f);
+}
+
+static void test_tsv(void **state) {
+	char test_data[] = "a\"a\tb,b\n\t\n";
+	struct csv_parser parser;
+	struct csv_field *fields;
+	int num = 0;
+	FILE *f = NULL;
+
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, csv_init(&parser, f, TSV_DELIM, CSV_NO_QUOTE));
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 2, "a\"a", "b,b");
+
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	verify_record(fields, num, 2, "", "");
+
+	assert_int_equal(CIO_EOF, csv_next_record(&parser, &fields, &num));
+	csv_destroy(&parser);
+	fclose(f);
+}
+
+static void test_long_fields(void **state) {
+	static char test_data[300000];
+	struct csv_parser parser;
+	struct csv_field *fields;
+	int num = 0, i;
+	FILE *f = NULL;
+
+	/* a quoted field spanning several blocks, with escaped quotes on the way */
+	test_data[0] = '"';
+	for (i = 1; i < 200000; i++)
+		test_data[i] = 'a';
+	test_data[70000] = '"';
+	test_data[70001] = '"';
+	test_data[200000] = '"';
+	test_data[200001] = ',';
+	for (i = 200002; i < 299999; i++)
+		test_data[i] = 'b';
+	test_data[299999] = '\n';
+
+	f = fmemopen(test_data, sizeof(test_data), "rb");
+	assert_int_equal(0, csv_init(&parser, f, CSV_DELIM, CSV_QUOTE));
+	assert_int_equal(0, csv_next_record(&parser, &fields, &num));
+	assert_int_equal(2, num);
+	assert_int_equal(199998, fields[0].len);
+	assert_int_equal('"', fields[0].ptr[69999]);
+	assert_int_equal('a', fields[0].ptr[70000]);
+	assert_int_equal(99997, fields[1].len);
+	assert_int_equal(99997, strlen(fields[1].ptr));
+	assert_int_equal(CIO_EOF, csv_next_record(&parser, &fields, &num));
+	csv_destroy(&parser);
+	fclose(f);
+}
+
+static void test_next_batch(void **state) {
+	char test_data[] = "1,a\n2,\"b\"\"\"\n3,c\n4";
+	struct csv_parser parser;
+	struct csv_batch batch;
+	FILE *f = NULL;
+
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, csv_init(&parser, f, CSV_DELIM, CSV_QUOTE));
+
+	assert_int_equal(0, csv_next_batch(&parser, &batch, 3));
+	assert_int_equal(3, batch.num_records);
+	assert_int_equal(6, batch.num_fields);
+	assert_int_equal(0, batch.records[0]);
+	assert_int_equal(2, batch.records[1]);
+	assert_int_equal(4, batch.records[2]);
+	assert_int_equal(6, batch.records[3]);
+	assert_string_equal("1", batch.data+batch.offsets[0]);
+	assert_string_equal("a", batch.data+batch.offsets[1]);
+	assert_string_equal("b\"", batch.data+batch.offsets[3]);
+	assert_int_equal(2, batch.lengths[3]);
+	assert_string_equal("c", batch.data+batch.offsets[5]);
+
+	assert_int_equal(0, csv_next_batch(&parser, &batch, 3));
+	assert_int_equal(1, batch.num_records);
+	assert_int_equal(1, batch.num_fields);
+	assert_string_equal("4", batch.data+batch.offsets[0]);
+	assert_int_equal(4, csv_record_number(&parser));
+
+	assert_int_equal(CIO_EOF, csv_next_batch(&parser, &batch, 3));
+	csv_destroy(&parser);
+	fclose(f);
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_next_record),
+		unit_test(test_tsv),
+		unit_test(test_long_fields),
+		unit_test(test_next_batch)
+	};
+
+	return run_tests(tests);
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2008 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <customio_parallel.h>
+
+/* per-chunk result of sum_func */
+struct test_result {
+	long sum;
+	long count;
+	long first;
+	/* records that weren't whole */
+	long broken;
+};
+
+struct test_totals {
+	long sum;
+	long count;
+	long last;
+	long broken;
+	int chunks;
+	int ordered;
+};
+
+/*
+ * args is an array of results, one for each chunk. The checks are left to the test
+ * body, since a failed assertion can't jump out of a worker thread.
+ */
+static void *sum_func(struct cio_chunk *chunk, void *args) {
+	struct test_result *result = &((struct test_result *)args)[chunk->index];
+	const char *rec;
+	size_t num;
+
+	result->sum = 0;
+	result->count = 0;
+	result->first = -1;
+	result->broken = 0;
+	while (cio_chunk_next(chunk, &rec, &num) == 0) {
+		if (num == 0 || rec[0] != 'n') {
+			result->broken++;
+			continue;
+		}
+		if (result->first == -1)
+			result->first = strtol(rec+1, NULL, 10);
+		result->sum += strtol(rec+1, NULL, 10);
+		result->count++;
+	}
+	return result;
+}
+
+static void total_func(struct cio_chunk *chunk, void *ret, void *args) {
+	struct test_totals *totals = (struct test_totals *)args;
+	struct test_result *result = (struct test_result *)ret;
+
+	if (chunk->index != totals->chunks)
+		totals->ordered = 0;
+	if (result->count > 0) {
+		if (result->first <= totals->last)
+			totals->ordered = 0;
+		totals->last = result->first;
+	}
+	totals->sum += result->sum;
+	totals->count += result->count;
+	totals->broken += result->broken;
+	totals->chunks++;
+}
+
+/* results for num_chunks chunks, 0 for the number of online CPUs as the library does */
+static struct test_result *alloc_results(int num_chunks) {
+	struct test_result *results;
+
+	if (num_chunks <= 0)
+		num_chunks = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_chunks <= 0)
+		num_chunks = 1;
+	results = (struct test_result *)calloc(num_chunks, sizeof(struct test_result));
+	assert_non_null(results);
+	return results;
+}
+
+static void test_parallel_buffer(void **state) {
+	char test_data[] = "n1\nn22\nn333\nn4444\nn55555\nn666666";
+	struct test_result results[20];
+	struct test_totals totals = {0, 0, -1, 0, 0, 1};
+
+	assert_int_equal(0, cio_parallel_buffer(test_data, strlen(test_data), 4, '\n',
+		sum_func, results, total_func, &totals));
+	assert_int_equal(1+22+333+4444+55555+666666, totals.sum);
+	assert_int_equal(6, totals.count);
+	/* every record must be whole */
+	assert_int_equal(0, totals.broken);
+	assert_int_equal(4, totals.chunks);
+	assert_int_equal(1, totals.ordered);
+
+	/* more chunks than records, some chunks end up empty */
+	memset(&totals, 0, sizeof(totals));
+	totals.last = -1;
+	totals.ordered = 1;
+	assert_int_equal(0, cio_parallel_buffer(test_data, strlen(test_data), 20, '\n',
+		sum_func, results, total_func, &totals));
+	assert_int_equal(1+22+333+4444+55555+666666, totals.sum);
+	assert_int_equal(6, totals.count);
+	assert_int_equal(0, totals.broken);
+	assert_int_equal(20, totals.chunks);
+	assert_int_equal(1, totals.ordered);
+
+	memset(&totals, 0, sizeof(totals));
+	totals.ordered = 1;
+	assert_int_equal(0, cio_parallel_buffer("", 0, 8, '\n', sum_func, results, total_func, &totals));
+	assert_int_equal(0, totals.count);
+	assert_int_equal(1, totals.chunks);
+}
+
+static void test_parallel_file(void **state) {
+	char path[] = "/tmp/customio_parallel_testXXXXXX";
+	struct test_totals totals = {0, 0, -1, 0, 0, 1};
+	struct test_result *results;
+	long sum = 0;
+	FILE *f = NULL;
+	int fd, i;
+
+	fd = mkstemp(path);
+	assert_true(fd >= 0);
+	f = fdopen(fd, "w");
+	for (i = 0; i < 100000; i++) {
+		fprintf(f, "n%d\n", i);
+		sum += i;
+	}
+	fclose(f);
+
+	results = alloc_results(16);
+	assert_int_equal(0, cio_parallel_file(path, 16, '\n', sum_func, results, total_func, &totals));
+	free(results);
+	assert_int_equal(sum, totals.sum);
+	assert_int_equal(100000, totals.count);
+	assert_int_equal(0, totals.broken);
+	assert_int_equal(16, totals.chunks);
+	assert_int_equal(1, totals.ordered);
+
+	memset(&totals, 0, sizeof(totals));
+	totals.last = -1;
+	totals.ordered = 1;
+	results = alloc_results(0);
+	assert_int_equal(0, cio_parallel_file(path, 0, '\n', sum_func, results, total_func, &totals));
+	free(results);
+	assert_int_equal(sum, totals.sum);
+	assert_int_equal(0, totals.broken);
+	assert_int_equal(1, totals.ordered);
+	unlink(path);
+
+	assert_int_equal(CIO_READ_ERROR, cio_parallel_file(path, 4, '\n', sum_func, NULL, NULL, NULL));
+}
+
+/* main function */
+int main(void) {
+	const UnitTest tests[] = {
+		unit_test(test_parallel_buffer),
+		unit_test(test_parallel_file)
+	};
+
+	return run_tests(tests);
+}
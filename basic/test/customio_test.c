@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <customio.h>
 
 static void test_is_ws(void **state) {
@@ -348,6 +349,324 @@ static void test_trim(void **state) {
 	assert_string_equal("", str4);
 }
 
+static void test_getline(void **state) {
+	char test_data1[] = "aa bb\r\n\ncc\r\ndd";
+	char test_data2[1024];
+	struct cio_reader reader;
+	char *line = NULL;
+	char *buf = NULL;
+	int num = 0, i;
+	FILE *f = NULL;
+
+	f = fmemopen(test_data1, strlen(test_data1), "rb");
+	assert_int_equal(0, cio_reader_init(&reader, f, 4));
+	assert_int_equal(0, cio_line_number(&reader));
+
+	assert_int_equal(0, cio_getline(&reader, &line, &num, 1));
+	assert_string_equal("aa bb", line);
+	assert_int_equal(5, num);
+	assert_int_equal(1, cio_line_number(&reader));
+
+	assert_int_equal(0, cio_getline(&reader, &line, &num, 1));
+	assert_string_equal("", line);
+	assert_int_equal(0, num);
+
+	assert_int_equal(0, cio_getline(&reader, &line, &num, 0));
+	assert_string_equal("cc\r", line);
+	assert_int_equal(3, num);
+
+	assert_int_equal(0, cio_getline(&reader, &line, &num, 1));
+	assert_string_equal("dd", line);
+	assert_int_equal(2, num);
+	assert_int_equal(4, cio_line_number(&reader));
+
+	assert_int_equal(CIO_EOF, cio_getline(&reader, &line, &num, 1));
+	assert_int_equal(CIO_EOF, cio_getline(&reader, &line, &num, 1));
+	assert_int_equal(4, cio_line_number(&reader));
+	cio_reader_destroy(&reader);
+	fclose(f);
+
+	for (i = 0; i < 1023; i++)
+		test_data2[i] = 'a';
+	test_data2[300] = '\n';
+	test_data2[1022] = '\n';
+	test_data2[1023] = '\0';
+
+	f = fmemopen(test_data2, strlen(test_data2), "rb");
+	assert_int_equal(0, cio_reader_init(&reader, f, 0));
+	assert_int_equal(0, cio_getline_copy(&reader, &buf, 0, &num, 1));
+	assert_int_equal(300, num);
+	assert_int_equal(300, strlen(buf));
+
+	assert_int_equal(0, cio_getline_copy(&reader, &buf, num+1, &num, 1));
+	assert_int_equal(721, num);
+	assert_int_equal(721, strlen(buf));
+	assert_int_equal(CIO_EOF, cio_getline_copy(&reader, &buf, num+1, &num, 1));
+	assert_int_equal(721, num);
+	assert_int_equal(2, cio_line_number(&reader));
+	free(buf);
+	buf = NULL;
+	cio_reader_destroy(&reader);
+	fclose(f);
+
+	f = fmemopen(test_data2, strlen(test_data2), "wb");
+	assert_int_equal(0, cio_reader_init(&reader, f, 0));
+	assert_int_equal(CIO_READ_ERROR, cio_getline(&reader, &line, &num, 1));
+	cio_reader_destroy(&reader);
+	fclose(f);
+}
+
+static void test_get_int64(void **state) {
+	char test_data[] = "  42 -17\n+5x 9223372036854775807 -9223372036854775808 "
+		"9223372036854775808 18446744073709551615 18446744073709551616 - abc";
+	struct cio_reader reader;
+	int64_t val = 0;
+	uint64_t uval = 0;
+	FILE *f = NULL;
+
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, cio_reader_init(&reader, f, 4));
+
+	assert_int_equal(0, cio_get_int64(&reader, &val));
+	assert_int_equal(42, val);
+	assert_int_equal(0, cio_get_int64(&reader, &val));
+	assert_int_equal(-17, val);
+	assert_int_equal(0, cio_get_int64(&reader, &val));
+	assert_int_equal(5, val);
+
+	/* the character after a number is left unread */
+	assert_int_equal(CIO_FORMAT_ERROR, cio_get_int64(&reader, &val));
+	assert_int_equal('x', reader.buf[reader.start]);
+	reader.start++;
+
+	assert_int_equal(0, cio_get_int64(&reader, &val));
+	assert_true(val == INT64_MAX);
+	assert_int_equal(0, cio_get_int64(&reader, &val));
+	assert_true(val == INT64_MIN);
+	assert_int_equal(CIO_RANGE_ERROR, cio_get_int64(&reader, &val));
+	assert_int_equal(0, cio_get_uint64(&reader, &uval));
+	assert_true(uval == UINT64_MAX);
+	assert_int_equal(CIO_RANGE_ERROR, cio_get_uint64(&reader, &uval));
+	assert_true(uval == UINT64_MAX);
+
+	assert_int_equal(CIO_FORMAT_ERROR, cio_get_uint64(&reader, &uval));
+	assert_int_equal(CIO_FORMAT_ERROR, cio_get_int64(&reader, &val));
+	reader.start++;
+	assert_int_equal(CIO_FORMAT_ERROR, cio_get_int64(&reader, &val));
+	reader.start += 3;
+	assert_int_equal(CIO_EOF, cio_get_int64(&reader, &val));
+	cio_reader_destroy(&reader);
+	fclose(f);
+}
+
+static void test_get_double(void **state) {
+	const char *values[] = {
+		"0", "-0.0", "1", "3.25", "0.1", "-2.5e-3", "1e22", "1e23", "123.456E+2",
+		"9007199254740993", "2.2250738585072014e-308", "4.9e-324", "0.000001234",
+		"123456789012345678901234567890", "1.7976931348623157e308", ".5", "7.",
+		"inf", "-Infinity"
+	};
+	char test_data[1024] = "";
+	struct cio_reader reader;
+	double val = 0;
+	unsigned int i;
+	FILE *f = NULL;
+
+	for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+		strcat(test_data, values[i]);
+		strcat(test_data, i%2 ? "\n" : ",");
+	}
+	strcat(test_data, "1e400 2e 1.5.5 -x");
+
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, cio_reader_init(&reader, f, 16));
+
+	/* results must match strtod bit for bit */
+	for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+		assert_int_equal(0, cio_get_double(&reader, &val));
+		assert_memory_equal(&(double){strtod(values[i], NULL)}, &val, sizeof(double));
+		if (i%2 == 0)
+			reader.start++;
+	}
+
+	assert_int_equal(CIO_RANGE_ERROR, cio_get_double(&reader, &val));
+
+	/* an exponent without digits is not part of the number */
+	assert_int_equal(0, cio_get_double(&reader, &val));
+	assert_true(val == 2.0);
+	assert_int_equal('e', reader.buf[reader.start]);
+	reader.start++;
+
+	assert_int_equal(0, cio_get_double(&reader, &val));
+	assert_true(val == 1.5);
+	assert_int_equal(0, cio_get_double(&reader, &val));
+	assert_true(val == 0.5);
+
+	assert_int_equal(CIO_FORMAT_ERROR, cio_get_double(&reader, &val));
+	cio_reader_destroy(&reader);
+	fclose(f);
+}
+
+static void verify_written(FILE *f, struct cio_writer *writer, const char *expected) {
+	char buf[1024];
+	int n;
+
+	assert_int_equal(0, cio_writer_flush(writer));
+	rewind(f);
+	n = fread(buf, 1, sizeof(buf)-1, f);
+	buf[n] = '\0';
+	assert_string_equal(expected, buf);
+	assert_int_equal(0, ftruncate(fileno(f), 0));
+	lseek(fileno(f), 0, SEEK_SET);
+}
+
+static void test_put(void **state) {
+	char test_data[300];
+	struct cio_writer writer;
+	FILE *f = NULL;
+	int i;
+
+	f = tmpfile();
+	assert_int_equal(0, cio_writer_init(&writer, fileno(f), 8));
+
+	assert_int_equal(0, cio_put_str(&writer, "abc"));
+	assert_int_equal(0, cio_put_char(&writer, ','));
+	assert_int_equal(0, cio_put(&writer, "defgh", 5));
+	assert_int_equal(0, cio_put_char(&writer, '\n'));
+	verify_written(f, &writer, "abc,defgh\n");
+
+	/* data larger than the buffer is written directly */
+	for (i = 0; i < 299; i++)
+		test_data[i] = 'a'+i%26;
+	test_data[299] = '\0';
+	assert_int_equal(0, cio_put_str(&writer, "x"));
+	assert_int_equal(0, cio_put_str(&writer, test_data));
+	assert_int_equal(0, writer.len);
+	assert_int_equal(0, cio_put_str(&writer, "y"));
+	assert_int_equal(1, writer.len);
+	rewind(f);
+	assert_int_equal('x', fgetc(f));
+	assert_int_equal(0, cio_writer_destroy(&writer));
+	assert_int_equal(301, lseek(fileno(f), 0, SEEK_END));
+	fclose(f);
+
+	assert_int_equal(0, cio_writer_init(&writer, -1, 0));
+	assert_int_equal(0, cio_put_str(&writer, "z"));
+	assert_int_equal(CIO_WRITE_ERROR, cio_writer_destroy(&writer));
+}
+
+static void test_put_numbers(void **state) {
+	const double values[] = {
+		0.1, 3.25, 1e22, 1e23, 123.456, 2.2250738585072014e-308, 4.9e-324, 1.0/3,
+		1.7976931348623157e308, 9007199254740993.0, 0.000001234, -2.5e-3
+	};
+	struct cio_writer writer;
+	struct cio_reader reader;
+	double val;
+	unsigned int i;
+	FILE *f = NULL;
+
+	f = tmpfile();
+	assert_int_equal(0, cio_writer_init(&writer, fileno(f), 16));
+
+	cio_put_int64(&writer, 0);
+	cio_put_char(&writer, ' ');
+	cio_put_int64(&writer, -12345);
+	cio_put_char(&writer, ' ');
+	cio_put_int64(&writer, INT64_MIN);
+	cio_put_char(&writer, ' ');
+	cio_put_uint64(&writer, UINT64_MAX);
+	cio_put_char(&writer, ' ');
+	cio_put_uint64(&writer, 7);
+	verify_written(f, &writer, "0 -12345 -9223372036854775808 18446744073709551615 7");
+
+	cio_put_double(&writer, 0.0);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, -0.0);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, 3.25);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, -0.01);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, 0.1);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, 1e15);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, 1.0/0.0);
+	cio_put_char(&writer, ' ');
+	cio_put_double(&writer, -1.0/0.0);
+	verify_written(f, &writer, "0 -0 3.25 -0.01 0.1 1000000000000000 inf -inf");
+
+	/* every value must read back exactly */
+	for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+		cio_put_double(&writer, values[i]);
+		cio_put_char(&writer, '\n');
+	}
+	cio_writer_flush(&writer);
+	rewind(f);
+	assert_int_equal(0, cio_reader_init(&reader, f, 0));
+	for (i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+		assert_int_equal(0, cio_get_double(&reader, &val));
+		assert_memory_equal(&values[i], &val, sizeof(double));
+	}
+	cio_reader_destroy(&reader);
+	cio_writer_destroy(&writer);
+	fclose(f);
+}
+
+static void test_put_field(void **state) {
+	struct cio_writer writer;
+	FILE *f = NULL;
+
+	f = tmpfile();
+	assert_int_equal(0, cio_writer_init(&writer, fileno(f), 4));
+
+	cio_put_field(&writer, "plain", 5, ',', '"');
+	cio_put_char(&writer, ',');
+	cio_put_field(&writer, "a,b", 3, ',', '"');
+	cio_put_char(&writer, ',');
+	cio_put_field(&writer, "say \"hi\"", 8, ',', '"');
+	cio_put_char(&writer, ',');
+	cio_put_field(&writer, "two\nlines", 9, ',', '"');
+	cio_put_char(&writer, ',');
+	cio_put_field(&writer, "", 0, ',', '"');
+	cio_put_char(&writer, '\t');
+	cio_put_field(&writer, "a,\"b", 4, '\t', '\0');
+	verify_written(f, &writer, "plain,\"a,b\",\"say \"\"hi\"\"\",\"two\nlines\",\ta,\"b");
+
+	cio_writer_destroy(&writer);
+	fclose(f);
+}
+
+static void test_arena(void **state) {
+	char test_data[] = "first line\nsecond, longer line\n";
+	struct ba_arena arena;
+	struct cio_reader reader;
+	struct cio_writer writer;
+	char *line = NULL;
+	FILE *f = NULL;
+
+	ba_init(&arena, 0, 0);
+	f = fmemopen(test_data, strlen(test_data), "rb");
+	assert_int_equal(0, cio_reader_init_arena(&reader, f, 4, &arena));
+	assert_int_equal(0, cio_getline(&reader, &line, NULL, 1));
+	assert_string_equal("first line", line);
+	assert_int_equal(0, cio_getline(&reader, &line, NULL, 1));
+	assert_string_equal("second, longer line", line);
+	assert_true(reader.buf >= (char *)(arena.chunk+1) && reader.buf < arena.chunk->end);
+	cio_reader_destroy(&reader);
+	fclose(f);
+
+	f = tmpfile();
+	assert_int_equal(0, cio_writer_init_arena(&writer, fileno(f), 0, &arena));
+	assert_true(writer.buf >= (char *)(arena.chunk+1) && writer.buf < arena.chunk->end);
+	cio_put_str(&writer, "abc");
+	verify_written(f, &writer, "abc");
+	cio_writer_destroy(&writer);
+	fclose(f);
+	ba_destroy(&arena);
+}
+
 int main(void) {
 	const UnitTest tests[] = {
 		unit_test(test_is_ws),
@@ -358,7 +677,14 @@ int main(void) {
 		unit_test(test_eat_ws),
 		unit_test(test_trim_before),
 		unit_test(test_trim_after),
-		unit_test(test_trim)
+		unit_test(test_trim),
+		unit_test(test_getline),
+		unit_test(test_get_int64),
+		unit_test(test_get_double),
+		unit_test(test_put),
+		unit_test(test_put_numbers),
+		unit_test(test_put_field),
+		unit_test(test_arena)
 	};
 
 	return run_tests(tests);
@@ -1375,6 +1375,405 @@ int run_tests(const UnitTest tests[]);
 #define run_tests(tests) _run_tests(tests, sizeof(tests) / sizeof(tests)[0])
 #endif
 
+/**
+ * @brief Set the number of processes run_tests() runs the tests in.
+ *
+ * With more than one job every test, or every group from a setup function to
+ * its teardown function, runs in a forked process, with up to jobs of them
+ * at a time. The stdout and stderr of each process are captured through one
+ * pipe and printed to stdout in the order of the tests, so on a terminal the
+ * output looks the same as in a serial run. A test that crashes its process
+ * only fails the tests of its group.
+ *
+ * Without a call to this function the number of jobs is taken from the
+ * CMOCKA_JOBS environment variable, and is 1 if it isn't set. Parallel runs
+ * are not supported on Windows, where the tests always run serially.
+ *
+ * @param[in]  jobs     The number of jobs, 0 for the number of online CPUs.
+ *
+ * @see cmocka_parse_args
+ */
+void cmocka_set_jobs(const int jobs);
+
+/**
+ * @brief Set the cmocka options given on the command line of a test.
+ *
+ * The number of jobs is read from "-j N", "-jN", "--jobs N" or "--jobs=N",
+ * the reports from "--junit=FILE" and "--json=FILE", the number of slowest
+ * tests to list from "--slowest=N", the tests to run from "--filter=PATTERN"
+ * and "--shard=INDEX/TOTAL", the checks of test_malloc() from
+ * "--malloc-check=full|count|off", and "--list" lists the tests instead of
+ * running them. The name of the program is the name of the test suite in
+ * the reports. Other arguments are ignored, so the test may have options of
+ * their own.
+ *
+ * @code
+ * int main(int argc, char *argv[]) {
+ *     const UnitTest tests[] = {
+ *         unit_test(test),
+ *     };
+ *
+ *     if (cmocka_parse_args(argc, argv) != 0) {
+ *         return 1;
+ *     }
+ *     return run_tests(tests);
+ * }
+ * @endcode
+ *
+ * @param[in]  argc     The number of arguments, as passed to main().
+ *
+ * @param[in]  argv     The arguments, as passed to main().
+ *
+ * @return 0 on success, -1 if an option has an invalid value.
+ *
+ * @see cmocka_set_jobs
+ * @see cmocka_set_test_filter
+ * @see cmocka_set_shard
+ * @see cmocka_set_list_tests
+ * @see cmocka_set_malloc_check
+ * @see cmocka_set_junit_report
+ * @see cmocka_set_json_report
+ * @see cmocka_set_slowest_tests
+ */
+int cmocka_parse_args(const int argc, char * const argv[]);
+
+/**
+ * @brief Run only the tests of run_tests() whose names match a filter.
+ *
+ * The filter is a list of glob patterns separated by ':', where '*' matches
+ * any characters and '?' any one character. A test runs if its name matches
+ * one of the patterns and none of the patterns starting with '-', so
+ * "queue_*:-*_slow" runs the queue tests except the slow ones. A filter of
+ * only '-' patterns runs all the other tests. Setup and teardown functions
+ * run if one of the tests between them does.
+ *
+ * Without a call to this function the filter is taken from the
+ * CMOCKA_TEST_FILTER environment variable, and all the tests run if it isn't
+ * set.
+ *
+ * @param[in]  filter   The filter, NULL to run all the tests.
+ */
+void cmocka_set_test_filter(const char * const filter);
+
+/**
+ * @brief Run only one shard of the tests of run_tests().
+ *
+ * The tests are split into total shards by a hash of their names, so a test
+ * stays in the same shard when other tests are added or removed, and running
+ * every index from 0 to total - 1 runs every test once. The tests from a
+ * setup function to its teardown function are in the shard of the first
+ * test.
+ *
+ * Without a call to this function the shard is taken from the
+ * CMOCKA_SHARD_INDEX and CMOCKA_SHARD_TOTAL environment variables, and all
+ * the tests run if they aren't set. run_tests() fails if index isn't below
+ * total.
+ *
+ * @param[in]  index    The shard to run, from 0.
+ *
+ * @param[in]  total    The number of shards.
+ */
+void cmocka_set_shard(const int index, const int total);
+
+/**
+ * @brief Make run_tests() print the names of the tests instead of running
+ * them.
+ *
+ * The names of the tests selected by the filter and the shard are printed
+ * one per line, without the setup and teardown functions. Without a call to
+ * this function the tests are listed if the CMOCKA_LIST_TESTS environment
+ * variable is set to a nonzero number.
+ *
+ * @param[in]  list     Nonzero to list the tests, 0 to run them.
+ */
+void cmocka_set_list_tests(const int list);
+
+/**
+ * @brief Write a JUnit XML report of the tests run by run_tests().
+ *
+ * The report has a testcase with the wall time of each test, and the place
+ * the test failed if it called fail() or an assertion failed. Without a call
+ * to this function the path is taken from the CMOCKA_JUNIT_REPORT
+ * environment variable.
+ *
+ * @param[in]  path     The file to write, NULL for no report.
+ */
+void cmocka_set_junit_report(const char * const path);
+
+/**
+ * @brief Write a JSON report of the tests run by run_tests().
+ *
+ * For each test the report has its status, the wall and CPU time, the peak
+ * number of bytes in use from test_malloc() and the number of blocks it
+ * allocated. Without a call to this function the path is taken from the
+ * CMOCKA_JSON_REPORT environment variable.
+ *
+ * @param[in]  path     The file to write, NULL for no report.
+ */
+void cmocka_set_json_report(const char * const path);
+
+/**
+ * @brief List the slowest tests after the results of run_tests().
+ *
+ * Without a call to this function the number is taken from the
+ * CMOCKA_SLOWEST_TESTS environment variable, and no tests are listed if it
+ * isn't set.
+ *
+ * @param[in]  count    The number of tests to list, 0 for none.
+ */
+void cmocka_set_slowest_tests(const int count);
+
+/** @} */
+
+/**
+ * @defgroup cmocka_benchmark Benchmarks
+ * @ingroup cmocka
+ *
+ * A benchmark measures how long an operation takes, from within a test.
+ *
+ * The benchmark function gets the number of times to run the operation, so
+ * the cost of calling it is spread over many operations. The number of
+ * iterations is calibrated so that each sample takes about 10ms. After a few
+ * warmup samples, 30 samples are timed with a monotonic clock. The median,
+ * minimum and 99th percentile time per operation are reported, and on x86 the
+ * time stamp counter ticks per operation as well. A fixture set up with
+ * unit_test_setup_teardown() is passed to the benchmark function as its
+ * state, so the tests run through run_tests() as usual.
+ *
+ * The measurement is tuned with environment variables:
+ *
+ * - CMOCKA_BENCHMARK_SAMPLES: the number of samples, up to 1000.
+ * - CMOCKA_BENCHMARK_SAMPLE_TIME: the time of a sample in milliseconds.
+ * - CMOCKA_BENCHMARK_SAVE: a file the median of each benchmark is appended
+ *   to, as a "test/function ns_per_op" line, so a benchmark function measured
+ *   by several tests gets a line for each of them.
+ * - CMOCKA_BENCHMARK_BASELINE: a file in the same format, usually one saved
+ *   by an earlier run. A benchmark fails if its median is slower than its
+ *   baseline by more than CMOCKA_BENCHMARK_TOLERANCE percent (10 by
+ *   default). The last line of a benchmark counts.
+ *
+ * Benchmarks compete for the CPUs when tests run in parallel, so they should
+ * be run with a single job.
+ *
+ * @{
+ */
+
+#ifdef DOXYGEN
+/**
+ * @brief Measure the time per operation of a benchmark function.
+ *
+ * @param[in]  function The benchmark function to measure.
+ *
+ * @param[in]  state    The state passed to the benchmark function.
+ *
+ * @return The median time per operation in nanoseconds.
+ *
+ * @code
+ * static void lookup(void **state, size_t iterations) {
+ *     const char *value = *state;
+ *     size_t i;
+ *
+ *     for (i = 0; i < iterations; i++) {
+ *         find_item_by_value(value);
+ *     }
+ * }
+ *
+ * static void test_lookup(void **state) {
+ *     cmocka_benchmark(lookup, state);
+ * }
+ * @endcode
+ */
+double cmocka_benchmark(BenchmarkFunction function, void **state);
+#else
+#define cmocka_benchmark(function, state) \
+    _run_benchmark(#function, function, state, 0, __FILE__, __LINE__)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Measure a benchmark function and fail if it is too slow.
+ *
+ * The test fails if the median time per operation is over max_ns_per_op, or
+ * over the limit of the baseline if that is lower.
+ *
+ * @param[in]  function The benchmark function to measure.
+ *
+ * @param[in]  state    The state passed to the benchmark function.
+ *
+ * @param[in]  max_ns_per_op The maximum median time per operation in
+ *                      nanoseconds.
+ *
+ * @return The median time per operation in nanoseconds.
+ *
+ * @see cmocka_benchmark
+ */
+double cmocka_benchmark_max(BenchmarkFunction function, void **state,
+                            double max_ns_per_op);
+#else
+#define cmocka_benchmark_max(function, state, max_ns_per_op) \
+    _run_benchmark(#function, function, state, max_ns_per_op, \
+                   __FILE__, __LINE__)
+#endif
+
+/** @} */
+
+/**
+ * @defgroup cmocka_stress Stress Tests
+ * @ingroup cmocka
+ *
+ * A stress test runs a function on several threads at once for a while, to
+ * find the races of a concurrent data structure and measure its throughput.
+ *
+ * Each thread calls the function over and over, with its index and the
+ * number of threads, so the index can pick its part, like a producer or a
+ * consumer. The threads are pinned to different CPUs where that is
+ * supported, and start together. After CMOCKA_STRESS_TIME milliseconds
+ * (100 by default) the threads stop once their current call returns, and the
+ * number of calls per second is reported. The test then checks what the
+ * threads did, such as that every item produced was consumed exactly once.
+ *
+ * An assertion or fail() in a thread stops all the threads, and the test
+ * fails once they are done. The other cmocka functions, such as
+ * will_return() and mock(), must not be called from the threads, but
+ * test_malloc() and test_free() may be.
+ *
+ * @code
+ * static void produce_consume(void **state, int thread,
+ *                             int number_of_threads) {
+ *     struct queue *queue = *state;
+ *
+ *     if (thread % 2 == 0) {
+ *         queue_push(queue, next_item(thread));
+ *     } else {
+ *         check_item(queue_pop(queue));
+ *     }
+ * }
+ *
+ * static void test_queue(void **state) {
+ *     int threads;
+ *
+ *     for (threads = 2; threads <= 8; threads *= 2) {
+ *         cmocka_stress(produce_consume, state, threads);
+ *         check_all_items_consumed(*state);
+ *     }
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+#ifdef DOXYGEN
+/**
+ * @brief Run a function on several threads and report its throughput.
+ *
+ * @param[in]  function The function each thread runs over and over.
+ *
+ * @param[in]  state    The state passed to the function.
+ *
+ * @param[in]  threads  The number of threads, 0 for the number of online
+ *                      CPUs. Without thread support there is always one.
+ *
+ * @return The number of calls of the function per second.
+ */
+double cmocka_stress(StressFunction function, void **state, int threads);
+#else
+#define cmocka_stress(function, state, threads) \
+    _run_stress(#function, function, state, threads, __FILE__, __LINE__)
+#endif
+
+/** @} */
+
+/**
+ * @defgroup cmocka_perf Performance Counters
+ * @ingroup cmocka
+ *
+ * Hardware performance counters measure a region of a test in cycles,
+ * instructions, cache misses and branch misses, which are much less noisy
+ * than its time, so a hot path can be checked for regressions with a tight
+ * limit.
+ *
+ * The counters count the calling thread in user space only, with
+ * perf_event_open() on Linux. They aren't available on other systems, and
+ * often not in containers or virtual machines, or when the
+ * kernel.perf_event_paranoid sysctl forbids them. Then the report shows
+ * "n/a" for them and the assertions on them pass, so the same test runs
+ * everywhere and checks what it can.
+ *
+ * @code
+ * static void test_sort(void **state) {
+ *     sort_items(items, NUMBER_OF_ITEMS);
+ *
+ *     perf_counters_begin();
+ *     sort_items(items, NUMBER_OF_ITEMS);
+ *     perf_counters_end("sort", NUMBER_OF_ITEMS);
+ *     assert_perf_counter_max(PERF_COUNTER_INSTRUCTIONS, 40);
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+#ifdef DOXYGEN
+/**
+ * @brief Start counting the hardware events of the calling thread.
+ *
+ * Only one region can be counted at a time, and it must be ended by
+ * perf_counters_end() before the test ends.
+ *
+ * @see perf_counters_end
+ */
+void perf_counters_begin(void);
+#else
+#define perf_counters_begin() _perf_counters_begin(__FILE__, __LINE__)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Stop counting and report the counts per operation of the region.
+ *
+ * @param[in]  name     The name of the region in the report.
+ *
+ * @param[in]  operations The number of operations the region did, the counts
+ *                      are divided by it.
+ *
+ * @see perf_counter_per_op
+ * @see assert_perf_counter_max
+ */
+void perf_counters_end(const char *name, size_t operations);
+#else
+#define perf_counters_end(name, operations) \
+    _perf_counters_end(name, operations, __FILE__, __LINE__)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Get a count per operation of the last region that ended.
+ *
+ * @param[in]  counter  The counter to get.
+ *
+ * @return The count per operation, or a negative number if the counter
+ *         isn't available.
+ */
+double perf_counter_per_op(const PerfCounter counter);
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Assert that a count per operation of the last region that ended
+ * is at most max_per_op.
+ *
+ * The assertion passes with a note if the counter isn't available.
+ *
+ * @param[in]  counter  The counter to check.
+ *
+ * @param[in]  max_per_op The highest count per operation allowed.
+ */
+void assert_perf_counter_max(PerfCounter counter, double max_per_op);
+#else
+#define assert_perf_counter_max(counter, max_per_op) \
+    _assert_perf_counter_max(counter, max_per_op, __FILE__, __LINE__)
+#endif
+
 /** @} */
 
 /**
@@ -1397,9 +1796,33 @@ int run_tests(const UnitTest tests[]);
  * means memory corruption from a single test case could potentially cause the
  * test application to exit prematurely.
  *
+ * The guard blocks and the fill patterns make allocations slow, so tests
+ * that allocate millions of blocks can use lighter checks with
+ * cmocka_set_malloc_check().
+ *
  * @{
  */
 
+#ifdef DOXYGEN
+/**
+ * @brief Set the checks done by test_malloc() and test_free().
+ *
+ * - TEST_MALLOC_CHECK_FULL, the default, checks for leaks, overflows and
+ *   underflows, and fills new and freed blocks with a pattern.
+ * - TEST_MALLOC_CHECK_COUNT only checks for leaks and keeps the numbers
+ *   used by the allocation assertions and the reports.
+ * - TEST_MALLOC_CHECK_OFF doesn't track the blocks, it only counts the
+ *   allocations checked by assert_allocations_begin().
+ *
+ * Each block is freed with the checks it was allocated with. Without a call
+ * to this function the checks are taken from the CMOCKA_MALLOC_CHECK
+ * environment variable, which may be "full", "count" or "off".
+ *
+ * @param[in]  check    The checks to do from now on.
+ */
+void cmocka_set_malloc_check(const TestMallocCheck check);
+#endif
+
 #ifdef DOXYGEN
 /**
  * @brief Test function overriding malloc.
@@ -1460,6 +1883,102 @@ void test_free(void *ptr);
 #define test_free(ptr) _test_free(ptr, __FILE__, __LINE__)
 #endif
 
+#ifdef DOXYGEN
+/**
+ * @brief Begin a region of a test which may allocate at most so much.
+ *
+ * Every block allocated with test_malloc() or test_calloc() until
+ * assert_allocations_end() is counted, and that fails the test if more
+ * blocks or bytes than allowed were allocated. Freeing doesn't give back
+ * any of the budget. Only one region can be open at a time, and it must be
+ * ended within the same test.
+ *
+ * @param[in]  max_count The maximum number of blocks, (size_t)-1 for any.
+ *
+ * @param[in]  max_bytes The maximum number of bytes, (size_t)-1 for any.
+ *
+ * @see assert_no_allocations_begin
+ * @see assert_allocations_end
+ */
+void assert_allocations_begin(size_t max_count, size_t max_bytes);
+#else
+#define assert_allocations_begin(max_count, max_bytes) \
+    _assert_allocations_begin(max_count, max_bytes, __FILE__, __LINE__)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Begin a region of a test which must not allocate at all.
+ *
+ * @code
+ * void test_pop_doesnt_allocate(void **state) {
+ *     struct queue *queue = *state;
+ *
+ *     assert_no_allocations_begin();
+ *     queue_pop(queue);
+ *     assert_no_allocations_end();
+ * }
+ * @endcode
+ *
+ * @see assert_allocations_begin
+ */
+void assert_no_allocations_begin(void);
+#else
+#define assert_no_allocations_begin() assert_allocations_begin(0, 0)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Begin a region of a test which may allocate at most max_count
+ * blocks.
+ *
+ * @param[in]  max_count The maximum number of blocks.
+ *
+ * @see assert_allocations_begin
+ */
+void assert_max_allocations_begin(size_t max_count);
+#else
+#define assert_max_allocations_begin(max_count) \
+    assert_allocations_begin(max_count, (size_t)-1)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief Begin a region of a test which may allocate at most max_bytes bytes.
+ *
+ * @param[in]  max_bytes The maximum number of bytes.
+ *
+ * @see assert_allocations_begin
+ */
+void assert_max_allocated_bytes_begin(size_t max_bytes);
+#else
+#define assert_max_allocated_bytes_begin(max_bytes) \
+    assert_allocations_begin((size_t)-1, max_bytes)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief End the region begun with one of the assert_*allocations*_begin()
+ * macros, and fail the test if it allocated more than allowed.
+ *
+ * @see assert_allocations_begin
+ */
+void assert_allocations_end(void);
+#else
+#define assert_allocations_end() _assert_allocations_end(__FILE__, __LINE__)
+#endif
+
+#ifdef DOXYGEN
+/**
+ * @brief End the region begun with assert_no_allocations_begin().
+ *
+ * @see assert_allocations_end
+ */
+void assert_no_allocations_end(void);
+#else
+#define assert_no_allocations_end() assert_allocations_end()
+#endif
+
 /* Redirect malloc, calloc and free to the unit test allocators. */
 #if UNIT_TESTING
 #define malloc test_malloc
@@ -1570,10 +2089,33 @@ void expect_assert_failure(function fn_call);
 /* Function prototype for setup, test and teardown functions. */
 typedef void (*UnitTestFunction)(void **state);
 
+/* Function measured by a benchmark, it runs its operation iterations times. */
+typedef void (*BenchmarkFunction)(void **state, size_t iterations);
+
+/* Function run over and over by each thread of a stress test. */
+typedef void (*StressFunction)(void **state, int thread,
+                               int number_of_threads);
+
 /* Function that determines whether a function parameter value is correct. */
 typedef int (*CheckParameterValue)(const LargestIntegralType value,
                                    const LargestIntegralType check_value_data);
 
+/* Hardware counters measured by perf_counters_begin(). */
+typedef enum PerfCounter {
+    PERF_COUNTER_CYCLES = 0,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_CACHE_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTERS,
+} PerfCounter;
+
+/* Checks done by test_malloc() and test_free(). */
+typedef enum TestMallocCheck {
+    TEST_MALLOC_CHECK_FULL = 0,
+    TEST_MALLOC_CHECK_COUNT,
+    TEST_MALLOC_CHECK_OFF,
+} TestMallocCheck;
+
 /* Type of the unit test function. */
 typedef enum UnitTestFunctionType {
     UNIT_TEST_FUNCTION_TYPE_TEST = 0,
@@ -1717,6 +2259,10 @@ void* _test_malloc(const size_t size, const char* file, const int line);
 void* _test_calloc(const size_t number_of_elements, const size_t size,
                    const char* file, const int line);
 void _test_free(void* const ptr, const char* file, const int line);
+void _assert_allocations_begin(const size_t max_count, const size_t max_bytes,
+                               const char * const file, const int line);
+void _assert_allocations_end(const char * const file, const int line);
+void cmocka_set_malloc_check(const TestMallocCheck check);
 
 void _fail(const char * const file, const int line);
 int _run_test(
@@ -1724,6 +2270,21 @@ int _run_test(
     void ** const volatile state, const UnitTestFunctionType function_type,
     const void* const heap_check_point);
 int _run_tests(const UnitTest * const tests, const size_t number_of_tests);
+double _run_benchmark(
+    const char * const function_name, const BenchmarkFunction function,
+    void ** const state, const double max_ns_per_op,
+    const char * const file, const int line);
+double _run_stress(
+    const char * const name, const StressFunction function,
+    void ** const state, const int threads,
+    const char * const file, const int line);
+void _perf_counters_begin(const char * const file, const int line);
+void _perf_counters_end(const char * const name, const size_t operations,
+                        const char * const file, const int line);
+double perf_counter_per_op(const PerfCounter counter);
+void _assert_perf_counter_max(const PerfCounter counter,
+                              const double max_per_op,
+                              const char * const file, const int line);
 
 /* Standard output and error print methods. */
 void print_message(const char* const format, ...) PRINTF_ATTRIBUTE(1, 2);
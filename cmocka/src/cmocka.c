@@ -21,12 +21,14 @@
 #include <malloc.h>
 #endif
 
+#include <ctype.h>
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -50,8 +52,26 @@ WINBASEAPI BOOL WINAPI IsDebuggerPresent(VOID);
 #endif
 
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #endif /* _WIN32 */
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define HAVE_PERF_COUNTERS 1
+#endif /* __linux__ */
+
+#if !defined(_WIN32) && defined(__GNUC__)
+#include <pthread.h>
+#include <sched.h>
+#define HAVE_STRESS_THREADS 1
+#endif /* !_WIN32 && __GNUC__ */
+
 #include <cmocka_private.h>
 #include <cmocka.h>
 
@@ -65,6 +85,29 @@ WINBASEAPI BOOL WINAPI IsDebuggerPresent(VOID);
 /* Alignment of allocated blocks.  NOTE: This must be base2. */
 #define MALLOC_ALIGNMENT sizeof(size_t)
 
+/* Size of the chunks of the bookkeeping arena. */
+#define ARENA_CHUNK_SIZE 65536
+/* Alignment of the arena allocations.  NOTE: This must be base2. */
+#define ARENA_ALIGNMENT 16
+
+/* Default number of samples measured by a benchmark. */
+#define BENCHMARK_SAMPLES 30
+/* Maximum number of samples measured by a benchmark. */
+#define BENCHMARK_MAX_SAMPLES 1000
+/* Default time a benchmark sample should take in milliseconds. */
+#define BENCHMARK_SAMPLE_TIME 10.0
+/* Number of samples run before a benchmark is measured. */
+#define BENCHMARK_WARMUP_SAMPLES 3
+/* Default percentage a benchmark may be slower than its baseline. */
+#define BENCHMARK_TOLERANCE 10.0
+
+/* Default time a stress test runs in milliseconds. */
+#define STRESS_TIME 100.0
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BENCHMARK_TICKS 1
+#endif
+
 /* Printf formatting for source code locations. */
 #define SOURCE_LOCATION_FORMAT "%s:%u"
 
@@ -119,8 +162,60 @@ typedef struct MallocBlockInfo {
     size_t size;              /* Request block size. */
     SourceLocation location;  /* Where the block was allocated. */
     ListNode node;            /* Node within list of all allocated blocks. */
+    TestMallocCheck check;    /* Checks done when the block was allocated. */
 } MallocBlockInfo;
 
+/*
+ * Chunk of the arena that holds the bookkeeping of a test, its data follows
+ * the header.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;  /* The chunk filled after this one. */
+    size_t size;              /* Bytes of data in the chunk. */
+    size_t used;              /* Bytes of data allocated so far. */
+} ArenaChunk;
+
+/* Limits checked by assert_allocations_end(). */
+typedef struct AllocationRegion {
+    SourceLocation location;  /* Where the region began, unset if none. */
+    size_t max_count;         /* Number of blocks that may be allocated. */
+    size_t max_bytes;         /* Number of bytes that may be allocated. */
+    size_t count;             /* Blocks allocated before the region. */
+    size_t bytes;             /* Bytes allocated before the region. */
+    SourceLocation exceeded;  /* First allocation over the limits. */
+} AllocationRegion;
+
+/* Hardware counters opened by perf_counters_begin(). */
+typedef struct PerfRegion {
+    SourceLocation location;  /* Where the region began, unset if none. */
+    int fds[PERF_COUNTERS];   /* Counter files, -1 if they couldn't open. */
+} PerfRegion;
+
+#ifdef HAVE_STRESS_THREADS
+/* A thread of cmocka_stress(). */
+typedef struct StressWorker {
+    pthread_t thread;
+    int index;
+    int number_of_threads;
+    StressFunction function;
+    void **state;
+    jmp_buf env;              /* Where a failure in the thread returns to. */
+    int failed;
+    size_t operations;        /* Calls of the function that returned. */
+} StressWorker;
+#endif /* HAVE_STRESS_THREADS */
+
+/* Measurements of a test, for the reports of run_tests(). */
+typedef struct TestResult {
+    size_t test_index;
+    int failed;
+    SourceLocation failure;   /* Where the test failed, if known. */
+    double wall_time;         /* Seconds. */
+    double cpu_time;          /* Seconds of CPU time of the process. */
+    size_t peak_bytes;        /* Most bytes in use from test_malloc(). */
+    size_t allocations;       /* Number of blocks allocated. */
+} TestResult;
+
 /* State of each test. */
 typedef struct TestState {
     const ListNode *check_point; /* Check point of the test if there's a */
@@ -128,9 +223,6 @@ typedef struct TestState {
     void *state;                 /* State associated with the test. */
 } TestState;
 
-/* Determines whether two values are the same. */
-typedef int (*EqualityFunction)(const void *left, const void *right);
-
 /* Value of a symbol and the place it was declared. */
 typedef struct SymbolValue {
     SourceLocation location;
@@ -145,8 +237,27 @@ typedef struct SymbolValue {
 typedef struct SymbolMapValue {
     const char *symbol_name;
     ListNode symbol_values_list_head;
+    /* Hash of symbol_name and the list it's in, see SymbolIndex. */
+    size_t hash;
+    const ListNode *symbol_map_head;
+    /* Node referencing this value in symbol_map_head. */
+    ListNode *node;
+    /* Next value in the same bucket of the index. */
+    struct SymbolMapValue *next;
 } SymbolMapValue;
 
+/*
+ * Hash table of all SymbolMapValues by the symbol map they're in and their
+ * name, so a mock call doesn't have to compare its names with every symbol
+ * of each level.
+ */
+typedef struct SymbolIndex {
+    SymbolMapValue **buckets;
+    /* Power of 2, or 0 while nothing was added. */
+    size_t number_of_buckets;
+    size_t number_of_values;
+} SymbolIndex;
+
 /* Used by list_free() to deallocate values referenced by list nodes. */
 typedef void (*CleanupListValue)(const void *value, void *cleanup_value_data);
 
@@ -172,6 +283,17 @@ typedef struct CheckMemoryData {
     size_t size;
 } CheckMemoryData;
 
+/*
+ * Stands in the parameter map for an event allocated on the heap by the
+ * caller of _expect_check(), which is freed once it has been checked.
+ */
+typedef struct HeapCheckEvent {
+    CheckParameterEvent event;
+    CheckParameterEvent *heap_event;
+    /* Node in global_heap_check_events until the event is freed. */
+    ListNode node;
+} HeapCheckEvent;
+
 static ListNode* list_initialize(ListNode * const node);
 static ListNode* list_add(ListNode * const head, ListNode *new_node);
 static ListNode* list_add_value(ListNode * const head, const void *value,
@@ -183,10 +305,15 @@ static void list_remove_free(
     ListNode * const node, const CleanupListValue cleanup_value,
     void * const cleanup_value_data);
 static int list_empty(const ListNode * const head);
-static int list_find(
-    ListNode * const head, const void *value,
-    const EqualityFunction equal_func, ListNode **output);
 static int list_first(ListNode * const head, ListNode **output);
+static size_t symbol_hash(const ListNode * const symbol_map_head,
+                          const char * const symbol_name);
+static ListNode* find_symbol(const ListNode * const symbol_map_head,
+                             const char * const symbol_name,
+                             const size_t hash);
+static void index_symbol(SymbolMapValue * const map_value);
+static void unindex_symbol(const SymbolMapValue * const map_value);
+static void free_symbol_index(void);
 static ListNode* list_free(
     ListNode * const head, const CleanupListValue cleanup_value,
     void * const cleanup_value_data);
@@ -197,7 +324,6 @@ static void add_symbol_value(
 static int get_symbol_value(
     ListNode * const symbol_map_head, const char * const symbol_names[],
     const size_t number_of_symbol_names, void **output);
-static void free_value(const void *value, void *cleanup_value_data);
 static void free_symbol_map_value(
     const void *value, void *cleanup_value_data);
 static void remove_always_return_values(ListNode * const map_head,
@@ -210,9 +336,20 @@ static int check_for_leftover_values(
  * structures.
  */
 static void initialize_testing(const char *test_name);
+static void close_perf_counters(void);
 
 /* This must be called at the end of a test to free() allocated structures. */
 static void teardown_testing(const char *test_name);
+static void* arena_malloc(const size_t size);
+static void reset_arena(void);
+static void add_check_event(
+    const char* const function, const char* const parameter,
+    const char* const file, const int line,
+    const CheckParameterValue check_function,
+    const LargestIntegralType check_data,
+    CheckParameterEvent * const event, const int count);
+static void free_heap_check_events(void);
+static void free_arena(void);
 
 
 /*
@@ -221,6 +358,8 @@ static void teardown_testing(const char *test_name);
  */
 static jmp_buf global_run_test_env;
 static int global_running_test = 0;
+/* Name of the running test, setup or teardown function. */
+static const char *global_running_test_name = NULL;
 
 /* Keeps track of the calling context returned by setenv() so that */
 /* mock_assert() can optionally jump back to expect_assert_failure(). */
@@ -240,9 +379,88 @@ static ListNode global_function_parameter_map_head;
 /* Location of last parameter value checked was declared. */
 static SourceLocation global_last_parameter_location;
 
+/* Index of the symbols of both of the maps above. */
+static SymbolIndex global_symbol_index;
+
+/* HeapCheckEvents whose event is still to be freed. */
+static ListNode global_heap_check_events;
+
+/*
+ * Arena the nodes and values of the maps above are allocated from, they are
+ * all released at once when a test ends.  The chunks are kept for the next
+ * tests until run_tests() returns.
+ */
+static ArenaChunk *global_arena_chunks = NULL;
+/* The chunk being filled. */
+static ArenaChunk *global_arena = NULL;
+
 /* List of all currently allocated blocks. */
 static ListNode global_allocated_blocks;
 
+/* Number of blocks and bytes allocated with test_malloc() so far. */
+static size_t global_allocation_count = 0;
+static size_t global_allocated_bytes = 0;
+
+/* Region of a test that may only allocate so much. */
+static AllocationRegion global_allocation_region;
+
+/* Checks done by test_malloc() and test_free(), -1 until it is set. */
+static int global_malloc_check = -1;
+
+#ifdef HAVE_STRESS_THREADS
+/* The stress test thread running on this thread, if any. */
+static __thread StressWorker *global_stress_worker = NULL;
+/* Whether the stress test threads should start, and stop. */
+static int global_stress_start = 0;
+static int global_stress_stop = 0;
+/*
+ * Whether stress test threads are running, so the list of allocated blocks
+ * must be locked.
+ */
+static int global_stress_running = 0;
+static pthread_mutex_t global_allocated_blocks_mutex =
+    PTHREAD_MUTEX_INITIALIZER;
+#endif /* HAVE_STRESS_THREADS */
+
+/* Region of a test measured with hardware counters. */
+static PerfRegion global_perf_region;
+/*
+ * Counts per operation of the last region that ended, negative for the
+ * counters that aren't available.
+ */
+static double global_perf_counts[PERF_COUNTERS] = {-1, -1, -1, -1};
+
+/*
+ * Number of bytes allocated with test_malloc() and not freed yet, and the
+ * highest it has been since the current test began.
+ */
+static size_t global_allocated_bytes_in_use = 0;
+static size_t global_peak_bytes_in_use = 0;
+
+/* Where the last failure was signalled with _fail(). */
+static SourceLocation global_last_failure_location;
+
+/* Measurements of the last function run by _run_test(). */
+static TestResult global_last_test_result;
+
+/* Reports written by run_tests(), NULL until they are set. */
+static const char *global_junit_report = NULL;
+static const char *global_json_report = NULL;
+/* Number of slowest tests to list, -1 until it is set. */
+static int global_slowest_tests = -1;
+/* Name of the test program in the reports. */
+static const char *global_suite_name = NULL;
+
+/* Tests to run, NULL and -1 until they are set. */
+static const char *global_test_filter = NULL;
+static int global_shard_index = -1;
+static int global_shard_total = -1;
+/* Whether to list the tests instead of running them, -1 until it is set. */
+static int global_list_tests = -1;
+
+/* Number of processes run_tests() runs tests in, -1 until it is set. */
+static int global_jobs = -1;
+
 #ifndef _WIN32
 /* Signals caught by exception_handler(). */
 static const int exception_signals[] = {
@@ -298,6 +516,12 @@ static const ExceptionCodeInfo exception_codes[] = {
 
 /* Exit the currently executing test. */
 static void exit_test(const int quit_application) {
+#ifdef HAVE_STRESS_THREADS
+    /* A failing stress test thread stops, and the test fails after it. */
+    if (global_stress_worker) {
+        longjmp(global_stress_worker->env, 1);
+    }
+#endif /* HAVE_STRESS_THREADS */
     if (global_running_test) {
         longjmp(global_run_test_env, 1);
     } else if (quit_application) {
@@ -333,11 +557,18 @@ static void set_source_location(
 
 /* Create function results and expected parameter lists. */
 void initialize_testing(const char *test_name) {
+    size_t i;
 	(void)test_name;
     list_initialize(&global_function_result_map_head);
     initialize_source_location(&global_last_mock_value_location);
     list_initialize(&global_function_parameter_map_head);
     initialize_source_location(&global_last_parameter_location);
+    list_initialize(&global_heap_check_events);
+    initialize_source_location(&global_allocation_region.location);
+    close_perf_counters();
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        global_perf_counts[i] = -1;
+    }
 }
 
 
@@ -357,6 +588,22 @@ static void fail_if_leftover_values(const char *test_name) {
             "%s parameter still has values that haven't been checked.\n", 2)) {
         error_occurred = 1;
     }
+    if (source_location_is_set(&global_allocation_region.location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: Allocation check wasn't "
+                    "ended with assert_allocations_end()\n",
+                    global_allocation_region.location.file,
+                    global_allocation_region.location.line);
+        initialize_source_location(&global_allocation_region.location);
+        error_occurred = 1;
+    }
+    if (source_location_is_set(&global_perf_region.location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: Performance counters "
+                    "weren't ended with perf_counters_end()\n",
+                    global_perf_region.location.file,
+                    global_perf_region.location.line);
+        close_perf_counters();
+        error_occurred = 1;
+    }
     if (error_occurred) {
         exit_test(1);
     }
@@ -365,14 +612,80 @@ static void fail_if_leftover_values(const char *test_name) {
 
 static void teardown_testing(const char *test_name) {
 	(void)test_name;
-    list_free(&global_function_result_map_head, free_symbol_map_value,
-              (void*)0);
+    /* The maps are in the arena, so they are dropped instead of freed. */
+    list_initialize(&global_function_result_map_head);
     initialize_source_location(&global_last_mock_value_location);
-    list_free(&global_function_parameter_map_head, free_symbol_map_value,
-              (void*)1);
+    list_initialize(&global_function_parameter_map_head);
     initialize_source_location(&global_last_parameter_location);
+    free_heap_check_events();
+    free_symbol_index();
+    reset_arena();
+}
+
+
+/*
+ * Allocates memory that lasts until the end of the test from the arena,
+ * moving on to the next chunk when the current one is full.  Nothing is
+ * freed before then, so the memory of the values a test has already
+ * consumed keeps growing until it ends.
+ */
+static void* arena_malloc(const size_t size) {
+    const size_t header_size = (sizeof(ArenaChunk) + ARENA_ALIGNMENT - 1) &
+                               ~(size_t)(ARENA_ALIGNMENT - 1);
+    const size_t aligned_size = (size + ARENA_ALIGNMENT - 1) &
+                                ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaChunk *chunk = global_arena;
+    void *ptr;
+
+    while (chunk && chunk->size - chunk->used < aligned_size) {
+        chunk = chunk->next;
+        if (chunk) {
+            chunk->used = 0;
+        }
+    }
+    if (!chunk) {
+        const size_t chunk_size = aligned_size > ARENA_CHUNK_SIZE ?
+                                  aligned_size : ARENA_CHUNK_SIZE;
+        chunk = (ArenaChunk*)malloc(header_size + chunk_size);
+        assert_non_null(chunk);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        /* Insert it after the current chunk, or make it the first. */
+        if (global_arena) {
+            chunk->next = global_arena->next;
+            global_arena->next = chunk;
+        } else {
+            chunk->next = global_arena_chunks;
+            global_arena_chunks = chunk;
+        }
+    }
+    global_arena = chunk;
+    ptr = (char*)chunk + header_size + chunk->used;
+    chunk->used += aligned_size;
+    return ptr;
+}
+
+
+/* Releases everything allocated from the arena, for the next test. */
+static void reset_arena(void) {
+    global_arena = global_arena_chunks;
+    if (global_arena) {
+        global_arena->used = 0;
+    }
+}
+
+
+/* Frees the chunks of the arena. */
+static void free_arena(void) {
+    while (global_arena_chunks) {
+        ArenaChunk * const next = global_arena_chunks->next;
+        free(global_arena_chunks);
+        global_arena_chunks = next;
+    }
+    global_arena = NULL;
 }
 
+
 /* Initialize a list node. */
 static ListNode* list_initialize(ListNode * const node) {
     node->value = NULL;
@@ -385,11 +698,11 @@ static ListNode* list_initialize(ListNode * const node) {
 
 /*
  * Adds a value at the tail of a given list.
- * The node referencing the value is allocated from the heap.
+ * The node referencing the value is allocated from the arena.
  */
 static ListNode* list_add_value(ListNode * const head, const void *value,
                                      const int refcount) {
-    ListNode * const new_node = (ListNode*)malloc(sizeof(ListNode));
+    ListNode * const new_node = (ListNode*)arena_malloc(sizeof(ListNode));
     assert_non_null(head);
     assert_non_null(value);
     new_node->value = value;
@@ -424,12 +737,15 @@ static ListNode* list_remove(
 }
 
 
-/* Remove a list node from a list and free the node. */
+/*
+ * Remove a list node from a list and clean up its value.  The node itself
+ * is in the arena, so it is released when the test ends.
+ */
 static void list_remove_free(
         ListNode * const node, const CleanupListValue cleanup_value,
         void * const cleanup_value_data) {
     assert_non_null(node);
-    free(list_remove(node, cleanup_value, cleanup_value_data));
+    list_remove(node, cleanup_value, cleanup_value_data);
 }
 
 
@@ -457,23 +773,6 @@ static int list_empty(const ListNode * const head) {
 }
 
 
-/*
- * Find a value in the list using the equal_func to compare each node with the
- * value.
- */
-static int list_find(ListNode * const head, const void *value,
-                     const EqualityFunction equal_func, ListNode **output) {
-    ListNode *current;
-    assert_non_null(head);
-    for (current = head->next; current != head; current = current->next) {
-        if (equal_func(current->value, value)) {
-            *output = current;
-            return 1;
-        }
-    }
-    return 0;
-}
-
 /* Returns the first node of a list */
 static int list_first(ListNode * const head, ListNode **output) {
     ListNode *target_node;
@@ -487,34 +786,123 @@ static int list_first(ListNode * const head, ListNode **output) {
 }
 
 
-/* Deallocate a value referenced by a list. */
-static void free_value(const void *value, void *cleanup_value_data) {
-	(void)cleanup_value_data;
-    assert_non_null(value);
-    free((void*)value);
+/* Number of buckets of the symbol index when the first symbol is added. */
+#define SYMBOL_INDEX_INITIAL_BUCKETS 64
+
+/* Hashes a symbol name (FNV-1a) together with the map it's in. */
+static size_t symbol_hash(const ListNode * const symbol_map_head,
+                          const char * const symbol_name) {
+    const unsigned char *c;
+    LargestIntegralType hash = 14695981039346656037ULL;
+    for (c = (const unsigned char*)symbol_name; *c; c++) {
+        hash = (hash ^ *c) * 1099511628211ULL;
+    }
+    hash ^= (LargestIntegralType)(uintptr_t)symbol_map_head *
+            0x9E3779B97F4A7C15ULL;
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+
+/*
+ * Find the node of the symbol map value with the given name in a symbol map.
+ * Names are usually the same string literals, so pointers are compared
+ * before the strings.
+ */
+static ListNode* find_symbol(const ListNode * const symbol_map_head,
+                             const char * const symbol_name,
+                             const size_t hash) {
+    const SymbolMapValue *current;
+    if (!global_symbol_index.number_of_buckets) {
+        return NULL;
+    }
+    current = global_symbol_index.buckets[
+        hash & (global_symbol_index.number_of_buckets - 1)];
+    for (; current; current = current->next) {
+        if (current->hash == hash &&
+            current->symbol_map_head == symbol_map_head &&
+            (current->symbol_name == symbol_name ||
+             !strcmp(current->symbol_name, symbol_name))) {
+            return current->node;
+        }
+    }
+    return NULL;
+}
+
+
+/* Add a symbol map value to the index, doubling it when it's full. */
+static void index_symbol(SymbolMapValue * const map_value) {
+    SymbolIndex * const index = &global_symbol_index;
+    SymbolMapValue **bucket;
+
+    if (index->number_of_values >= index->number_of_buckets) {
+        const size_t number_of_buckets = index->number_of_buckets ?
+            index->number_of_buckets * 2 : SYMBOL_INDEX_INITIAL_BUCKETS;
+        SymbolMapValue ** const buckets = (SymbolMapValue**)calloc(
+            number_of_buckets, sizeof(*buckets));
+        size_t i;
+        assert_non_null(buckets);
+        for (i = 0; i < index->number_of_buckets; i++) {
+            SymbolMapValue *current = index->buckets[i];
+            while (current) {
+                SymbolMapValue * const next = current->next;
+                bucket = &buckets[current->hash & (number_of_buckets - 1)];
+                current->next = *bucket;
+                *bucket = current;
+                current = next;
+            }
+        }
+        free(index->buckets);
+        index->buckets = buckets;
+        index->number_of_buckets = number_of_buckets;
+    }
+
+    bucket = &index->buckets[map_value->hash & (index->number_of_buckets - 1)];
+    map_value->next = *bucket;
+    *bucket = map_value;
+    index->number_of_values ++;
+}
+
+
+/* Remove a symbol map value from the index. */
+static void unindex_symbol(const SymbolMapValue * const map_value) {
+    SymbolIndex * const index = &global_symbol_index;
+    SymbolMapValue **current;
+    assert_true(index->number_of_buckets);
+    for (current = &index->buckets[
+             map_value->hash & (index->number_of_buckets - 1)];
+         *current; current = &(*current)->next) {
+        if (*current == map_value) {
+            *current = map_value->next;
+            index->number_of_values --;
+            return;
+        }
+    }
+    assert_null("BUG: symbol map value isn't indexed!");
 }
 
 
-/* Releases memory associated to a symbol_map_value. */
+/* Free the buckets of the index when the symbol maps are dropped. */
+static void free_symbol_index(void) {
+    free(global_symbol_index.buckets);
+    global_symbol_index.buckets = NULL;
+    global_symbol_index.number_of_buckets = 0;
+    global_symbol_index.number_of_values = 0;
+}
+
+
+/*
+ * Removes a symbol_map_value and its children from the index, their memory
+ * is released with the arena.
+ */
 static void free_symbol_map_value(const void *value,
                                   void *cleanup_value_data) {
     SymbolMapValue * const map_value = (SymbolMapValue*)value;
     const LargestIntegralType children = cast_ptr_to_largest_integral_type(cleanup_value_data);
     assert_non_null(value);
     list_free(&map_value->symbol_values_list_head,
-              children ? free_symbol_map_value : free_value,
+              children ? free_symbol_map_value : NULL,
               (void *) ((uintptr_t)children - 1));
-    free(map_value);
-}
-
-
-/*
- * Determine whether a symbol name referenced by a symbol_map_value matches the
- * specified function name.
- */
-static int symbol_names_match(const void *map_value, const void *symbol) {
-    return !strcmp(((SymbolMapValue*)map_value)->symbol_name,
-                   (const char*)symbol);
+    unindex_symbol(map_value);
 }
 
 
@@ -527,21 +915,27 @@ static void add_symbol_value(ListNode * const symbol_map_head,
                              const size_t number_of_symbol_names,
                              const void* value, const int refcount) {
     const char* symbol_name;
+    size_t hash;
     ListNode *target_node;
     SymbolMapValue *target_map_value;
     assert_non_null(symbol_map_head);
     assert_non_null(symbol_names);
     assert_true(number_of_symbol_names);
     symbol_name = symbol_names[0];
+    hash = symbol_hash(symbol_map_head, symbol_name);
 
-    if (!list_find(symbol_map_head, symbol_name, symbol_names_match,
-                   &target_node)) {
+    target_node = find_symbol(symbol_map_head, symbol_name, hash);
+    if (!target_node) {
         SymbolMapValue * const new_symbol_map_value =
-            (SymbolMapValue*)malloc(sizeof(*new_symbol_map_value));
+            (SymbolMapValue*)arena_malloc(sizeof(*new_symbol_map_value));
         new_symbol_map_value->symbol_name = symbol_name;
         list_initialize(&new_symbol_map_value->symbol_values_list_head);
+        new_symbol_map_value->hash = hash;
+        new_symbol_map_value->symbol_map_head = symbol_map_head;
         target_node = list_add_value(symbol_map_head, new_symbol_map_value,
                                           1);
+        new_symbol_map_value->node = target_node;
+        index_symbol(new_symbol_map_value);
     }
 
     target_map_value = (SymbolMapValue*)target_node->value;
@@ -573,7 +967,9 @@ static int get_symbol_value(
     assert_non_null(output);
     symbol_name = symbol_names[0];
 
-    if (list_find(head, symbol_name, symbol_names_match, &target_node)) {
+    target_node = find_symbol(head, symbol_name,
+                              symbol_hash(head, symbol_name));
+    if (target_node) {
         SymbolMapValue *map_value;
         ListNode *child_list;
         int return_value = 0;
@@ -631,7 +1027,7 @@ static void remove_always_return_values(ListNode * const map_head,
                 ListNode * const child_node = child_list->next;
                 /* If this item has been returned more than once, free it. */
                 if (child_node->refcount < -1) {
-                    list_remove_free(child_node, free_value, NULL);
+                    list_remove_free(child_node, NULL, NULL);
                 }
             } else {
                 remove_always_return_values(child_list,
@@ -640,7 +1036,7 @@ static void remove_always_return_values(ListNode * const map_head,
         }
 
         if (list_empty(child_list)) {
-            list_remove_free(current, free_value, NULL);
+            list_remove_free(current, free_symbol_map_value, (void*)0);
         }
         current = next;
     }
@@ -701,9 +1097,6 @@ LargestIntegralType _mock(const char * const function, const char* const file,
         SymbolValue * const symbol = (SymbolValue*)result;
         const LargestIntegralType value = symbol->value;
         global_last_mock_value_location = symbol->location;
-        if (rc == 1) {
-            free(symbol);
-        }
         return value;
     } else {
         print_error(SOURCE_LOCATION_FORMAT ": error: Could not get value "
@@ -728,7 +1121,7 @@ void _will_return(const char * const function_name, const char * const file,
                   const int line, const LargestIntegralType value,
                   const int count) {
     SymbolValue * const return_value =
-	    (SymbolValue*)malloc(sizeof(*return_value));
+	    (SymbolValue*)arena_malloc(sizeof(*return_value));
     assert_true(count > 0 || count == -1);
     return_value->value = value;
     set_source_location(&return_value->location, file, line);
@@ -737,6 +1130,32 @@ void _will_return(const char * const function_name, const char * const file,
 }
 
 
+/* Checks a value with the heap event a HeapCheckEvent stands for. */
+static int check_heap_event(const LargestIntegralType value,
+                            const LargestIntegralType check_value_data) {
+    const CheckParameterEvent * const heap_event =
+        cast_largest_integral_type_to_pointer(const CheckParameterEvent*,
+                                              check_value_data);
+    return heap_event->check_value(value, heap_event->check_value_data);
+}
+
+
+/* Frees the heap event of a HeapCheckEvent. */
+static void free_heap_check_event(HeapCheckEvent * const check) {
+    list_remove(&check->node, NULL, NULL);
+    free(check->heap_event);
+}
+
+
+/* Frees the heap events that weren't checked by the end of the test. */
+static void free_heap_check_events(void) {
+    while (!list_empty(&global_heap_check_events)) {
+        free_heap_check_event(
+            (HeapCheckEvent*)global_heap_check_events.next->value);
+    }
+}
+
+
 /*
  * Add a custom parameter checking function.  If the event parameter is NULL
  * the event structure is allocated internally by this function.  If event
@@ -749,8 +1168,40 @@ void _expect_check(
         const CheckParameterValue check_function,
         const LargestIntegralType check_data,
         CheckParameterEvent * const event, const int count) {
+    HeapCheckEvent *check;
+
+    if (!event) {
+        add_check_event(function, parameter, file, line, check_function,
+                        check_data, NULL, count);
+        return;
+    }
+    event->parameter_name = parameter;
+    event->check_value = check_function;
+    event->check_value_data = check_data;
+    set_source_location(&event->location, file, line);
+
+    check = (HeapCheckEvent*)arena_malloc(sizeof(*check));
+    check->heap_event = event;
+    check->node.value = check;
+    list_add(&global_heap_check_events, &check->node);
+    add_check_event(function, parameter, file, line, check_heap_event,
+                    cast_ptr_to_largest_integral_type(event), &check->event,
+                    count);
+}
+
+
+/*
+ * Adds a check event to the parameter map, allocating it from the arena if
+ * event is NULL.  An event that isn't NULL must live until the test ends.
+ */
+static void add_check_event(
+        const char* const function, const char* const parameter,
+        const char* const file, const int line,
+        const CheckParameterValue check_function,
+        const LargestIntegralType check_data,
+        CheckParameterEvent * const event, const int count) {
     CheckParameterEvent * const check =
-        event ? event : (CheckParameterEvent*)malloc(sizeof(*check));
+        event ? event : (CheckParameterEvent*)arena_malloc(sizeof(*check));
     const char* symbols[] = {function, parameter};
     check->parameter_name = parameter;
     check->check_value = check_function;
@@ -965,7 +1416,7 @@ static void expect_set(
         const LargestIntegralType values[], const size_t number_of_values,
         const CheckParameterValue check_function, const int count) {
     CheckIntegerSet * const check_integer_set =
-        (CheckIntegerSet*)malloc(sizeof(*check_integer_set) +
+        (CheckIntegerSet*)arena_malloc(sizeof(*check_integer_set) +
                (sizeof(values[0]) * number_of_values));
     LargestIntegralType * const set = (LargestIntegralType*)(
         check_integer_set + 1);
@@ -974,7 +1425,7 @@ static void expect_set(
     assert_true(number_of_values);
     memcpy(set, values, number_of_values * sizeof(values[0]));
     check_integer_set->set = set;
-    _expect_check(
+    add_check_event(
         function, parameter, file, line, check_function,
         check_data.value, &check_integer_set->event, count);
 }
@@ -1034,12 +1485,12 @@ static void expect_range(
         const LargestIntegralType minimum, const LargestIntegralType maximum,
         const CheckParameterValue check_function, const int count) {
     CheckIntegerRange * const check_integer_range =
-        (CheckIntegerRange*)malloc(sizeof(*check_integer_range));
+        (CheckIntegerRange*)arena_malloc(sizeof(*check_integer_range));
     declare_initialize_value_pointer_pointer(check_data, check_integer_range);
     check_integer_range->minimum = minimum;
     check_integer_range->maximum = maximum;
-    _expect_check(function, parameter, file, line, check_function,
-                  check_data.value, &check_integer_range->event, count);
+    add_check_event(function, parameter, file, line, check_function,
+                    check_data.value, &check_integer_range->event, count);
 }
 
 
@@ -1164,7 +1615,7 @@ static void expect_memory_setup(
         const void * const memory, const size_t size,
         const CheckParameterValue check_function, const int count) {
     CheckMemoryData * const check_data =
-	    (CheckMemoryData*)malloc(sizeof(*check_data) + size);
+	    (CheckMemoryData*)arena_malloc(sizeof(*check_data) + size);
     void * const mem = (void*)(check_data + 1);
     declare_initialize_value_pointer_pointer(check_data_pointer, check_data);
     assert_non_null(memory);
@@ -1172,8 +1623,8 @@ static void expect_memory_setup(
     memcpy(mem, memory, size);
     check_data->memory = mem;
     check_data->size = size;
-    _expect_check(function, parameter, file, line, check_function,
-                  check_data_pointer.value, &check_data->event, count);
+    add_check_event(function, parameter, file, line, check_function,
+                    check_data_pointer.value, &check_data->event, count);
 }
 
 
@@ -1241,8 +1692,8 @@ void _check_expected(
         int check_succeeded;
         global_last_parameter_location = check->location;
         check_succeeded = check->check_value(value, check->check_value_data);
-        if (rc == 1) {
-            free(check);
+        if (rc == 1 && check->check_value == check_heap_event) {
+            free_heap_check_event((HeapCheckEvent*)check);
         }
         if (!check_succeeded) {
             print_error(SOURCE_LOCATION_FORMAT
@@ -1403,12 +1854,85 @@ static ListNode* get_allocated_blocks_list() {
     return &global_allocated_blocks;
 }
 
+void cmocka_set_malloc_check(const TestMallocCheck check) {
+    global_malloc_check = check;
+}
+
+
+/* Returns the checks named by "full", "count" or "off", or -1. */
+static int parse_malloc_check(const char * const name) {
+    if (strcmp(name, "full") == 0) {
+        return TEST_MALLOC_CHECK_FULL;
+    } else if (strcmp(name, "count") == 0) {
+        return TEST_MALLOC_CHECK_COUNT;
+    } else if (strcmp(name, "off") == 0) {
+        return TEST_MALLOC_CHECK_OFF;
+    }
+    return -1;
+}
+
+
+/*
+ * Returns the checks done by test_malloc(), from the CMOCKA_MALLOC_CHECK
+ * environment variable if they weren't set.
+ */
+static TestMallocCheck get_malloc_check(void) {
+    if (global_malloc_check < 0) {
+        const char * const env = getenv("CMOCKA_MALLOC_CHECK");
+        const int check = env ? parse_malloc_check(env) : -1;
+        global_malloc_check = check < 0 ? TEST_MALLOC_CHECK_FULL : check;
+    }
+    return (TestMallocCheck)global_malloc_check;
+}
+
+
+/*
+ * Returns the first corrupt byte of a guard block, or NULL if it is intact.
+ * The guard is compared a word at a time, it needn't be aligned.
+ */
+static const char* find_corrupt_guard_byte(const char * const guard) {
+    size_t pattern;
+    size_t i;
+    memset(&pattern, MALLOC_GUARD_PATTERN, sizeof(pattern));
+    for (i = 0; i < MALLOC_GUARD_SIZE; i += sizeof(pattern)) {
+        size_t word;
+        memcpy(&word, guard + i, sizeof(word));
+        if (word != pattern) {
+            size_t j;
+            for (j = i; (unsigned char)guard[j] == MALLOC_GUARD_PATTERN; j++) {
+            }
+            return &guard[j];
+        }
+    }
+    return NULL;
+}
+
+
+/* Locks the list of allocated blocks while stress test threads run. */
+static void lock_allocated_blocks(void) {
+#ifdef HAVE_STRESS_THREADS
+    if (global_stress_running) {
+        pthread_mutex_lock(&global_allocated_blocks_mutex);
+    }
+#endif /* HAVE_STRESS_THREADS */
+}
+
+
+static void unlock_allocated_blocks(void) {
+#ifdef HAVE_STRESS_THREADS
+    if (global_stress_running) {
+        pthread_mutex_unlock(&global_allocated_blocks_mutex);
+    }
+#endif /* HAVE_STRESS_THREADS */
+}
+
+
 /* Use the real malloc in this function. */
 #undef malloc
 void* _test_malloc(const size_t size, const char* file, const int line) {
     char* ptr;
     MallocBlockInfo *block_info;
-    ListNode * const block_list = get_allocated_blocks_list();
+    const TestMallocCheck check = get_malloc_check();
     const size_t allocate_size = size + (MALLOC_GUARD_SIZE * 2) +
         sizeof(*block_info) + MALLOC_ALIGNMENT;
     char* const block = (char*)malloc(allocate_size);
@@ -1419,18 +1943,42 @@ void* _test_malloc(const size_t size, const char* file, const int line) {
                   MALLOC_ALIGNMENT) & ~(MALLOC_ALIGNMENT - 1));
 
     /* Initialize the guard blocks. */
-    memset(ptr - MALLOC_GUARD_SIZE, MALLOC_GUARD_PATTERN, MALLOC_GUARD_SIZE);
-    memset(ptr + size, MALLOC_GUARD_PATTERN, MALLOC_GUARD_SIZE);
-    memset(ptr, MALLOC_ALLOC_PATTERN, size);
+    if (check == TEST_MALLOC_CHECK_FULL) {
+        memset(ptr - MALLOC_GUARD_SIZE, MALLOC_GUARD_PATTERN,
+               MALLOC_GUARD_SIZE);
+        memset(ptr + size, MALLOC_GUARD_PATTERN, MALLOC_GUARD_SIZE);
+        memset(ptr, MALLOC_ALLOC_PATTERN, size);
+    }
 
     block_info = (MallocBlockInfo*)(ptr - (MALLOC_GUARD_SIZE +
                                              sizeof(*block_info)));
-    set_source_location(&block_info->location, file, line);
     block_info->allocated_size = allocate_size;
     block_info->size = size;
     block_info->block = block;
-    block_info->node.value = block_info;
-    list_add(block_list, &block_info->node);
+    block_info->check = check;
+    lock_allocated_blocks();
+    /* Untracked blocks still count for the allocation assertions. */
+    if (check != TEST_MALLOC_CHECK_OFF) {
+        set_source_location(&block_info->location, file, line);
+        block_info->node.value = block_info;
+        list_add(get_allocated_blocks_list(), &block_info->node);
+        global_allocated_bytes_in_use += size;
+        if (global_allocated_bytes_in_use > global_peak_bytes_in_use) {
+            global_peak_bytes_in_use = global_allocated_bytes_in_use;
+        }
+    }
+
+    global_allocation_count ++;
+    global_allocated_bytes += size;
+    if (source_location_is_set(&global_allocation_region.location) &&
+        !source_location_is_set(&global_allocation_region.exceeded) &&
+        (global_allocation_count - global_allocation_region.count >
+         global_allocation_region.max_count ||
+         global_allocated_bytes - global_allocation_region.bytes >
+         global_allocation_region.max_bytes)) {
+        set_source_location(&global_allocation_region.exceeded, file, line);
+    }
+    unlock_allocated_blocks();
     return ptr;
 }
 #define malloc test_malloc
@@ -1446,6 +1994,58 @@ void* _test_calloc(const size_t number_of_elements, const size_t size,
 }
 
 
+void _assert_allocations_begin(const size_t max_count, const size_t max_bytes,
+                               const char * const file, const int line) {
+    AllocationRegion * const region = &global_allocation_region;
+    if (source_location_is_set(&region->location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: Allocation check already "
+                    "began at " SOURCE_LOCATION_FORMAT "\n", file, line,
+                    region->location.file, region->location.line);
+        _fail(file, line);
+    }
+    set_source_location(&region->location, file, line);
+    initialize_source_location(&region->exceeded);
+    region->max_count = max_count;
+    region->max_bytes = max_bytes;
+    region->count = global_allocation_count;
+    region->bytes = global_allocated_bytes;
+}
+
+
+void _assert_allocations_end(const char * const file, const int line) {
+    AllocationRegion * const region = &global_allocation_region;
+    size_t count;
+    size_t bytes;
+    if (!source_location_is_set(&region->location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: No allocation check to "
+                    "end\n", file, line);
+        _fail(file, line);
+    }
+    initialize_source_location(&region->location);
+    count = global_allocation_count - region->count;
+    bytes = global_allocated_bytes - region->bytes;
+
+    if (count > region->max_count || bytes > region->max_bytes) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: %"PRIdS " block(s) of "
+                    "%"PRIdS " bytes in total were allocated", file, line,
+                    count, bytes);
+        if (region->max_count == 0 || region->max_bytes == 0) {
+            print_error(", none allowed\n");
+        } else if (count > region->max_count) {
+            print_error(", at most %"PRIdS " block(s) allowed\n",
+                        region->max_count);
+        } else {
+            print_error(", at most %"PRIdS " bytes allowed\n",
+                        region->max_bytes);
+        }
+        print_error(SOURCE_LOCATION_FORMAT ": note: allocation over the "
+                    "limit was here\n", region->exceeded.file,
+                    region->exceeded.line);
+        _fail(file, line);
+    }
+}
+
+
 /* Use the real free in this function. */
 #undef free
 void _test_free(void* const ptr, const char* file, const int line) {
@@ -1457,31 +2057,34 @@ void _test_free(void* const ptr, const char* file, const int line) {
     block_info = (MallocBlockInfo*)(block - (MALLOC_GUARD_SIZE +
                                                sizeof(*block_info)));
     /* Check the guard blocks. */
-    {
-        char *guards[2] = {block - MALLOC_GUARD_SIZE,
-                           block + block_info->size};
+    if (block_info->check == TEST_MALLOC_CHECK_FULL) {
+        const char *guards[2] = {block - MALLOC_GUARD_SIZE,
+                                 block + block_info->size};
         for (i = 0; i < ARRAY_LENGTH(guards); i++) {
-            unsigned int j;
-            char * const guard = guards[i];
-            for (j = 0; j < MALLOC_GUARD_SIZE; j++) {
-                const char diff = guard[j] - MALLOC_GUARD_PATTERN;
-                if (diff) {
-                    print_error(SOURCE_LOCATION_FORMAT
-                                ": error: Guard block of %p size=%lu is corrupt\n"
-                                SOURCE_LOCATION_FORMAT ": note: allocated here at %p\n",
-                                file, line,
-                                ptr, (unsigned long)block_info->size,
-                                block_info->location.file, block_info->location.line,
-                                &guard[j]);
-                    _fail(file, line);
-                }
+            const char * const corrupt = find_corrupt_guard_byte(guards[i]);
+            if (corrupt) {
+                print_error(SOURCE_LOCATION_FORMAT
+                            ": error: Guard block of %p size=%lu is corrupt\n"
+                            SOURCE_LOCATION_FORMAT ": note: allocated here at %p\n",
+                            file, line,
+                            ptr, (unsigned long)block_info->size,
+                            block_info->location.file, block_info->location.line,
+                            corrupt);
+                _fail(file, line);
             }
         }
     }
-    list_remove(&block_info->node, NULL, NULL);
+    if (block_info->check != TEST_MALLOC_CHECK_OFF) {
+        lock_allocated_blocks();
+        list_remove(&block_info->node, NULL, NULL);
+        global_allocated_bytes_in_use -= block_info->size;
+        unlock_allocated_blocks();
+    }
 
     block = discard_const_p(char, block_info->block);
-    memset(block, MALLOC_FREE_PATTERN, block_info->allocated_size);
+    if (block_info->check == TEST_MALLOC_CHECK_FULL) {
+        memset(block, MALLOC_FREE_PATTERN, block_info->allocated_size);
+    }
     free(block);
 }
 #define free test_free
@@ -1551,6 +2154,7 @@ static void fail_if_blocks_allocated(const ListNode * const check_point,
 
 
 void _fail(const char * const file, const int line) {
+    set_source_location(&global_last_failure_location, file, line);
   print_error(SOURCE_LOCATION_FORMAT ": error: Failure!\n", file, line);
     exit_test(1);
 }
@@ -1643,6 +2247,22 @@ void print_error(const char* const format, ...) {
 }
 
 
+/* Returns a monotonic time in nanoseconds. */
+static double monotonic_clock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * 1e9 / (double)frequency.QuadPart;
+#else /* _WIN32 */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+#endif /* _WIN32 */
+}
+
+
 int _run_test(
         const char * const function_name,  const UnitTestFunction Function,
         void ** const volatile state, const UnitTestFunctionType function_type,
@@ -1653,6 +2273,10 @@ int _run_test(
     void *current_state = NULL;
     volatile int rc = 1;
     int handle_exceptions = 1;
+    const double start_time = monotonic_clock();
+    const clock_t start_cpu_time = clock();
+    const size_t start_allocation_count = global_allocation_count;
+    const size_t start_bytes_in_use = global_allocated_bytes_in_use;
 #ifdef _WIN32
     handle_exceptions = !IsDebuggerPresent();
 #endif /* _WIN32 */
@@ -1676,8 +2300,11 @@ int _run_test(
     if (function_type == UNIT_TEST_FUNCTION_TYPE_TEST) {
         print_message("[ RUN      ] %s\n", function_name);
     }
+    global_peak_bytes_in_use = start_bytes_in_use;
+    initialize_source_location(&global_last_failure_location);
     initialize_testing(function_name);
     global_running_test = 1;
+    global_running_test_name = function_name;
     if (setjmp(global_run_test_env) == 0) {
         Function(state ? state : &current_state);
         fail_if_leftover_values(function_name);
@@ -1689,6 +2316,7 @@ int _run_test(
         }
 
         global_running_test = 0;
+        global_running_test_name = NULL;
 
         if (function_type == UNIT_TEST_FUNCTION_TYPE_TEST) {
             print_message("[       OK ] %s\n", function_name);
@@ -1696,10 +2324,22 @@ int _run_test(
         rc = 0;
     } else {
         global_running_test = 0;
+        global_running_test_name = NULL;
         print_message("[  FAILED  ] %s\n", function_name);
     }
     teardown_testing(function_name);
 
+    global_last_test_result.failed = rc;
+    global_last_test_result.failure = global_last_failure_location;
+    global_last_test_result.wall_time =
+        (monotonic_clock() - start_time) / 1e9;
+    global_last_test_result.cpu_time =
+        (double)(clock() - start_cpu_time) / CLOCKS_PER_SEC;
+    global_last_test_result.peak_bytes =
+        global_peak_bytes_in_use - start_bytes_in_use;
+    global_last_test_result.allocations =
+        global_allocation_count - start_allocation_count;
+
     if (handle_exceptions) {
 #ifndef _WIN32
         unsigned int i;
@@ -1718,106 +2358,667 @@ int _run_test(
 }
 
 
-int _run_tests(const UnitTest * const tests, const size_t number_of_tests) {
-    /* Whether to execute the next test. */
-    int run_next_test = 1;
-    /* Whether the previous test failed. */
-    int previous_test_failed = 0;
-    /* Check point of the heap state. */
-    const ListNode * const check_point = check_point_allocated_blocks();
-    /* Current test being executed. */
-    size_t current_test = 0;
-    /* Number of tests executed. */
-    size_t tests_executed = 0;
-    /* Number of failed tests. */
-    size_t total_failed = 0;
-    /* Number of setup functions. */
-    size_t setups = 0;
-    /* Number of teardown functions. */
-    size_t teardowns = 0;
-    /*
-     * A stack of test states.  A state is pushed on the stack
-     * when a test setup occurs and popped on tear down.
-     */
-    TestState* test_states =
-	    (TestState*)malloc(number_of_tests * sizeof(*test_states));
-    size_t number_of_test_states = 0;
-    /* Names of the tests that failed. */
-    const char** failed_names = (const char**)malloc(number_of_tests *
-                                       sizeof(*failed_names));
-    void **current_state = NULL;
+/* Returns the time stamp counter, or 0 where there isn't one. */
+static LargestIntegralType benchmark_ticks(void) {
+#ifdef HAVE_BENCHMARK_TICKS
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif /* HAVE_BENCHMARK_TICKS */
+}
 
-    print_message("[==========] Running %"PRIdS " test(s).\n", number_of_tests);
 
-    /* Make sure LargestIntegralType is at least the size of a pointer. */
-    assert_true(sizeof(LargestIntegralType) >= sizeof(void*));
+/*
+ * Returns the number in the environment variable name, or default_value if
+ * it isn't set or out of the range from minimum to maximum.
+ */
+static double get_benchmark_option(const char * const name,
+                                   const double default_value,
+                                   const double minimum,
+                                   const double maximum) {
+    const char * const env = getenv(name);
+    char *end;
+    double value;
+
+    if (!env || !*env) {
+        return default_value;
+    }
+    value = strtod(env, &end);
+    if (*end != '\0' || !(value >= minimum && value <= maximum)) {
+        print_error("Ignoring invalid %s: %s\n", name, env);
+        return default_value;
+    }
+    return value;
+}
 
-    while (current_test < number_of_tests) {
-        const ListNode *test_check_point = NULL;
-        TestState *current_TestState;
-        const UnitTest * const test = &tests[current_test++];
-        if (!test->function) {
-            continue;
-        }
 
-        switch (test->function_type) {
-        case UNIT_TEST_FUNCTION_TYPE_TEST:
-            run_next_test = 1;
-            break;
-        case UNIT_TEST_FUNCTION_TYPE_SETUP: {
-            /* Checkpoint the heap before the setup. */
-            current_TestState = &test_states[number_of_test_states++];
-            current_TestState->check_point = check_point_allocated_blocks();
-            test_check_point = current_TestState->check_point;
-            current_state = &current_TestState->state;
-            *current_state = NULL;
-            run_next_test = 1;
-            setups ++;
-            break;
-        }
-        case UNIT_TEST_FUNCTION_TYPE_TEARDOWN:
-            /* Check the heap based on the last setup checkpoint. */
-            assert_true(number_of_test_states);
-            current_TestState = &test_states[--number_of_test_states];
-            test_check_point = current_TestState->check_point;
-            current_state = &current_TestState->state;
-            teardowns ++;
-            break;
-        default:
-            print_error("Invalid unit test function type %d\n",
-                        test->function_type);
-            exit_test(1);
-            break;
-        }
+/* Runs a benchmark function and returns the time it took in nanoseconds. */
+static double time_benchmark(const BenchmarkFunction function,
+                             void ** const state, const size_t iterations,
+                             LargestIntegralType * const ticks) {
+    const LargestIntegralType start_ticks = benchmark_ticks();
+    const double start = monotonic_clock();
+    double elapsed;
 
-        if (run_next_test) {
-            int failed = _run_test(test->name, test->function, current_state,
-                                   test->function_type, test_check_point);
-            if (failed) {
-                failed_names[total_failed] = test->name;
-            }
+    function(state, iterations);
+    elapsed = monotonic_clock() - start;
+    if (ticks) {
+        *ticks += benchmark_ticks() - start_ticks;
+    }
+    return elapsed;
+}
 
-            switch (test->function_type) {
+
+static int compare_benchmark_samples(const void *left, const void *right) {
+    const double a = *(const double*)left;
+    const double b = *(const double*)right;
+    return a < b ? -1 : a > b;
+}
+
+
+/*
+ * Returns the time per operation of a benchmark from the last line for it in
+ * a baseline file, or 0 if there's none.
+ */
+static double read_benchmark_baseline(const char * const path,
+                                      const char * const name) {
+    FILE * const file = fopen(path, "r");
+    const size_t name_length = strlen(name);
+    double baseline = 0;
+    char line[1024];
+
+    if (!file) {
+        print_error("Could not open benchmark baseline %s\n", path);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, name, name_length) == 0 &&
+            (line[name_length] == ' ' || line[name_length] == '\t')) {
+            baseline = strtod(&line[name_length], NULL);
+        }
+    }
+    fclose(file);
+    return baseline;
+}
+
+
+static void save_benchmark_result(const char * const path,
+                                  const char * const name,
+                                  const double ns_per_op) {
+    FILE * const file = fopen(path, "a");
+
+    if (!file) {
+        print_error("Could not open benchmark results %s\n", path);
+        return;
+    }
+    fprintf(file, "%s %.3f\n", name, ns_per_op);
+    fclose(file);
+}
+
+
+/*
+ * Writes the key of a benchmark, "test/function", to key. The function name
+ * alone is used outside of a test, and both are cut to fit.
+ */
+static void format_benchmark_key(char * const key, const size_t size,
+                                 const char * const function_name) {
+    size_t length = 0;
+
+    if (global_running_test_name) {
+        length = strlen(global_running_test_name);
+        if (length > size / 2 - 1) {
+            length = size / 2 - 1;
+        }
+        memcpy(key, global_running_test_name, length);
+        key[length++] = '/';
+    }
+    key[length] = '\0';
+    strncat(key, function_name, size - length - 1);
+}
+
+
+double _run_benchmark(
+        const char * const function_name, const BenchmarkFunction function,
+        void ** const state, const double max_ns_per_op,
+        const char * const file, const int line) {
+    char name[512];
+    double samples[BENCHMARK_MAX_SAMPLES];
+    const size_t number_of_samples = (size_t)get_benchmark_option(
+        "CMOCKA_BENCHMARK_SAMPLES", BENCHMARK_SAMPLES, 1,
+        BENCHMARK_MAX_SAMPLES);
+    const double sample_time = get_benchmark_option(
+        "CMOCKA_BENCHMARK_SAMPLE_TIME", BENCHMARK_SAMPLE_TIME, 0.001,
+        60000) * 1e6;
+    const char * const baseline_path = getenv("CMOCKA_BENCHMARK_BASELINE");
+    const char * const save_path = getenv("CMOCKA_BENCHMARK_SAVE");
+    LargestIntegralType ticks = 0;
+    size_t iterations = 1;
+    double limit = max_ns_per_op;
+    double median;
+    size_t i;
+
+    format_benchmark_key(name, sizeof(name), function_name);
+
+    /*
+     * Grow the batch until it takes a sample's time, which also warms up
+     * the caches and branch predictors.
+     */
+    for (;;) {
+        const double elapsed = time_benchmark(function, state, iterations,
+                                              NULL);
+        const double scale = elapsed > 0 ? sample_time / elapsed * 1.1 : 100;
+        if (elapsed >= sample_time || iterations > ((size_t)-1) / 100) {
+            break;
+        }
+        iterations = (size_t)((double)iterations * (scale < 100 ? scale : 100))
+                     + 1;
+    }
+    for (i = 0; i < BENCHMARK_WARMUP_SAMPLES; i++) {
+        time_benchmark(function, state, iterations, NULL);
+    }
+
+    for (i = 0; i < number_of_samples; i++) {
+        samples[i] = time_benchmark(function, state, iterations, &ticks) /
+                     (double)iterations;
+    }
+    qsort(samples, number_of_samples, sizeof(*samples),
+          compare_benchmark_samples);
+    median = number_of_samples % 2 ? samples[number_of_samples / 2] :
+        (samples[number_of_samples / 2 - 1] +
+         samples[number_of_samples / 2]) / 2;
+
+    print_message("[ BENCH    ] %s: %.2f ns/op (min %.2f, p99 %.2f)",
+                  name, median, samples[0],
+                  samples[(number_of_samples * 99 + 99) / 100 - 1]);
+#ifdef HAVE_BENCHMARK_TICKS
+    print_message(", %.1f ticks/op",
+                  (double)ticks / (double)iterations /
+                  (double)number_of_samples);
+#endif /* HAVE_BENCHMARK_TICKS */
+    print_message(", %"PRIdS " x %"PRIdS " iterations\n",
+                  number_of_samples, iterations);
+
+    if (baseline_path && *baseline_path) {
+        const double baseline = read_benchmark_baseline(baseline_path, name);
+        if (baseline > 0) {
+            const double baseline_limit = baseline *
+                (1 + get_benchmark_option("CMOCKA_BENCHMARK_TOLERANCE",
+                                          BENCHMARK_TOLERANCE, 0, 1e6) / 100);
+            print_message("[ BENCH    ] %s: baseline %.2f ns/op (%+.1f%%)\n",
+                          name, baseline, (median / baseline - 1) * 100);
+            if (limit <= 0 || baseline_limit < limit) {
+                limit = baseline_limit;
+            }
+        }
+    }
+    if (save_path && *save_path) {
+        save_benchmark_result(save_path, name, median);
+    }
+
+    if (limit > 0 && median > limit) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: %s takes %.2f ns/op, "
+                    "over the limit of %.2f ns/op\n", file, line, name,
+                    median, limit);
+        _fail(file, line);
+    }
+    return median;
+}
+
+
+/* Names of the counters in the perf_counters_end() report. */
+static const char * const perf_counter_names[PERF_COUNTERS] = {
+    "cycles", "instructions", "cache misses", "branch misses",
+};
+
+
+/*
+ * Opens a counter of the calling thread in user space, disabled, and returns
+ * its file descriptor, or -1 if it isn't available.
+ */
+static int open_perf_counter(const PerfCounter counter) {
+#ifdef HAVE_PERF_COUNTERS
+    static const unsigned long long configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[counter];
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)counter;
+    return -1;
+#endif /* HAVE_PERF_COUNTERS */
+}
+
+
+/*
+ * Returns the count of an enabled counter, scaled up for the time it was
+ * multiplexed out, or a negative number if it couldn't count.
+ */
+static double read_perf_counter(const int fd) {
+#ifdef HAVE_PERF_COUNTERS
+    /* The value, the time enabled and the time running. */
+    __u64 values[3];
+
+    if (read(fd, values, sizeof(values)) != (ssize_t)sizeof(values) ||
+        values[2] == 0) {
+        return -1;
+    }
+    return (double)values[0] * ((double)values[1] / (double)values[2]);
+#else
+    (void)fd;
+    return -1;
+#endif /* HAVE_PERF_COUNTERS */
+}
+
+
+/* Closes the counters of the current region, if there is one. */
+static void close_perf_counters(void) {
+    PerfRegion * const region = &global_perf_region;
+    size_t i;
+
+    if (!source_location_is_set(&region->location)) {
+        return;
+    }
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (region->fds[i] >= 0) {
+            close(region->fds[i]);
+        }
+    }
+    initialize_source_location(&region->location);
+}
+
+
+void _perf_counters_begin(const char * const file, const int line) {
+    PerfRegion * const region = &global_perf_region;
+    size_t i;
+
+    if (source_location_is_set(&region->location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: Performance counters "
+                    "already began at " SOURCE_LOCATION_FORMAT "\n", file,
+                    line, region->location.file, region->location.line);
+        _fail(file, line);
+    }
+    set_source_location(&region->location, file, line);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        region->fds[i] = open_perf_counter((PerfCounter)i);
+    }
+#ifdef HAVE_PERF_COUNTERS
+    /* Enable them last so they count as little of each other as possible. */
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (region->fds[i] >= 0) {
+            ioctl(region->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(region->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif /* HAVE_PERF_COUNTERS */
+}
+
+
+void _perf_counters_end(const char * const name, const size_t operations,
+                        const char * const file, const int line) {
+    PerfRegion * const region = &global_perf_region;
+    const double divisor = operations ? (double)operations : 1;
+    size_t i;
+
+    if (!source_location_is_set(&region->location)) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: No performance counters "
+                    "to end\n", file, line);
+        _fail(file, line);
+    }
+#ifdef HAVE_PERF_COUNTERS
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (region->fds[i] >= 0) {
+            ioctl(region->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif /* HAVE_PERF_COUNTERS */
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        const double count = region->fds[i] >= 0 ?
+                             read_perf_counter(region->fds[i]) : -1;
+        global_perf_counts[i] = count >= 0 ? count / divisor : -1;
+    }
+    close_perf_counters();
+
+    print_message("[ PERF     ] %s:", name);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (global_perf_counts[i] >= 0) {
+            print_message("%s %.2f %s/op", i ? "," : "",
+                          global_perf_counts[i], perf_counter_names[i]);
+        } else {
+            print_message("%s %s n/a", i ? "," : "", perf_counter_names[i]);
+        }
+    }
+    print_message(", %"PRIdS " operations\n", operations);
+}
+
+
+double perf_counter_per_op(const PerfCounter counter) {
+    return global_perf_counts[counter];
+}
+
+
+void _assert_perf_counter_max(const PerfCounter counter,
+                              const double max_per_op,
+                              const char * const file, const int line) {
+    const double count = global_perf_counts[counter];
+
+    if (count < 0) {
+        print_message("[ PERF     ] %s not available, not checked\n",
+                      perf_counter_names[counter]);
+    } else if (count > max_per_op) {
+        print_error(SOURCE_LOCATION_FORMAT ": error: %.2f %s/op, over the "
+                    "limit of %.2f\n", file, line, count,
+                    perf_counter_names[counter], max_per_op);
+        _fail(file, line);
+    }
+}
+
+
+#ifdef HAVE_STRESS_THREADS
+/*
+ * Pins the calling thread to the CPU its index picks from the CPUs it may
+ * run on, where that is supported.
+ */
+static void pin_stress_worker(const int index) {
+#ifdef __linux__
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    const size_t bits = 8 * sizeof(mask[0]);
+    size_t number_of_cpus = 0;
+    size_t cpu;
+
+    memset(mask, 0, sizeof(mask));
+    if (syscall(__NR_sched_getaffinity, 0, sizeof(mask), mask) <= 0) {
+        return;
+    }
+    for (cpu = 0; cpu < bits * ARRAY_LENGTH(mask); cpu++) {
+        number_of_cpus += (mask[cpu / bits] >> (cpu % bits)) & 1;
+    }
+    number_of_cpus = (size_t)index % number_of_cpus;
+    for (cpu = 0; cpu < bits * ARRAY_LENGTH(mask); cpu++) {
+        if (((mask[cpu / bits] >> (cpu % bits)) & 1) &&
+            number_of_cpus-- == 0) {
+            break;
+        }
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[cpu / bits] = 1UL << (cpu % bits);
+    syscall(__NR_sched_setaffinity, 0, sizeof(mask), mask);
+#else
+    (void)index;
+#endif /* __linux__ */
+}
+
+
+static void* run_stress_worker(void *arg) {
+    StressWorker * const worker = (StressWorker*)arg;
+
+    pin_stress_worker(worker->index);
+    global_stress_worker = worker;
+    if (setjmp(worker->env) == 0) {
+        while (!__atomic_load_n(&global_stress_start, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        while (!__atomic_load_n(&global_stress_stop, __ATOMIC_RELAXED)) {
+            worker->function(worker->state, worker->index,
+                             worker->number_of_threads);
+            /* Not a local, which a longjmp() could leave undefined. */
+            worker->operations ++;
+        }
+    } else {
+        /* Stop the others too, the test has failed anyway. */
+        worker->failed = 1;
+        __atomic_store_n(&global_stress_stop, 1, __ATOMIC_RELAXED);
+    }
+    global_stress_worker = NULL;
+    return NULL;
+}
+#endif /* HAVE_STRESS_THREADS */
+
+
+/* Use the real malloc and free in this function, the workers aren't a leak. */
+#undef malloc
+#undef free
+double _run_stress(
+        const char * const name, const StressFunction function,
+        void ** const state, const int threads,
+        const char * const file, const int line) {
+    const double duration = get_benchmark_option(
+        "CMOCKA_STRESS_TIME", STRESS_TIME, 0.001, 3600000) * 1e6;
+    int number_of_threads = threads;
+    size_t operations = 0;
+    double start;
+    double elapsed;
+#ifdef HAVE_STRESS_THREADS
+    StressWorker *workers;
+    int failed = 0;
+    int started;
+    int i;
+
+    if (number_of_threads <= 0) {
+        number_of_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (number_of_threads <= 0) {
+        number_of_threads = 1;
+    }
+    workers = (StressWorker*)malloc(number_of_threads * sizeof(*workers));
+    if (!workers) {
+        print_error("[  ERROR   ] %s: could not allocate %d thread(s)\n", name,
+                    number_of_threads);
+        _fail(file, line);
+    }
+    memset(workers, 0, number_of_threads * sizeof(*workers));
+    global_stress_start = 0;
+    global_stress_stop = 0;
+    global_stress_running = 1;
+    for (started = 0; started < number_of_threads; started++) {
+        StressWorker * const worker = &workers[started];
+        worker->index = started;
+        worker->number_of_threads = number_of_threads;
+        worker->function = function;
+        worker->state = state;
+        if (pthread_create(&worker->thread, NULL, run_stress_worker,
+                           worker)) {
+            print_error("[  ERROR   ] %s: could not start thread %d\n", name,
+                        started);
+            __atomic_store_n(&global_stress_stop, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    start = monotonic_clock();
+    __atomic_store_n(&global_stress_start, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&global_stress_stop, __ATOMIC_RELAXED) &&
+           monotonic_clock() - start < duration) {
+        usleep(1000);
+    }
+    __atomic_store_n(&global_stress_stop, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    elapsed = monotonic_clock() - start;
+    global_stress_running = 0;
+
+    for (i = 0; i < started; i++) {
+        operations += workers[i].operations;
+        if (workers[i].failed) {
+            print_error("[  ERROR   ] %s: thread %d failed\n", name, i);
+            failed = 1;
+        }
+    }
+    free(workers);
+    if (failed || started < number_of_threads) {
+        _fail(file, line);
+    }
+#else
+    /* Without threads the function runs as the only thread. */
+    number_of_threads = 1;
+    start = monotonic_clock();
+    do {
+        function(state, 0, 1);
+        operations ++;
+        elapsed = monotonic_clock() - start;
+    } while (elapsed < duration);
+#endif /* HAVE_STRESS_THREADS */
+
+    print_message("[ STRESS   ] %s: %d thread(s), %.0f ops/s, %.0f ops/s per "
+                  "thread, %.0f ms\n", name, number_of_threads,
+                  (double)operations * 1e9 / elapsed,
+                  (double)operations * 1e9 / elapsed / number_of_threads,
+                  elapsed / 1e6);
+    return (double)operations * 1e9 / elapsed;
+}
+#define malloc test_malloc
+#define free test_free
+
+
+/* Progress of run_tests() through the array of tests. */
+typedef struct TestRun {
+    /* Whether to execute the next test. */
+    int run_next_test;
+    /* Whether the previous test failed. */
+    int previous_test_failed;
+    /*
+     * A stack of test states.  A state is pushed on the stack
+     * when a test setup occurs and popped on tear down.
+     */
+    TestState *test_states;
+    size_t number_of_test_states;
+    /* Number of tests executed. */
+    size_t tests_executed;
+    /* Number of failed tests. */
+    size_t total_failed;
+    /* Number of setup functions. */
+    size_t setups;
+    /* Number of teardown functions. */
+    size_t teardowns;
+    /* Indexes of the tests that failed. */
+    size_t *failed_tests;
+    /* Measurements of the tests executed. */
+    TestResult *results;
+    size_t number_of_results;
+} TestRun;
+
+
+static void initialize_test_run(TestRun * const run,
+                                const size_t number_of_tests) {
+    run->run_next_test = 1;
+    run->previous_test_failed = 0;
+    run->test_states =
+        (TestState*)malloc(number_of_tests * sizeof(*run->test_states));
+    run->number_of_test_states = 0;
+    run->tests_executed = 0;
+    run->total_failed = 0;
+    run->setups = 0;
+    run->teardowns = 0;
+    run->failed_tests =
+        (size_t*)malloc(number_of_tests * sizeof(*run->failed_tests));
+    run->results = (TestResult*)malloc(number_of_tests * sizeof(*run->results));
+    run->number_of_results = 0;
+}
+
+
+static void free_test_run(TestRun * const run) {
+    free(run->test_states);
+    free(run->failed_tests);
+    free(run->results);
+}
+
+
+/* Runs the tests from begin up to end in the current process. */
+static void run_test_range(const UnitTest * const tests, const size_t begin,
+                           const size_t end, TestRun * const run) {
+    /* Current test being executed. */
+    size_t current_test = begin;
+    void **current_state = NULL;
+
+    while (current_test < end) {
+        const ListNode *test_check_point = NULL;
+        TestState *current_TestState;
+        const size_t test_index = current_test++;
+        const UnitTest * const test = &tests[test_index];
+        if (!test->function) {
+            continue;
+        }
+
+        switch (test->function_type) {
+        case UNIT_TEST_FUNCTION_TYPE_TEST:
+            run->run_next_test = 1;
+            break;
+        case UNIT_TEST_FUNCTION_TYPE_SETUP: {
+            /* Checkpoint the heap before the setup. */
+            current_TestState =
+                &run->test_states[run->number_of_test_states++];
+            current_TestState->check_point = check_point_allocated_blocks();
+            test_check_point = current_TestState->check_point;
+            current_state = &current_TestState->state;
+            *current_state = NULL;
+            run->run_next_test = 1;
+            run->setups ++;
+            break;
+        }
+        case UNIT_TEST_FUNCTION_TYPE_TEARDOWN:
+            /* Check the heap based on the last setup checkpoint. */
+            assert_true(run->number_of_test_states);
+            current_TestState =
+                &run->test_states[--run->number_of_test_states];
+            test_check_point = current_TestState->check_point;
+            current_state = &current_TestState->state;
+            run->teardowns ++;
+            break;
+        default:
+            print_error("Invalid unit test function type %d\n",
+                        test->function_type);
+            exit_test(1);
+            break;
+        }
+
+        if (run->run_next_test) {
+            int failed = _run_test(test->name, test->function, current_state,
+                                   test->function_type, test_check_point);
+            if (failed) {
+                run->failed_tests[run->total_failed] = test_index;
+            }
+            /* Failed setups count as tests. */
+            if (test->function_type == UNIT_TEST_FUNCTION_TYPE_TEST ||
+                (test->function_type == UNIT_TEST_FUNCTION_TYPE_SETUP &&
+                 failed)) {
+                TestResult * const result =
+                    &run->results[run->number_of_results++];
+                *result = global_last_test_result;
+                result->test_index = test_index;
+            }
+
+            switch (test->function_type) {
             case UNIT_TEST_FUNCTION_TYPE_TEST:
-                previous_test_failed = failed;
-                total_failed += failed;
-                tests_executed ++;
+                run->previous_test_failed = failed;
+                run->total_failed += failed;
+                run->tests_executed ++;
                 break;
 
             case UNIT_TEST_FUNCTION_TYPE_SETUP:
                 if (failed) {
-                    total_failed ++;
-                    tests_executed ++;
+                    run->total_failed ++;
+                    run->tests_executed ++;
                     /* Skip forward until the next test or setup function. */
-                    run_next_test = 0;
+                    run->run_next_test = 0;
                 }
-                previous_test_failed = 0;
+                run->previous_test_failed = 0;
                 break;
 
             case UNIT_TEST_FUNCTION_TYPE_TEARDOWN:
                 /* If this test failed. */
-                if (failed && !previous_test_failed) {
-                    total_failed ++;
+                if (failed && !run->previous_test_failed) {
+                    run->total_failed ++;
                 }
                 break;
             default:
@@ -1828,29 +3029,975 @@ int _run_tests(const UnitTest * const tests, const size_t number_of_tests) {
             }
         }
     }
+}
+
+
+void cmocka_set_jobs(const int jobs) {
+    global_jobs = jobs;
+}
+
+
+void cmocka_set_test_filter(const char * const filter) {
+    global_test_filter = filter;
+}
+
+
+void cmocka_set_shard(const int index, const int total) {
+    global_shard_index = index;
+    global_shard_total = total;
+}
+
+
+void cmocka_set_list_tests(const int list) {
+    global_list_tests = list;
+}
+
+
+void cmocka_set_junit_report(const char * const path) {
+    global_junit_report = path;
+}
+
+
+void cmocka_set_json_report(const char * const path) {
+    global_json_report = path;
+}
+
+
+void cmocka_set_slowest_tests(const int count) {
+    global_slowest_tests = count;
+}
+
+
+/* Parses the number given to a command line option. */
+static int parse_count_arg(const char * const name, const char * const value,
+                           int * const count) {
+    char *end;
+    const long number = strtol(value, &end, 10);
+
+    if (end == value || *end != '\0' || number < 0 || number > 65536) {
+        print_error("Invalid %s: %s\n", name, value);
+        return -1;
+    }
+    *count = (int)number;
+    return 0;
+}
+
+
+int cmocka_parse_args(const int argc, char * const argv[]) {
+    int count;
+    int i;
+
+    if (argc > 0 && argv[0]) {
+        const char * const slash = strrchr(argv[0], '/');
+        global_suite_name = slash ? slash + 1 : argv[0];
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                print_error("Missing number of jobs after %s\n", argv[i]);
+                return -1;
+            }
+            if (parse_count_arg("number of jobs", argv[++i], &count)) {
+                return -1;
+            }
+            cmocka_set_jobs(count);
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            if (parse_count_arg("number of jobs", argv[i] + 7, &count)) {
+                return -1;
+            }
+            cmocka_set_jobs(count);
+        } else if (argv[i][0] == '-' && argv[i][1] == 'j' &&
+                   isdigit((unsigned char)argv[i][2])) {
+            /* Only -j<digits>, other arguments like -json are ignored. */
+            if (parse_count_arg("number of jobs", argv[i] + 2, &count)) {
+                return -1;
+            }
+            cmocka_set_jobs(count);
+        } else if (strncmp(argv[i], "--slowest=", 10) == 0) {
+            if (parse_count_arg("number of slowest tests", argv[i] + 10,
+                                &count)) {
+                return -1;
+            }
+            cmocka_set_slowest_tests(count);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            cmocka_set_test_filter(argv[i] + 9);
+        } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            int index;
+            int total;
+            char *slash = strchr(argv[i] + 8, '/');
+            if (!slash) {
+                print_error("Invalid shard, expected INDEX/TOTAL: %s\n",
+                            argv[i] + 8);
+                return -1;
+            }
+            *slash = '\0';
+            count = parse_count_arg("shard index", argv[i] + 8, &index) ||
+                    parse_count_arg("number of shards", slash + 1, &total);
+            *slash = '/';
+            if (count) {
+                return -1;
+            }
+            cmocka_set_shard(index, total);
+        } else if (strcmp(argv[i], "--list") == 0) {
+            cmocka_set_list_tests(1);
+        } else if (strncmp(argv[i], "--malloc-check=", 15) == 0) {
+            const int check = parse_malloc_check(argv[i] + 15);
+            if (check < 0) {
+                print_error("Invalid malloc check, expected full, count or "
+                            "off: %s\n", argv[i] + 15);
+                return -1;
+            }
+            cmocka_set_malloc_check((TestMallocCheck)check);
+        } else if (strncmp(argv[i], "--junit=", 8) == 0) {
+            cmocka_set_junit_report(argv[i] + 8);
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            cmocka_set_json_report(argv[i] + 7);
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Returns the number of processes to run the tests in, from
+ * cmocka_set_jobs() or else the CMOCKA_JOBS environment variable.
+ */
+static size_t get_test_jobs(void) {
+    int jobs = global_jobs;
+
+    if (jobs < 0) {
+        const char *env = getenv("CMOCKA_JOBS");
+        jobs = (env && *env) ? atoi(env) : 1;
+    }
+#ifndef _WIN32
+    if (jobs == 0) {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif /* !_WIN32 */
+    return jobs > 0 ? (size_t)jobs : 1;
+}
 
-    print_message("[==========] %"PRIdS " test(s) run.\n", tests_executed);
-    print_error("[  PASSED  ] %"PRIdS " test(s).\n", tests_executed - total_failed);
 
-    if (total_failed) {
+/*
+ * Returns the end of the job starting at begin: a setup function with
+ * everything up to and including its teardown, or a single test.
+ */
+static size_t next_test_job(const UnitTest * const tests, const size_t begin,
+                            const size_t number_of_tests) {
+    size_t depth = 0;
+    size_t current_test = begin;
+
+    do {
+        const UnitTest * const test = &tests[current_test++];
+        if (!test->function) {
+            continue;
+        }
+        if (test->function_type == UNIT_TEST_FUNCTION_TYPE_SETUP) {
+            depth ++;
+        } else if (test->function_type == UNIT_TEST_FUNCTION_TYPE_TEARDOWN &&
+                   depth) {
+            depth --;
+        }
+    } while (depth && current_test < number_of_tests);
+
+    return current_test;
+}
+
+
+/*
+ * Returns whether a name matches a glob pattern of the given length, where
+ * '*' matches any characters and '?' any one character.
+ */
+static int glob_matches(const char * const pattern, const size_t length,
+                        const char *name) {
+    const char *star_name = NULL;
+    size_t star = 0;
+    size_t p = 0;
+
+    while (*name) {
+        if (p < length && (pattern[p] == '?' || pattern[p] == *name)) {
+            p ++;
+            name ++;
+        } else if (p < length && pattern[p] == '*') {
+            star = ++p;
+            star_name = name;
+        } else if (star_name) {
+            /* Let the last '*' match one more character. */
+            p = star;
+            name = ++star_name;
+        } else {
+            return 0;
+        }
+    }
+    while (p < length && pattern[p] == '*') {
+        p ++;
+    }
+    return p == length;
+}
+
+
+/*
+ * Returns whether a test name is selected by a filter of ':' separated glob
+ * patterns.  Patterns starting with '-' exclude the tests they match, the
+ * others include them; with only excluding patterns all the other tests are
+ * included.
+ */
+static int filter_matches(const char * const filter, const char * const name) {
+    const char *pattern = filter;
+    int has_includes = 0;
+    int included = 0;
+
+    while (*pattern) {
+        const char * const end = strchr(pattern, ':');
+        const size_t length = end ? (size_t)(end - pattern) : strlen(pattern);
+        if (*pattern == '-') {
+            if (glob_matches(pattern + 1, length - 1, name)) {
+                return 0;
+            }
+        } else if (length) {
+            has_includes = 1;
+            included = included || glob_matches(pattern, length, name);
+        }
+        pattern += length + (end != NULL);
+    }
+    return included || !has_includes;
+}
+
+
+/* Returns a hash of a test name that's the same on every run. */
+static size_t test_name_hash(const char *name) {
+    size_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash & 0xFFFFFFFFu;
+}
+
+
+/* Returns the value of an integer environment variable, or default_value. */
+static int get_int_env(const char * const name, const int default_value) {
+    const char * const env = getenv(name);
+    return (env && *env) ? atoi(env) : default_value;
+}
+
+
+/*
+ * Copies the tests selected by the filter and the shard to selected_tests,
+ * and returns their number.  Setup and teardown functions are kept with the
+ * tests they belong to, and a whole setup/teardown group is in the shard
+ * chosen by the hash of the name of its first test.
+ */
+static size_t select_tests(const UnitTest * const tests,
+                           const size_t number_of_tests,
+                           const char * const filter,
+                           const size_t shard_index, const size_t shard_total,
+                           UnitTest * const selected_tests) {
+    size_t number_of_selected_tests = 0;
+    size_t begin = 0;
+
+    while (begin < number_of_tests) {
+        const size_t end = next_test_job(tests, begin, number_of_tests);
+        const char *name = NULL;
+        int has_tests = 0;
+        size_t i;
+
+        for (i = begin; i < end && !name; i++) {
+            if (tests[i].function &&
+                tests[i].function_type == UNIT_TEST_FUNCTION_TYPE_TEST) {
+                name = tests[i].name;
+            }
+        }
+        if (name && test_name_hash(name) % shard_total == shard_index) {
+            for (i = begin; i < end; i++) {
+                if (tests[i].function &&
+                    tests[i].function_type == UNIT_TEST_FUNCTION_TYPE_TEST &&
+                    (!filter || filter_matches(filter, tests[i].name))) {
+                    has_tests = 1;
+                }
+            }
+        }
+        for (i = begin; has_tests && i < end; i++) {
+            if (!tests[i].function ||
+                (tests[i].function_type == UNIT_TEST_FUNCTION_TYPE_TEST &&
+                 filter && !filter_matches(filter, tests[i].name))) {
+                continue;
+            }
+            selected_tests[number_of_selected_tests++] = tests[i];
+        }
+        begin = end;
+    }
+    return number_of_selected_tests;
+}
+
+
+#ifndef _WIN32
+/*
+ * Streams read from the process of a test job. Its stdout and stderr share
+ * one pipe, so their output keeps the order it was written in.
+ */
+enum {
+    TEST_STREAM_OUTPUT,
+    TEST_STREAM_RESULT,
+    TEST_STREAMS
+};
+
+/* Number of counters leading a test job's result, see run_test_job(). */
+#define TEST_RESULT_COUNTERS 6
+
+/* Data read from a stream. */
+typedef struct TestBuffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+} TestBuffer;
+
+/* Tests that have to run in the same process. */
+typedef struct TestJob {
+    size_t begin;
+    size_t end;
+    pid_t pid;
+    /* Read ends of the pipes, -1 once closed. */
+    int fds[TEST_STREAMS];
+    TestBuffer output[TEST_STREAMS];
+    int status;
+    int started;
+    int finished;
+} TestJob;
+
+
+static void append_test_buffer(TestBuffer * const buffer,
+                               const char * const data, const size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        char *new_data;
+        while (capacity < buffer->size + size) {
+            capacity *= 2;
+        }
+        new_data = (char*)malloc(capacity);
+        if (buffer->data) {
+            memcpy(new_data, buffer->data, buffer->size);
+            free(buffer->data);
+        }
+        buffer->data = new_data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+
+static int write_all(const int fd, const void * const data, const size_t size) {
+    const char *pos = (const char*)data;
+    size_t left = size;
+
+    while (left) {
+        const ssize_t written = write(fd, pos, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        pos += written;
+        left -= (size_t)written;
+    }
+    return 0;
+}
+
+
+/*
+ * Runs a job in a forked process and writes its result to fd: the
+ * TEST_RESULT_COUNTERS counters, the indexes of the failed tests and the
+ * TestResults.
+ */
+static void run_test_job(const UnitTest * const tests,
+                         const TestJob * const job, const int fd) {
+    TestRun run;
+    size_t counters[TEST_RESULT_COUNTERS];
+
+    initialize_test_run(&run, job->end - job->begin);
+    run_test_range(tests, job->begin, job->end, &run);
+
+    counters[0] = run.tests_executed;
+    counters[1] = run.total_failed;
+    counters[2] = run.setups;
+    counters[3] = run.teardowns;
+    counters[4] = run.number_of_test_states;
+    counters[5] = run.number_of_results;
+    fflush(NULL);
+    if (write_all(fd, counters, sizeof(counters)) ||
+        write_all(fd, run.failed_tests,
+                  run.total_failed * sizeof(*run.failed_tests)) ||
+        write_all(fd, run.results,
+                  run.number_of_results * sizeof(*run.results))) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+
+static int start_test_job(const UnitTest * const tests, TestJob * const job) {
+    int pipes[TEST_STREAMS][2];
+    size_t i;
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        pipes[i][0] = pipes[i][1] = -1;
+    }
+    for (i = 0; i < TEST_STREAMS; i++) {
+        if (pipe(pipes[i]) != 0) {
+            goto error;
+        }
+    }
+
+    /* Don't let the child print what is still buffered here. */
+    fflush(NULL);
+    job->pid = fork();
+    if (job->pid < 0) {
+        goto error;
+    }
+
+    if (job->pid == 0) {
+        for (i = 0; i < TEST_STREAMS; i++) {
+            close(pipes[i][0]);
+        }
+        if (dup2(pipes[TEST_STREAM_OUTPUT][1], STDOUT_FILENO) < 0 ||
+            dup2(pipes[TEST_STREAM_OUTPUT][1], STDERR_FILENO) < 0) {
+            _exit(1);
+        }
+        /* Flush stdout by line as on a terminal, so it interleaves with stderr. */
+        setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+        run_test_job(tests, job, pipes[TEST_STREAM_RESULT][1]);
+    }
+
+    for (i = 0; i < TEST_STREAMS; i++) {
+        close(pipes[i][1]);
+        job->fds[i] = pipes[i][0];
+    }
+    job->started = 1;
+    return 0;
+
+error:
+    for (i = 0; i < TEST_STREAMS; i++) {
+        if (pipes[i][0] >= 0) {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * Reads the output of the running jobs in [first, last) until at least one
+ * of them finishes, and returns the number of jobs that finished.
+ */
+static size_t wait_test_jobs(TestJob * const jobs, const size_t first,
+                             const size_t last, struct pollfd * const fds,
+                             size_t * const fd_jobs) {
+    size_t finished = 0;
+
+    while (!finished) {
+        size_t number_of_fds = 0;
         size_t i;
-        print_error("[  FAILED  ] %"PRIdS " test(s), listed below:\n", total_failed);
-        for (i = 0; i < total_failed; i++) {
-            print_error("[  FAILED  ] %s\n", failed_names[i]);
+
+        for (i = first; i < last; i++) {
+            size_t stream;
+            if (!jobs[i].started || jobs[i].finished) {
+                continue;
+            }
+            for (stream = 0; stream < TEST_STREAMS; stream++) {
+                if (jobs[i].fds[stream] >= 0) {
+                    fds[number_of_fds].fd = jobs[i].fds[stream];
+                    fds[number_of_fds].events = POLLIN;
+                    fds[number_of_fds].revents = 0;
+                    fd_jobs[number_of_fds++] = i * TEST_STREAMS + stream;
+                }
+            }
+        }
+
+        if (number_of_fds &&
+            poll(fds, (nfds_t)number_of_fds, -1) < 0 && errno != EINTR) {
+            print_error("poll() failed\n");
+            exit_test(1);
+        }
+
+        for (i = 0; i < number_of_fds; i++) {
+            TestJob * const job = &jobs[fd_jobs[i] / TEST_STREAMS];
+            const size_t stream = fd_jobs[i] % TEST_STREAMS;
+            char data[4096];
+            ssize_t size;
+
+            if (!fds[i].revents) {
+                continue;
+            }
+            size = read(fds[i].fd, data, sizeof(data));
+            if (size > 0) {
+                append_test_buffer(&job->output[stream], data, (size_t)size);
+            } else if (size == 0 || errno != EINTR) {
+                close(job->fds[stream]);
+                job->fds[stream] = -1;
+            }
+        }
+
+        /* A job is done once its process closed all its streams. */
+        for (i = first; i < last; i++) {
+            TestJob * const job = &jobs[i];
+            if (!job->started || job->finished ||
+                job->fds[TEST_STREAM_OUTPUT] >= 0 ||
+                job->fds[TEST_STREAM_RESULT] >= 0) {
+                continue;
+            }
+            while (waitpid(job->pid, &job->status, 0) < 0 && errno == EINTR) {
+            }
+            job->finished = 1;
+            finished ++;
+        }
+    }
+
+    return finished;
+}
+
+
+/* Prints the output of a finished job and adds its result to run. */
+static void merge_test_job(const UnitTest * const tests, TestJob * const job,
+                           TestRun * const run) {
+    const TestBuffer * const result = &job->output[TEST_STREAM_RESULT];
+    const size_t * const counters = (const size_t*)result->data;
+    size_t i;
+
+    if (!job->started) {
+        /* The process couldn't be created, run the tests here instead. */
+        run_test_range(tests, job->begin, job->end, run);
+        return;
+    }
+
+    fwrite(job->output[TEST_STREAM_OUTPUT].data, 1,
+           job->output[TEST_STREAM_OUTPUT].size, stdout);
+    fflush(stdout);
+
+    if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0 &&
+        result->size >= sizeof(*counters) * TEST_RESULT_COUNTERS &&
+        result->size == sizeof(*counters) *
+                        (TEST_RESULT_COUNTERS + counters[1]) +
+                        sizeof(*run->results) * counters[5]) {
+        run->tests_executed += counters[0];
+        for (i = 0; i < counters[1]; i++) {
+            run->failed_tests[run->total_failed++] =
+                counters[TEST_RESULT_COUNTERS + i];
         }
+        run->setups += counters[2];
+        run->teardowns += counters[3];
+        run->number_of_test_states += counters[4];
+        memcpy(&run->results[run->number_of_results],
+               &counters[TEST_RESULT_COUNTERS + counters[1]],
+               sizeof(*run->results) * counters[5]);
+        run->number_of_results += counters[5];
+        return;
+    }
+
+    /* The process died in the middle, fail all of its tests. */
+    if (WIFSIGNALED(job->status)) {
+        print_error("[  ERROR   ] %s: process killed by signal %d\n",
+                    tests[job->begin].name, WTERMSIG(job->status));
     } else {
-        print_error("\n %"PRIdS " FAILED TEST(S)\n", total_failed);
+        print_error("[  ERROR   ] %s: process exited without a result\n",
+                    tests[job->begin].name);
+    }
+    for (i = job->begin; i < job->end; i++) {
+        if (tests[i].function &&
+            tests[i].function_type == UNIT_TEST_FUNCTION_TYPE_TEST) {
+            TestResult * const test_result =
+                &run->results[run->number_of_results++];
+            memset(test_result, 0, sizeof(*test_result));
+            test_result->test_index = i;
+            test_result->failed = 1;
+            run->failed_tests[run->total_failed++] = i;
+            run->tests_executed ++;
+        }
     }
+}
 
-    if (number_of_test_states) {
+
+/*
+ * Runs each setup/test/teardown group in its own forked process, up to jobs
+ * at a time.  The output of the processes is buffered and printed in the
+ * order of the tests, so it looks as if they ran one after the other.
+ */
+static void run_tests_parallel(const UnitTest * const tests,
+                               const size_t number_of_tests,
+                               const size_t jobs, TestRun * const run) {
+    TestJob * const test_jobs =
+        (TestJob*)malloc(number_of_tests * sizeof(*test_jobs));
+    struct pollfd * const fds =
+        (struct pollfd*)malloc(jobs * TEST_STREAMS * sizeof(*fds));
+    size_t * const fd_jobs =
+        (size_t*)malloc(jobs * TEST_STREAMS * sizeof(*fd_jobs));
+    size_t number_of_jobs = 0;
+    size_t next_start = 0;
+    size_t next_merge = 0;
+    size_t running = 0;
+    size_t current_test = 0;
+    size_t i;
+
+    memset(test_jobs, 0, number_of_tests * sizeof(*test_jobs));
+    while (current_test < number_of_tests) {
+        if (!tests[current_test].function) {
+            current_test ++;
+            continue;
+        }
+        test_jobs[number_of_jobs].begin = current_test;
+        current_test = next_test_job(tests, current_test, number_of_tests);
+        test_jobs[number_of_jobs++].end = current_test;
+    }
+
+    while (next_merge < number_of_jobs) {
+        while (running < jobs && next_start < number_of_jobs) {
+            if (start_test_job(tests, &test_jobs[next_start]) == 0) {
+                running ++;
+            } else {
+                test_jobs[next_start].finished = 1;
+            }
+            next_start ++;
+        }
+
+        if (!test_jobs[next_merge].finished) {
+            running -= wait_test_jobs(test_jobs, next_merge, next_start,
+                                      fds, fd_jobs);
+        }
+
+        while (next_merge < next_start && test_jobs[next_merge].finished) {
+            TestJob * const job = &test_jobs[next_merge++];
+            merge_test_job(tests, job, run);
+            for (i = 0; i < TEST_STREAMS; i++) {
+                if (job->output[i].data) {
+                    free(job->output[i].data);
+                }
+            }
+        }
+    }
+
+    free(fd_jobs);
+    free(fds);
+    free(test_jobs);
+}
+#endif /* !_WIN32 */
+
+
+/*
+ * Returns the value set by a cmocka_set_*() function, or else the value of
+ * the environment variable name, or NULL if neither is set.
+ */
+static const char *get_report_option(const char * const value,
+                                     const char * const name) {
+    const char *env;
+    if (value) {
+        return value;
+    }
+    env = getenv(name);
+    return (env && *env) ? env : NULL;
+}
+
+
+/* Returns the name of the test program for the reports. */
+static const char *get_suite_name(void) {
+#ifdef __GLIBC__
+    extern char *program_invocation_short_name;
+    if (!global_suite_name) {
+        return program_invocation_short_name;
+    }
+#endif /* __GLIBC__ */
+    return global_suite_name ? global_suite_name : "cmocka";
+}
+
+
+/* Sorts test results by decreasing wall time. */
+static int compare_test_times(const void *left, const void *right) {
+    const double a = ((const TestResult*)left)->wall_time;
+    const double b = ((const TestResult*)right)->wall_time;
+    return a > b ? -1 : a < b;
+}
+
+
+static void print_slowest_tests(const UnitTest * const tests,
+                                const TestRun * const run) {
+    const char * const env = getenv("CMOCKA_SLOWEST_TESTS");
+    size_t count = global_slowest_tests >= 0 ? (size_t)global_slowest_tests :
+                   (env ? (size_t)atoi(env) : 0);
+    TestResult *sorted;
+    size_t i;
+
+    if (count > run->number_of_results) {
+        count = run->number_of_results;
+    }
+    if (!count) {
+        return;
+    }
+
+    sorted = (TestResult*)malloc(run->number_of_results * sizeof(*sorted));
+    memcpy(sorted, run->results, run->number_of_results * sizeof(*sorted));
+    qsort(sorted, run->number_of_results, sizeof(*sorted),
+          compare_test_times);
+
+    print_message("[  SLOWEST ] %"PRIdS " slowest test(s):\n", count);
+    for (i = 0; i < count; i++) {
+        print_message("[  SLOWEST ] %s: %.3f ms (%.3f ms CPU), peak %"PRIdS
+                      " bytes, %"PRIdS " allocation(s)\n",
+                      tests[sorted[i].test_index].name,
+                      sorted[i].wall_time * 1e3, sorted[i].cpu_time * 1e3,
+                      sorted[i].peak_bytes, sorted[i].allocations);
+    }
+    free(sorted);
+}
+
+
+static void print_xml_escaped(FILE * const file, const char *text) {
+    for (; *text; text++) {
+        switch (*text) {
+        case '&':
+            fputs("&amp;", file);
+            break;
+        case '<':
+            fputs("&lt;", file);
+            break;
+        case '>':
+            fputs("&gt;", file);
+            break;
+        case '"':
+            fputs("&quot;", file);
+            break;
+        default:
+            fputc(*text, file);
+            break;
+        }
+    }
+}
+
+
+static void print_json_escaped(FILE * const file, const char *text) {
+    fputc('"', file);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') {
+            fputc('\\', file);
+            fputc(*text, file);
+        } else if ((unsigned char)*text < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned int)(unsigned char)*text);
+        } else {
+            fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
+
+
+/* Adds up the failures and the time of the tests in a run. */
+static size_t sum_test_results(const TestRun * const run,
+                               double * const total_time) {
+    size_t failures = 0;
+    size_t i;
+    *total_time = 0;
+    for (i = 0; i < run->number_of_results; i++) {
+        failures += run->results[i].failed != 0;
+        *total_time += run->results[i].wall_time;
+    }
+    return failures;
+}
+
+
+static void write_junit_report(const char * const path,
+                               const UnitTest * const tests,
+                               const TestRun * const run) {
+    FILE * const file = fopen(path, "w");
+    const char * const suite_name = get_suite_name();
+    double total_time;
+    const size_t failures = sum_test_results(run, &total_time);
+    size_t i;
+
+    if (!file) {
+        print_error("Could not open JUnit report %s\n", path);
+        return;
+    }
+
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(file, "<testsuites tests=\"%"PRIdS "\" failures=\"%"PRIdS "\" "
+            "time=\"%.6f\">\n", run->number_of_results, failures, total_time);
+    fprintf(file, "  <testsuite name=\"");
+    print_xml_escaped(file, suite_name);
+    fprintf(file, "\" tests=\"%"PRIdS "\" failures=\"%"PRIdS "\" "
+            "time=\"%.6f\">\n", run->number_of_results, failures, total_time);
+
+    for (i = 0; i < run->number_of_results; i++) {
+        const TestResult * const result = &run->results[i];
+        fprintf(file, "    <testcase name=\"");
+        print_xml_escaped(file, tests[result->test_index].name);
+        fprintf(file, "\" classname=\"");
+        print_xml_escaped(file, suite_name);
+        fprintf(file, "\" time=\"%.6f\"", result->wall_time);
+        if (!result->failed) {
+            fprintf(file, "/>\n");
+            continue;
+        }
+        fprintf(file, ">\n      <failure message=\"");
+        if (source_location_is_set(&result->failure)) {
+            print_xml_escaped(file, result->failure.file);
+            fprintf(file, ":%d", result->failure.line);
+        } else {
+            fprintf(file, "failed");
+        }
+        fprintf(file, "\"/>\n    </testcase>\n");
+    }
+
+    fprintf(file, "  </testsuite>\n</testsuites>\n");
+    fclose(file);
+}
+
+
+static void write_json_report(const char * const path,
+                              const UnitTest * const tests,
+                              const TestRun * const run) {
+    FILE * const file = fopen(path, "w");
+    double total_time;
+    const size_t failures = sum_test_results(run, &total_time);
+    size_t i;
+
+    if (!file) {
+        print_error("Could not open JSON report %s\n", path);
+        return;
+    }
+
+    fprintf(file, "{\n  \"name\": ");
+    print_json_escaped(file, get_suite_name());
+    fprintf(file, ",\n  \"tests\": %"PRIdS ",\n  \"failures\": %"PRIdS ",\n"
+            "  \"time\": %.6f,\n  \"testcases\": [", run->number_of_results,
+            failures, total_time);
+
+    for (i = 0; i < run->number_of_results; i++) {
+        const TestResult * const result = &run->results[i];
+        fprintf(file, "%s\n    {\"name\": ", i ? "," : "");
+        print_json_escaped(file, tests[result->test_index].name);
+        fprintf(file, ", \"status\": \"%s\"",
+                result->failed ? "failed" : "passed");
+        if (result->failed && source_location_is_set(&result->failure)) {
+            fprintf(file, ", \"failure\": ");
+            print_json_escaped(file, result->failure.file);
+            fprintf(file, ", \"failure_line\": %d", result->failure.line);
+        }
+        fprintf(file, ", \"time\": %.6f, \"cpu_time\": %.6f, "
+                "\"peak_bytes\": %"PRIdS ", \"allocations\": %"PRIdS "}",
+                result->wall_time, result->cpu_time, result->peak_bytes,
+                result->allocations);
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+}
+
+
+int _run_tests(const UnitTest * const all_tests,
+               const size_t number_of_all_tests) {
+    /* Check point of the heap state. */
+    const ListNode * const check_point = check_point_allocated_blocks();
+    /* Number of processes to run the tests in. */
+    const size_t jobs = get_test_jobs();
+    const char * const env_filter = getenv("CMOCKA_TEST_FILTER");
+    const char * const filter = global_test_filter ? global_test_filter :
+                                (env_filter && *env_filter ? env_filter : NULL);
+    const int shard_index = global_shard_index >= 0 ? global_shard_index :
+                            get_int_env("CMOCKA_SHARD_INDEX", 0);
+    const int shard_total = global_shard_total >= 0 ? global_shard_total :
+                            get_int_env("CMOCKA_SHARD_TOTAL", 1);
+    const int list_tests = global_list_tests >= 0 ? global_list_tests :
+                           get_int_env("CMOCKA_LIST_TESTS", 0);
+    const UnitTest *tests = all_tests;
+    size_t number_of_tests = number_of_all_tests;
+    UnitTest *selected_tests = NULL;
+    const char *junit_report;
+    const char *json_report;
+    TestRun run;
+
+    if (shard_total < 1 || shard_index < 0 || shard_index >= shard_total) {
+        print_error("[  ERROR   ] Invalid shard %d of %d\n", shard_index,
+                    shard_total);
+        return -1;
+    }
+    if (filter || shard_total > 1) {
+        selected_tests =
+            (UnitTest*)malloc(number_of_all_tests * sizeof(*selected_tests));
+        number_of_tests = select_tests(all_tests, number_of_all_tests, filter,
+                                       (size_t)shard_index,
+                                       (size_t)shard_total, selected_tests);
+        tests = selected_tests;
+    }
+
+    if (list_tests) {
+        size_t i;
+        for (i = 0; i < number_of_tests; i++) {
+            if (tests[i].function &&
+                tests[i].function_type == UNIT_TEST_FUNCTION_TYPE_TEST) {
+                print_message("%s\n", tests[i].name);
+            }
+        }
+        if (selected_tests) {
+            free(selected_tests);
+        }
+        return 0;
+    }
+
+    initialize_test_run(&run, number_of_tests);
+
+    print_message("[==========] Running %"PRIdS " test(s).\n", number_of_tests);
+
+    /* Make sure LargestIntegralType is at least the size of a pointer. */
+    assert_true(sizeof(LargestIntegralType) >= sizeof(void*));
+
+#ifndef _WIN32
+    if (jobs > 1) {
+        run_tests_parallel(tests, number_of_tests, jobs, &run);
+    } else
+#endif /* !_WIN32 */
+    {
+        (void)jobs;
+        run_test_range(tests, 0, number_of_tests, &run);
+    }
+
+    print_message("[==========] %"PRIdS " test(s) run.\n", run.tests_executed);
+    print_error("[  PASSED  ] %"PRIdS " test(s).\n",
+                run.tests_executed - run.total_failed);
+
+    if (run.total_failed) {
+        size_t i;
+        print_error("[  FAILED  ] %"PRIdS " test(s), listed below:\n",
+                    run.total_failed);
+        for (i = 0; i < run.total_failed; i++) {
+            print_error("[  FAILED  ] %s\n", tests[run.failed_tests[i]].name);
+        }
+    } else {
+        print_error("\n %"PRIdS " FAILED TEST(S)\n", run.total_failed);
+    }
+
+    print_slowest_tests(tests, &run);
+    junit_report = get_report_option(global_junit_report,
+                                     "CMOCKA_JUNIT_REPORT");
+    if (junit_report) {
+        write_junit_report(junit_report, tests, &run);
+    }
+    json_report = get_report_option(global_json_report, "CMOCKA_JSON_REPORT");
+    if (json_report) {
+        write_json_report(json_report, tests, &run);
+    }
+
+    if (run.number_of_test_states) {
         print_error("[  ERROR   ] Mismatched number of setup %"PRIdS " and "
-                    "teardown %"PRIdS " functions\n", setups, teardowns);
-        total_failed = (size_t)-1;
+                    "teardown %"PRIdS " functions\n", run.setups, run.teardowns);
+        run.total_failed = (size_t)-1;
     }
 
-    free(test_states);
-    free((void*)failed_names);
+    free_test_run(&run);
+    if (selected_tests) {
+        free(selected_tests);
+    }
+    free_arena();
 
     fail_if_blocks_allocated(check_point, "run_tests");
-    return (int)total_failed;
+    return (int)run.total_failed;
 }